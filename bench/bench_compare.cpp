@@ -0,0 +1,264 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compares two encryptor_bench JSON results case by case and fails if throughput dropped
+ * by more than the tolerance. Used by the perf tests and handy on its own before a merge.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <format>
+#include <map>
+#include <vector>
+#include <string>
+#include <cctype>
+#include <cstdlib>
+#include <exception>
+
+#include "utilities/exception.h"
+
+#include "include/cxxopts.hpp"
+
+namespace {
+    // The fields of one result that are compared; throughput higher is better, CPU time lower is better
+    struct Metric {
+        const char* name;
+        bool higher_is_better;
+    };
+
+    constexpr Metric METRICS[]{
+        { "encrypt_mb_s", true }, { "decrypt_mb_s", true }, { "encrypt_cpu_s", false }, { "decrypt_cpu_s", false },
+    };
+
+    using BenchResults = std::map<std::string, std::map<std::string, double>>;
+
+    /*
+     * @brief Just enough of a JSON reader for encryptor_bench output: objects, arrays,
+     * strings without escapes beyond \" and \\, numbers, true, false and null
+     */
+    class JsonReader {
+    public:
+        explicit JsonReader(const std::string& text) : text(text) {}
+
+        // Collects the numeric fields of every object in the "results" array, keyed by "name"
+        BenchResults read_results() {
+            BenchResults results;
+            expect('{');
+            while (!consume('}')) {
+                std::string key = read_string();
+                expect(':');
+                if (key == "results") {
+                    expect('[');
+                    while (!consume(']')) {
+                        read_result(results);
+                        consume(',');
+                    }
+                }
+                else {
+                    skip_value();
+                }
+                consume(',');
+            }
+            return results;
+        }
+
+    private:
+        void read_result(BenchResults& results) {
+            std::string name;
+            std::map<std::string, double> fields;
+
+            expect('{');
+            while (!consume('}')) {
+                std::string key = read_string();
+                expect(':');
+                skip_space();
+                if (key == "name") name = read_string();
+                else if (position < text.size() && (text[position] == '-' || std::isdigit(static_cast<unsigned char>(text[position])))) fields[key] = read_number();
+                else skip_value();
+                consume(',');
+            }
+
+            if (name.empty()) throw UtilException("A result has no name");
+            results[name] = fields;
+        }
+
+        void skip_space() {
+            while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) ++position;
+        }
+
+        bool consume(char c) {
+            skip_space();
+            if (position < text.size() && text[position] == c) {
+                ++position;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c) {
+            if (!consume(c)) throw UtilException(std::format("Expected `{}` at offset {}", c, position));
+        }
+
+        std::string read_string() {
+            expect('"');
+            std::string value;
+            while (position < text.size() && text[position] != '"') {
+                if (text[position] == '\\' && position + 1 < text.size()) ++position;
+                value += text[position++];
+            }
+            expect('"');
+            return value;
+        }
+
+        double read_number() {
+            size_t start = position;
+            while (position < text.size() && std::string_view("+-.eE0123456789").find(text[position]) != std::string_view::npos) ++position;
+            return std::strtod(text.substr(start, position - start).c_str(), nullptr);
+        }
+
+        void skip_value() {
+            skip_space();
+            if (position >= text.size()) throw UtilException("Unexpected end of JSON");
+
+            char c = text[position];
+            if (c == '"') {
+                read_string();
+            }
+            else if (c == '{' || c == '[') {
+                char close = c == '{' ? '}' : ']';
+                ++position;
+                while (!consume(close)) {
+                    if (c == '{') {
+                        read_string();
+                        expect(':');
+                    }
+                    skip_value();
+                    consume(',');
+                }
+            }
+            else {
+                while (position < text.size() && text[position] != ',' && text[position] != '}' && text[position] != ']') ++position;
+            }
+        }
+
+        const std::string& text;
+        size_t position{ 0 };
+    };
+
+    BenchResults load_results(const std::string& path) {
+        std::ifstream file(path);
+        if (!file.is_open()) throw FileError("Error: Couldn't open `" + path + '`');
+
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string text = contents.str();
+
+        try {
+            return JsonReader(text).read_results();
+        }
+        catch (const UtilException& e) {
+            throw UtilException(std::format("`{}` isn't encryptor_bench JSON: {}", path, e.what()));
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options("bench_compare", "Compares two encryptor_bench JSON results and fails on throughput regressions");
+
+    try {
+        options.add_options()
+            ("baseline", "Baseline JSON", cxxopts::value<std::string>())
+            ("current", "JSON to check against the baseline", cxxopts::value<std::string>())
+            ("t,tolerance", "Allowed throughput drop, in percent", cxxopts::value<double>()->default_value("10"))
+            ("cpu", "Also fail when CPU time grows by more than the tolerance")
+            ("h,help", "Print usage");
+
+        options.parse_positional({ "baseline", "current" });
+        options.positional_help("<baseline.json> <current.json>");
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("h") || !result.count("baseline") || !result.count("current")) {
+            std::cout << options.help();
+            return result.count("h") ? 0 : 1;
+        }
+
+        double tolerance = result["tolerance"].as<double>();
+        bool check_cpu = result.count("cpu") > 0;
+        BenchResults baseline = load_results(result["baseline"].as<std::string>());
+        BenchResults current = load_results(result["current"].as<std::string>());
+
+        int regressions = 0;
+        std::cout << std::format("{:<20} {:<14} {:>10} {:>10} {:>8}", "case", "metric", "baseline", "current", "change") << std::endl;
+
+        for (const auto& [name, baseline_fields] : baseline) {
+            auto current_case = current.find(name);
+            if (current_case == current.end()) {
+                // A renamed or dropped case would otherwise pass unchecked
+                std::cout << std::format("{:<20} missing from the current results  REGRESSION", name) << std::endl;
+                ++regressions;
+                continue;
+            }
+
+            for (const Metric& metric : METRICS) {
+                auto before = baseline_fields.find(metric.name);
+                auto after = current_case->second.find(metric.name);
+                if (before == baseline_fields.end() || after == current_case->second.end() || before->second <= 0) continue;
+
+                // Positive is always an improvement, whichever direction the metric goes
+                double change = (after->second - before->second) / before->second * 100.0;
+                if (!metric.higher_is_better) change = -change;
+                if (change == 0) change = 0; // Print +0.0% rather than -0.0%
+
+                bool checked = metric.higher_is_better || check_cpu;
+                bool regressed = checked && change < -tolerance;
+                if (regressed) ++regressions;
+
+                std::cout << std::format("{:<20} {:<14} {:>10.2f} {:>10.2f} {:>+7.1f}%{}", name, metric.name,
+                    before->second, after->second, change, regressed ? "  REGRESSION" : "") << std::endl;
+            }
+        }
+
+        // A case added since the baseline was recorded isn't checked until the baseline is recorded again
+        int unchecked = 0;
+        for (const auto& [name, fields] : current) {
+            if (baseline.contains(name)) continue;
+            std::cout << std::format("{:<20} has no baseline; record the baseline again  UNCHECKED", name) << std::endl;
+            ++unchecked;
+        }
+
+        if (regressions > 0 || unchecked > 0) {
+            if (regressions > 0) std::cout << std::format("{} metrics or cases regressed by more than {}%", regressions, tolerance) << std::endl;
+            if (unchecked > 0) std::cout << std::format("{} cases have no baseline", unchecked) << std::endl;
+            return 1;
+        }
+
+        std::cout << std::format("No regressions beyond {}%", tolerance) << std::endl;
+        return 0;
+    }
+    catch (const cxxopts::exceptions::exception& e) {
+        std::cerr << "Error parsing arguments: " << e.what() << std::endl;
+        std::cout << options.help();
+        return 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception thrown: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,371 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Benchmarks the encrypt/decrypt engine on a generated file, once per I/O configuration.
+ * Each timed phase starts with the input evicted from the page cache and ends once the
+ * output is on disk, so the numbers reflect the filesystem and not just memcpy into the cache.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <format>
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <exception>
+
+#include "src/encrypt.hpp"
+#include "src/decrypt.hpp"
+#include "src/kernel.hpp"
+#include "utilities/file_io.h"
+#include "utilities/exception.h"
+#include "utilities/parse_size.h"
+#include "utilities/buffer_pool.h"
+#include "utilities/source_sink.h"
+#include "utilities/digests.h"
+
+#include "include/cxxopts.hpp"
+#include <sodium/core.h>
+#include <sodium/randombytes.h>
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#if defined(__linux__)
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+    #include <linux/fiemap.h>
+#endif
+
+namespace {
+    // Which I/O path the engine runs against: the path overloads, or a Source/Sink pair
+    enum class Backend {
+        Path,
+        Mmap,
+        FdBuffered,
+    };
+
+    struct BenchCase {
+        std::string name;
+        IoOptions options;
+        bool kernel_crypto{ false };
+        Backend backend{ Backend::Path };
+    };
+
+    struct Timing {
+        double wall_seconds{ 0 };
+        double cpu_seconds{ 0 };
+    };
+
+    struct BenchResult {
+        std::string name;
+        Timing encrypt;
+        Timing decrypt;
+        long long extents{ -1 };
+    };
+
+    // Puts a stream's buffer back even if a phase throws, so the stream never points at a destroyed buffer
+    struct StreamRedirect {
+        std::ostream& stream;
+        std::streambuf* original;
+
+        StreamRedirect(std::ostream& stream, std::streambuf* buffer) : stream(stream), original(stream.rdbuf(buffer)) {}
+        ~StreamRedirect() { stream.rdbuf(original); }
+
+        StreamRedirect(const StreamRedirect&) = delete;
+        StreamRedirect& operator=(const StreamRedirect&) = delete;
+    };
+
+    void write_random_file(const std::string& path, uint64_t size) {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) throw FileError("Error: Couldn't create `" + path + '`');
+
+        std::vector<unsigned char> block(1024 * 1024);
+        while (size > 0) {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(size, block.size()));
+            randombytes_buf(block.data(), count);
+            file.write(reinterpret_cast<const char*>(block.data()), count);
+            size -= count;
+        }
+    }
+
+    // Makes the file durable so the timing includes writeback, not just the page cache
+    void sync_file(const std::string& path) {
+    #if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        fsync(fd);
+        ::close(fd);
+    #else
+        (void)path;
+    #endif
+    }
+
+    // Drops the file's clean pages so the next read comes from disk
+    void evict_file(const std::string& path) {
+    #if defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    #else
+        (void)path;
+    #endif
+    }
+
+    long long count_extents(const std::string& path) {
+    #if defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return -1;
+
+        struct fiemap map {};
+        map.fm_length = FIEMAP_MAX_OFFSET;
+        map.fm_flags = FIEMAP_FLAG_SYNC;
+        map.fm_extent_count = 0; // Only count them
+
+        long long extents = ioctl(fd, FS_IOC_FIEMAP, &map) == 0 ? map.fm_mapped_extents : -1;
+        ::close(fd);
+        return extents;
+    #else
+        (void)path;
+        return -1;
+    #endif
+    }
+
+    // Runs one phase through a Source/Sink backend: `transform` is the Source/Sink overload of encrypt or decrypt
+    void run_backend(Backend backend, const std::string& input_path, const std::string& output_path,
+        const std::function<void(Source&, Sink&)>& transform) {
+    #if !defined(_WIN32)
+        int output_fd = ::open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (output_fd < 0) throw FileError("Error: Couldn't create `" + output_path + '`');
+        FdSink fd_sink(output_fd);
+        BufferedSink sink(fd_sink);
+
+        if (backend == Backend::Mmap) {
+            MmapSource source(input_path);
+            transform(source, sink);
+        }
+        else {
+            int input_fd = ::open(input_path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (input_fd < 0) {
+                ::close(output_fd);
+                throw FileError("Error: Couldn't open `" + input_path + '`');
+            }
+            FdSource fd_source(input_fd);
+            BufferedSource source(fd_source);
+            transform(source, sink);
+            ::close(input_fd);
+        }
+
+        sink.close();
+        ::close(output_fd);
+    #else
+        (void)backend; (void)input_path; (void)output_path; (void)transform;
+        throw UtilException("The Source/Sink backends are only benchmarked on POSIX systems");
+    #endif
+    }
+
+    Timing time_phase(const std::function<void()>& phase) {
+        auto wall_start = std::chrono::steady_clock::now();
+        std::clock_t cpu_start = std::clock();
+
+        phase();
+
+        Timing timing;
+        timing.cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+        timing.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        return timing;
+    }
+
+    double megabytes_per_second(uint64_t size, const Timing& timing) {
+        return timing.wall_seconds > 0 ? static_cast<double>(size) / (1024.0 * 1024.0) / timing.wall_seconds : 0;
+    }
+
+    std::string to_json(uint64_t size, int runs, const std::vector<BenchResult>& results) {
+        std::ostringstream json;
+        json << "{\n  \"benchmark\": \"encryptor_bench\",\n";
+        json << std::format("  \"size_bytes\": {},\n  \"runs\": {},\n  \"results\": [\n", size, runs);
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& result = results[i];
+            json << "    {";
+            json << std::format("\"name\": \"{}\", ", result.name);
+            json << std::format("\"encrypt_mb_s\": {:.2f}, \"encrypt_cpu_s\": {:.3f}, ", megabytes_per_second(size, result.encrypt), result.encrypt.cpu_seconds);
+            json << std::format("\"decrypt_mb_s\": {:.2f}, \"decrypt_cpu_s\": {:.3f}, ", megabytes_per_second(size, result.decrypt), result.decrypt.cpu_seconds);
+            json << std::format("\"extents\": {}", result.extents);
+            json << (i + 1 < results.size() ? "},\n" : "}\n");
+        }
+
+        json << "  ]\n}\n";
+        return json.str();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    cxxopts::Options options("encryptor_bench", "Benchmarks encryption and decryption throughput per I/O configuration");
+
+    try {
+        options.add_options()
+            ("s,size", "Size of the generated input (suffixes K, M, G)", cxxopts::value<std::string>()->default_value("1G"))
+            ("dir", "Directory for the generated files", cxxopts::value<std::string>()->default_value("."))
+            ("r,runs", "Runs per case; the fastest one is reported", cxxopts::value<int>()->default_value("3"))
+            ("cases", "Comma-separated cases to run (default: all)", cxxopts::value<std::vector<std::string>>())
+            ("json", "Also write the results as JSON to this file", cxxopts::value<std::string>())
+            ("h,help", "Print usage");
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("h")) {
+            std::cout << options.help();
+            return 0;
+        }
+
+        if (sodium_init() < 0) {
+            std::cerr << "Error: Couldn't initialize libsodium" << std::endl;
+            return 1;
+        }
+
+        uint64_t size = parse_size(result["size"].as<std::string>());
+        int runs = std::max(1, result["runs"].as<int>());
+        std::filesystem::path dir = result["dir"].as<std::string>();
+
+        IoOptions no_preallocate;
+        no_preallocate.preallocate = false;
+
+        IoOptions drop_cache;
+        drop_cache.drop_cache = true;
+
+        IoOptions direct;
+        direct.direct = true;
+
+        IoOptions digests;
+        digests.digest_part_size = 64ULL << 20;
+
+        std::vector<BenchCase> cases{
+            { "buffered", IoOptions{} },
+            { "no-preallocate", no_preallocate },
+            { "no-cache-pollution", drop_cache },
+            { "direct", direct },
+            { "digests", digests },
+            { "kernel-crypto", IoOptions{}, true },
+    #if !defined(_WIN32)
+            { "mmap", IoOptions{}, false, Backend::Mmap },
+            { "fd-buffered", IoOptions{}, false, Backend::FdBuffered },
+    #endif
+        };
+
+        if (result.count("cases")) {
+            auto selected = result["cases"].as<std::vector<std::string>>();
+            std::erase_if(cases, [&](const BenchCase& c) { return std::find(selected.begin(), selected.end(), c.name) == selected.end(); });
+        }
+
+        std::string input_path = (dir / "bench_input.bin").string();
+        std::string encrypted_path = (dir / "bench_output.enc").string();
+        std::string decrypted_path = (dir / "bench_output.dec").string();
+
+        std::cout << std::format("Generating {} bytes of input in `{}`", size, input_path) << std::endl;
+        write_random_file(input_path, size);
+
+        unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+        randombytes_buf(key, sizeof(key));
+
+        // The engine reports every file it writes; keep that out of the results
+        std::ostringstream discarded;
+        std::vector<BenchResult> results;
+
+        for (const BenchCase& bench_case : cases) {
+            BenchResult best;
+            best.name = bench_case.name;
+
+            for (int run = 0; run < runs; ++run) {
+                std::filesystem::remove(encrypted_path);
+                std::filesystem::remove(decrypted_path);
+
+                Timing encrypt_timing;
+                Timing decrypt_timing;
+                {
+                    StreamRedirect redirect(std::cout, discarded.rdbuf());
+
+                    evict_file(input_path);
+                    encrypt_timing = time_phase([&] {
+                        if (bench_case.backend != Backend::Path) {
+                            run_backend(bench_case.backend, input_path, encrypted_path, [&](Source& source, Sink& sink) { encrypt(source, sink, key); });
+                        }
+                        else if (bench_case.kernel_crypto) encrypt_kernel(input_path, encrypted_path, key, bench_case.options);
+                        else encrypt(input_path, encrypted_path, key, bench_case.options);
+                        sync_file(encrypted_path);
+                    });
+
+                    evict_file(encrypted_path);
+                    decrypt_timing = time_phase([&] {
+                        if (bench_case.backend != Backend::Path) {
+                            run_backend(bench_case.backend, encrypted_path, decrypted_path, [&](Source& source, Sink& sink) { decrypt(source, sink, key); });
+                        }
+                        else decrypt(encrypted_path, decrypted_path, key, bench_case.options);
+                        sync_file(decrypted_path);
+                    });
+                }
+                discarded.str("");
+
+                // The extents belong to the encrypted file of the reported encrypt run
+                if (run == 0 || encrypt_timing.wall_seconds < best.encrypt.wall_seconds) {
+                    best.encrypt = encrypt_timing;
+                    best.extents = count_extents(encrypted_path);
+                }
+                if (run == 0 || decrypt_timing.wall_seconds < best.decrypt.wall_seconds) best.decrypt = decrypt_timing;
+            }
+
+            std::cout << std::format("{:<20} encrypt {:.1f} MB/s ({:.2f} s CPU), decrypt {:.1f} MB/s ({:.2f} s CPU), {} extents",
+                best.name, megabytes_per_second(size, best.encrypt), best.encrypt.cpu_seconds,
+                megabytes_per_second(size, best.decrypt), best.decrypt.cpu_seconds, best.extents) << std::endl;
+            results.push_back(best);
+        }
+
+        BufferPoolStats pool_stats = BufferPool::instance().stats();
+        std::cout << std::format("Buffer pool: {} allocations, {} avoided", pool_stats.allocations, pool_stats.allocations_avoided) << std::endl;
+
+        std::filesystem::remove(input_path);
+        std::filesystem::remove(encrypted_path);
+        std::filesystem::remove(decrypted_path);
+        std::filesystem::remove(digest_manifest_path(encrypted_path));
+
+        if (result.count("json")) {
+            std::ofstream json_file(result["json"].as<std::string>());
+            json_file << to_json(size, runs, results);
+        }
+
+        return 0;
+    }
+    catch (const cxxopts::exceptions::exception& e) {
+        std::cerr << "Error parsing arguments: " << e.what() << std::endl;
+        std::cout << options.help();
+        return 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception thrown: " << e.what() << "\nThe benchmark will now terminate" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,18 @@
+# Merges the raw profiles Clang's instrumented binaries wrote into the file the USE phase reads
+
+find_program(LLVM_PROFDATA NAMES llvm-profdata)
+if(NOT LLVM_PROFDATA)
+    message(FATAL_ERROR "llvm-profdata is needed to merge Clang profiles")
+endif()
+
+file(GLOB raw_profiles "${PGO_DIR}/*.profraw")
+if(NOT raw_profiles)
+    message(FATAL_ERROR "No raw profiles in ${PGO_DIR}; did the training run use the instrumented build?")
+endif()
+
+execute_process(
+    COMMAND "${LLVM_PROFDATA}" merge "-output=${PGO_DIR}/merged.profdata" ${raw_profiles}
+    RESULT_VARIABLE merge_result)
+if(NOT merge_result EQUAL 0)
+    message(FATAL_ERROR "llvm-profdata merge failed (${merge_result})")
+endif()
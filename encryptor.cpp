@@ -16,15 +16,70 @@
 */
 
 #include <iostream>
+#include <format>
 #include <string>
+#include <vector>
+#include <filesystem>
+#include <memory>
 #include <exception>
 
 #include "utilities/exception.h"
+#include "utilities/get_secret_key.h"
+#include "utilities/file_io.h"
+#include "utilities/throttle.h"
+#include "utilities/buffer_pool.h"
+#include "utilities/perf_counters.h"
+#include "utilities/trace.h"
+#include "utilities/progress.h"
+#include "utilities/metrics.h"
+#include "utilities/parse_size.h"
 #include "src/encrypt.hpp"
 #include "src/decrypt.hpp"
+#include "src/indexed.hpp"
+#include "src/store.hpp"
+#include "src/pack.hpp"
+#include "src/kernel.hpp"
+#include "src/memfd.hpp"
+#include "src/exec.hpp"
+#include "src/records.hpp"
+#include "src/grep.hpp"
+#include "src/segmented.hpp"
 
+// File names may contain commas, so repeated options must not be split on them
+#define CXXOPTS_VECTOR_DELIMITER '\0'
 #include "include/cxxopts.hpp"
 #include <sodium/core.h>
+#include <sodium/utils.h>
+
+namespace {
+    // `name.ext` becomes `name.enc` or `name.dec`
+    std::string default_output_path(const std::string& input_file, bool encrypting) {
+        size_t last_dot_pos = input_file.find_last_of('.');
+
+        std::string base_name = "";
+
+        if (last_dot_pos == std::string::npos || last_dot_pos == 0) {
+            // Treat the whole name as the base
+            base_name = input_file;
+        }
+        else {
+            // Get the substring from the start up to the last dot
+            base_name = input_file.substr(0, last_dot_pos);
+        }
+
+        return base_name + (encrypting ? ".enc" : ".dec");
+    }
+
+    // Options that only the plain stream and --kernel-crypto engines route through IoOptions
+    constexpr const char* IO_OPTIONS[]{ "direct", "no-cache-pollution", "max-read-bps", "max-write-bps", "max-iops", "throttle-file", "trace", "progress" };
+
+    // Wipes the key however its scope is left, including by an exception
+    struct KeyWiper {
+        unsigned char* key;
+        size_t size;
+        ~KeyWiper() { sodium_memzero(key, size); }
+    };
+}
 
 int main(int argc, char* argv[]) {
     cxxopts::Options options("encryptor", "Encrypts or decrypts files");
@@ -33,11 +88,45 @@ int main(int argc, char* argv[]) {
     std::string output_file = "";
     try {
         options.add_options()
-            ("e,encrypt", "File to encrypt", cxxopts::value<std::string>())
-            ("d,decrypt", "File to decrypt", cxxopts::value<std::string>())
+            ("e,encrypt", "File to encrypt (repeat for a batch)", cxxopts::value<std::vector<std::string>>())
+            ("d,decrypt", "File to decrypt (repeat for a batch)", cxxopts::value<std::vector<std::string>>())
             ("o,output", "Output file (optional)", cxxopts::value<std::string>())
+            ("update", "With --encrypt, write a chunk-indexed container and, if the output already is one, reseal only the chunks that changed")
+            ("store", "Deduplicating chunk store directory: --encrypt adds the file to it and writes a recipe, --decrypt restores from a recipe", cxxopts::value<std::string>())
+            ("kernel-crypto", "With --encrypt, use the kernel's ChaCha20-Poly1305 through AF_ALG with the input spliced in (experimental, Linux; falls back to libsodium)")
+            ("records", "With --encrypt, write a record log: newline-delimited records (e.g. NDJSON logs) sealed in batches with an index of their time ranges, so they can be scanned in parallel")
+            ("time-field", "With --records, the top-level JSON field holding each record's timestamp (an integer, or RFC 3339 indexed as Unix milliseconds)", cxxopts::value<std::string>()->default_value("ts"))
+            ("from", "With --decrypt of a record log, only write the records stamped at or after this time, reading only the batches that can hold them", cxxopts::value<std::string>())
+            ("to", "With --decrypt of a record log, only write the records stamped at or before this time", cxxopts::value<std::string>())
+            ("segment-size", "With --encrypt, write numbered segment files of at most this size (suffixes K, M, G) next to an authenticated manifest, for parallel multipart uploads", cxxopts::value<std::string>())
+            ("digest-part-size", "With --encrypt, take SHA-256 digests of the ciphertext while writing it, in parts of this size (suffixes K, M, G; 0 for none) and whole, and save them to <output>.sha256.json", cxxopts::value<std::string>())
+            ("to-memfd", "With --decrypt, decrypt into a sealed memfd and pass it to the process listening on this UNIX socket instead of writing a file (Linux)", cxxopts::value<std::string>())
+            ("exec", "With --decrypt, run this shell command and stream the plaintext into its standard input instead of writing a file. Exits with the command's status", cxxopts::value<std::string>())
+            ("small", "With --encrypt, seal files under 4 KiB with a single read, AEAD call and write in a compact format only --decrypt and the path-based readers open")
+            ("no-preallocate", "Don't reserve the output's final size before writing it")
+            ("no-cache-pollution", "Keep the page-cache footprint bounded: drop input and output pages behind a sliding window (Linux)")
+            ("direct", "Use O_DIRECT with page-aligned buffers, bypassing the page cache (falls back to buffered I/O where unsupported)")
+            ("max-read-bps", "Limit reads to this many bytes per second (suffixes K, M, G)", cxxopts::value<std::string>())
+            ("max-write-bps", "Limit writes to this many bytes per second (suffixes K, M, G)", cxxopts::value<std::string>())
+            ("max-iops", "Limit reads and writes to this many requests per second", cxxopts::value<std::string>())
+            ("throttle-file", "Control file with max-read-bps=, max-write-bps= and max-iops= lines that replace the limits while running (re-read when it changes or on SIGHUP)", cxxopts::value<std::string>())
+            ("huge-pages", "Back I/O and chunk buffers with huge pages (MAP_HUGETLB, else transparent huge pages)")
+            ("lock-memory", "Pin I/O and chunk buffers in RAM so plaintext never reaches swap")
+            ("pool-stats", "Print buffer pool counters when done")
+            ("perf-counters", "Report cycles/byte, IPC, LLC misses and context switches per stage (Linux perf_event_open)")
+            ("trace", "Write a Chrome Trace Event timeline of per-chunk read, seal/open and write events", cxxopts::value<std::string>())
+            ("progress", "Show bytes done, throughput and ETA on stderr (--progress=json prints one JSON object per update)", cxxopts::value<std::string>()->implicit_value("text"))
+            ("metrics-file", "Write Prometheus metrics for node_exporter's textfile collector to this file, during the run and at the end", cxxopts::value<std::string>())
+            ("grep", "Search the plaintext of the encrypted files listed after the options for this literal pattern, in memory, and print the matching lines", cxxopts::value<std::string>())
+            ("regex", "With --grep, the pattern is an RE2 regular expression matched within each line; in lines over 1 MiB, a match across a 1 MiB piece boundary is missed")
+            ("offsets", "With --grep, print the byte offset of every match instead of the matching lines")
+            ("pack", "Seal the small files listed after the options into one pack (extract it with --decrypt)", cxxopts::value<std::string>())
+            ("files", "Files to pack", cxxopts::value<std::vector<std::string>>())
             ("h,help", "Print usage");
 
+        options.parse_positional({ "files" });
+        options.positional_help("[files to pack or search...]");
+
         auto result = options.parse(argc, argv);
 
         if (result.count("h") || argc == 1) {
@@ -51,48 +140,357 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
+        for (const char* io_option : IO_OPTIONS) {
+            if (!result.count(io_option)) continue;
+            if (result.count("pack") || result.count("grep") || result.count("update") || result.count("store") || result.count("records") ||
+                result.count("segment-size") || result.count("from") || result.count("to")) {
+                std::cerr << std::format("Error: --{} only applies to plain and --kernel-crypto files, so it can't be combined with --pack, --grep, --update, --store, --records, --segment-size, --from or --to\n", io_option) << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+        }
+
+        if (result.count("pack")) {
+            if (result.count("e") || result.count("d") || result.count("o") || result.count("update") || result.count("store") || result.count("grep")) {
+                std::cerr << "Error: --pack takes no other mode or output option\n" << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+            if (!result.count("files")) {
+                std::cerr << "Error: --pack needs at least one file to pack\n" << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+
+            if (sodium_init() < 0) {
+                std::cerr << "Error: Couldn't initialize libsodium" << std::endl;
+                return 1;
+            }
+
+            unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+            KeyWiper key_wiper{ key, sizeof(key) };
+            get_secret_key(key);
+            pack_files(result["files"].as<std::vector<std::string>>(), result["pack"].as<std::string>(), key);
+            return 0;
+        }
+
+        if ((result.count("regex") || result.count("offsets")) && !result.count("grep")) {
+            std::cerr << "Error: --regex and --offsets can only be used with --grep\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("grep")) {
+            if (result.count("e") || result.count("d") || result.count("o") || result.count("update") || result.count("store")) {
+                std::cerr << "Error: --grep takes no other mode or output option\n" << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+            if (!result.count("files")) {
+                std::cerr << "Error: --grep needs at least one file to search\n" << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+
+            if (sodium_init() < 0) {
+                std::cerr << "Error: Couldn't initialize libsodium" << std::endl;
+                return 1;
+            }
+
+            GrepOptions grep_options;
+            grep_options.regex = result.count("regex") > 0;
+            grep_options.offsets = result.count("offsets") > 0;
+
+            unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+            KeyWiper key_wiper{ key, sizeof(key) };
+            get_secret_key(key);
+            GrepSummary summary = grep_files(result["files"].as<std::vector<std::string>>(), result["grep"].as<std::string>(), key, grep_options, std::cout);
+
+            // Like grep: 0 if anything matched, 1 if nothing did, 2 if a file couldn't be searched
+            if (summary.files_failed > 0) return 2;
+            return summary.files_matched > 0 ? 0 : 1;
+        }
+
+        if (result.count("files")) {
+            std::cerr << "Error: Only --pack and --grep take a list of files\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("update") && !result.count("e")) {
+            std::cerr << "Error: --update can only be used with --encrypt (-e)\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("kernel-crypto") && (!result.count("e") || result.count("update") || result.count("store"))) {
+            std::cerr << "Error: --kernel-crypto can only be used with --encrypt (-e), without --update or --store\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("records") && (!result.count("e") || result.count("update") || result.count("store") || result.count("kernel-crypto"))) {
+            std::cerr << "Error: --records can only be used with --encrypt (-e), without --update, --store or --kernel-crypto\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("segment-size") && (!result.count("e") || result.count("update") || result.count("store") || result.count("kernel-crypto") || result.count("records"))) {
+            std::cerr << "Error: --segment-size can only be used with --encrypt (-e), without --update, --store, --kernel-crypto or --records\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("digest-part-size") && (!result.count("e") || result.count("update") || result.count("store") || result.count("kernel-crypto") || result.count("records") || result.count("segment-size"))) {
+            std::cerr << "Error: --digest-part-size can only be used with --encrypt (-e), without --update, --store, --kernel-crypto, --records or --segment-size\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if ((result.count("from") || result.count("to")) && (!result.count("d") || result.count("store"))) {
+            std::cerr << "Error: --from and --to can only be used with --decrypt (-d), without --store\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("to-memfd") && (!result.count("d") || result.count("o") || result.count("store"))) {
+            std::cerr << "Error: --to-memfd can only be used with --decrypt (-d), without --output (-o) or --store\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("exec") && (!result.count("d") || result.count("o") || result.count("store") || result.count("to-memfd"))) {
+            std::cerr << "Error: --exec can only be used with --decrypt (-d), without --output (-o), --store or --to-memfd\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if ((result.count("from") || result.count("to")) && (result.count("to-memfd") || result.count("exec"))) {
+            std::cerr << "Error: --from and --to write a file, so they can't be combined with --to-memfd or --exec\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("small") && (!result.count("e") || result.count("update") || result.count("store") || result.count("kernel-crypto") || result.count("records") || result.count("segment-size"))) {
+            std::cerr << "Error: --small can only be used with --encrypt (-e), without --update, --store, --kernel-crypto, --records or --segment-size\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("small") && (result.count("direct") || result.count("no-cache-pollution") || result.count("max-read-bps") || result.count("max-write-bps") ||
+            result.count("max-iops") || result.count("throttle-file") || result.count("perf-counters") || result.count("trace"))) {
+            std::cerr << "Error: --small does its own single read and write, so it can't be combined with --direct, --no-cache-pollution, throttling, --perf-counters or --trace\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (result.count("update") && result.count("store")) {
+            std::cerr << "Error: Cannot use --update and --store simultaneously\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        std::vector<std::string> input_files;
         if (result.count("e")) {
-            input_file = result["e"].as<std::string>();
+            input_files = result["e"].as<std::vector<std::string>>();
         }
         else if (result.count("d")) {
-            input_file = result["d"].as<std::string>();
+            input_files = result["d"].as<std::vector<std::string>>();
         }
         else {
-            std::cerr << "Error: You must specify a mode: --encrypt (-e) or --decrypt (-d)\n" << std::endl;
+            std::cerr << "Error: You must specify a mode: --encrypt (-e), --decrypt (-d) or --pack\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (input_files.size() > 1 && result.count("o")) {
+            std::cerr << "Error: --output (-o) takes a single input file; in a batch each output is named after its input\n" << std::endl;
+            std::cout << options.help();
+            return 1;
+        }
+
+        if (input_files.size() > 1 && (result.count("to-memfd") || result.count("exec"))) {
+            std::cerr << "Error: --to-memfd and --exec take a single input file\n" << std::endl;
             std::cout << options.help();
             return 1;
         }
 
+        RecordQuery record_query;
+        for (const char* bound : { "from", "to" }) {
+            if (!result.count(bound)) continue;
+            std::optional<int64_t> time = parse_record_time(result[bound].as<std::string>());
+            if (!time) {
+                std::cerr << std::format("Error: --{} takes an integer or an RFC 3339 time\n", bound) << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+            (std::string(bound) == "from" ? record_query.from : record_query.to) = time;
+        }
+
+        uint64_t segment_size = 0;
+        std::optional<uint64_t> digest_part_size;
+        for (const char* size_option : { "segment-size", "digest-part-size" }) {
+            if (!result.count(size_option)) continue;
+            try {
+                uint64_t size = parse_size(result[size_option].as<std::string>());
+                if (std::string(size_option) == "segment-size") segment_size = size;
+                else digest_part_size = size;
+            }
+            catch (const UtilException& e) {
+                std::cerr << std::format("Error: {} for --{}\n", e.what(), size_option) << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+        }
+
+        ProgressFormat progress_format = ProgressFormat::Text;
+        if (result.count("progress")) {
+            std::string format = result["progress"].as<std::string>();
+            if (format == "json") progress_format = ProgressFormat::Json;
+            else if (format != "text") {
+                std::cerr << "Error: --progress takes `text` or `json`\n" << std::endl;
+                std::cout << options.help();
+                return 1;
+            }
+        }
+
         if (sodium_init() < 0) {
             std::cerr << "Error: Couldn't initialize libsodium" << std::endl;
             return 1;
         }
 
-        if (result.count("o")) {
-            output_file = result["o"].as<std::string>();
+        std::vector<uint64_t> input_sizes;
+        uint64_t total_size = 0;
+        for (const std::string& path : input_files) {
+            std::error_code size_error;
+            uint64_t size = std::filesystem::file_size(path, size_error);
+            input_sizes.push_back(size_error ? 0 : size);
+            total_size += input_sizes.back();
+        }
+
+        IoOptions io_options;
+        io_options.preallocate = !result.count("no-preallocate");
+        io_options.drop_cache = result.count("no-cache-pollution") > 0;
+        io_options.direct = result.count("direct") > 0;
+        io_options.digest_part_size = digest_part_size;
+        io_options.small_format = result.count("small") > 0;
+
+        BufferPoolOptions pool_options;
+        pool_options.huge_pages = result.count("huge-pages") > 0;
+        pool_options.lock_memory = result.count("lock-memory") > 0;
+        BufferPool::instance().configure(pool_options);
+
+        std::unique_ptr<Throttle> throttle;
+        if (result.count("max-read-bps") || result.count("max-write-bps") || result.count("max-iops") || result.count("throttle-file")) {
+            ThrottleLimits limits;
+            if (result.count("max-read-bps")) limits.max_read_bps = parse_size(result["max-read-bps"].as<std::string>());
+            if (result.count("max-write-bps")) limits.max_write_bps = parse_size(result["max-write-bps"].as<std::string>());
+            if (result.count("max-iops")) limits.max_iops = parse_size(result["max-iops"].as<std::string>());
+
+            throttle = std::make_unique<Throttle>(limits, result.count("throttle-file") ? result["throttle-file"].as<std::string>() : "");
+            Throttle::install_reload_signal();
+            io_options.throttle = throttle.get();
+        }
+
+        std::unique_ptr<PerfCounters> perf_counters;
+        if (result.count("perf-counters")) {
+            perf_counters = std::make_unique<PerfCounters>();
+            io_options.perf = perf_counters.get();
         }
-        else {
-            size_t last_dot_pos = input_file.find_last_of('.');
 
-            std::string base_name = "";
+        std::unique_ptr<Trace> trace;
+        if (result.count("trace")) {
+            trace = std::make_unique<Trace>(result["trace"].as<std::string>());
+            io_options.trace = trace.get();
+        }
+
+        unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+        KeyWiper key_wiper{ key, sizeof(key) };
+        get_secret_key(key);
+
+        std::unique_ptr<Progress> progress;
+        if (result.count("progress")) {
+            progress = std::make_unique<Progress>(progress_format, total_size, input_files.size());
+            io_options.progress = progress.get();
+        }
+
+        std::unique_ptr<Metrics> metrics;
+        if (result.count("metrics-file")) {
+            metrics = std::make_unique<Metrics>(result["metrics-file"].as<std::string>());
+            io_options.metrics = metrics.get();
+        }
+
+        // In a batch, a file that fails is reported and the rest are still processed
+        size_t failed_files = 0;
+        int command_status = 0;
+        for (size_t i = 0; i < input_files.size(); ++i) {
+            input_file = input_files[i];
+            if (result.count("to-memfd") || result.count("exec")) output_file = "";
+            else output_file = result.count("o") ? result["o"].as<std::string>() : default_output_path(input_file, result.count("e") > 0);
+
+            if (progress) progress->begin_file(input_file, input_sizes[i]);
+            if (metrics) metrics->begin_file();
 
-            if (last_dot_pos == std::string::npos || last_dot_pos == 0) {
-                // Treat the whole name as the base
-                base_name = input_file;
+            try {
+                if (result.count("store")) {
+                    std::string store_dir = result["store"].as<std::string>();
+                    if (result.count("e")) store_file(input_file, output_file, store_dir, key);
+                    else restore_file(input_file, output_file, store_dir, key);
+                }
+                else if (result.count("e") && result.count("update")) encrypt_indexed(input_file, output_file, key);
+                else if (result.count("e") && result.count("records")) encrypt_record_log(input_file, output_file, key, result["time-field"].as<std::string>());
+                else if (result.count("e") && result.count("segment-size")) encrypt_segmented(input_file, output_file, key, segment_size);
+                else if (result.count("from") || result.count("to")) extract_records(input_file, output_file, key, record_query);
+                else if (result.count("e") && result.count("kernel-crypto")) encrypt_kernel(input_file, output_file, key, io_options);
+                else if (result.count("to-memfd")) {
+                    std::string socket_path = result["to-memfd"].as<std::string>();
+                    decrypt_to_socket(input_file, socket_path, key, io_options);
+                    std::cout << std::format("Passed the plaintext of `{}` to `{}` as a sealed memfd", input_file, socket_path) << std::endl;
+                }
+                else if (result.count("exec")) {
+                    command_status = decrypt_to_command(input_file, result["exec"].as<std::string>(), key, io_options);
+                }
+                else if (result.count("e")) encrypt(input_file, output_file, key, io_options);
+                else if (result.count("d")) decrypt(input_file, output_file, key, io_options);
             }
-            else {
-                // Get the substring from the start up to the last dot
-                base_name = input_file.substr(0, last_dot_pos);
+            catch (const std::exception& e) {
+                // Not only the library's own errors: a filesystem error or running out of memory fails just this file too
+                bool auth_failure = dynamic_cast<const AuthError*>(&e) != nullptr;
+                if (progress) progress->end_file();
+                if (metrics) metrics->end_file(false, auth_failure, 0, 0);
+
+                if (input_files.size() == 1) std::cerr << "Exception thrown: " << e.what() << "\nThe program will terminate" << std::endl;
+                else std::cerr << std::format("Skipping `{}`: {}", input_file, e.what()) << std::endl;
+                ++failed_files;
+                continue;
+            }
+
+            if (progress) progress->end_file();
+            if (metrics) {
+                std::error_code size_error;
+                uint64_t output_size = std::filesystem::file_size(output_file, size_error);
+                metrics->end_file(true, false, input_sizes[i], size_error ? 0 : output_size);
             }
+        }
 
-            if (result.count("e")) output_file = base_name + ".enc";
-            else output_file = base_name + ".dec";
+        if (progress) progress->finish();
+        if (metrics) metrics->finish();
+        if (trace) trace->finish();
+
+        if (perf_counters) perf_counters->report(std::cerr);
+
+        if (result.count("pool-stats")) {
+            BufferPoolStats stats = BufferPool::instance().stats();
+            std::cerr << std::format("Buffer pool: {} allocations, {} avoided, {} bytes pinned at peak, {} bytes in huge pages",
+                stats.allocations, stats.allocations_avoided, stats.peak_pinned_bytes, stats.huge_page_bytes) << std::endl;
         }
 
-        if (result.count("e")) encrypt(input_file, output_file);
-        else if (result.count("d")) decrypt(input_file, output_file);
+        if (failed_files > 0) {
+            if (input_files.size() > 1) std::cerr << std::format("Error: {} of {} files failed", failed_files, input_files.size()) << std::endl;
+            return 1;
+        }
 
-        return 0;
+        return command_status;
     }
     catch (const cxxopts::exceptions::exception& e) {
         std::cerr << "Error parsing arguments: " << e.what() << std::endl;
@@ -0,0 +1,372 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <format>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "src/async.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+#include "utilities/buffer_pool.h"
+
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+#include <sodium/utils.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    constexpr size_t HEADER_SIZE{ crypto_secretstream_xchacha20poly1305_HEADERBYTES };
+
+    // Records sealed or opened per trip to the executor, to amortise the hand-off
+    constexpr size_t BATCH_RECORDS{ 16 };
+    constexpr size_t PLAINTEXT_BATCH{ BATCH_RECORDS * STREAM_CHUNK_SIZE };
+    constexpr size_t CIPHERTEXT_BATCH{ BATCH_RECORDS * STREAM_RECORD_SIZE };
+
+    constexpr int MAX_EVENTS{ 64 };
+
+    void set_nonblocking(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+            throw FileError(std::format("Error: Couldn't make descriptor {} non-blocking: {}", fd, std::strerror(errno)));
+        }
+    }
+
+    // Reads until `size` bytes arrived or the input ended
+    task<size_t> read_full(AsyncSource& source, unsigned char* data, size_t size) {
+        size_t filled = 0;
+        while (filled < size) {
+            size_t count = co_await source.read(data + filled, size - filled);
+            if (count == 0) break;
+            filled += count;
+        }
+        co_return filled;
+    }
+
+    // Runs `work` on the executor if there is one, and inline otherwise
+    task<void> run_on(EventLoop& loop, CpuExecutor* executor, std::function<void()> work) {
+        if (executor) co_await executor->run(loop, std::move(work));
+        else work();
+    }
+}
+
+struct EventLoop::Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+EventLoop::EventLoop() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        if (epoll_fd >= 0) close(epoll_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        throw UtilException(std::format("Error: Couldn't set up the event loop: {}", std::strerror(errno)));
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+}
+
+EventLoop::~EventLoop() {
+    close(epoll_fd);
+    close(wake_fd);
+}
+
+// Waits on the loop's queue before starting, so spawn() never runs the task on the caller's stack
+EventLoop::Detached EventLoop::run_detached(EventLoop* loop, task<void> work) {
+    struct Yield {
+        EventLoop* loop;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { loop->ready.push_back(handle); }
+        void await_resume() const noexcept {}
+    };
+    co_await Yield{ loop };
+
+    try {
+        co_await work;
+    }
+    catch (...) {
+        if (!loop->first_error) loop->first_error = std::current_exception();
+    }
+    --loop->active;
+}
+
+void EventLoop::spawn(task<void> work) {
+    ++active;
+    run_detached(this, std::move(work));
+}
+
+void EventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+
+    while (active > 0) {
+        while (!ready.empty()) {
+            std::coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+        }
+        if (active == 0) break;
+
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw UtilException(std::format("Error: epoll_wait failed: {}", std::strerror(errno)));
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.fd != wake_fd) {
+                dispatch(events[i].data.fd, events[i].events);
+                continue;
+            }
+
+            uint64_t wakeups;
+            while (read(wake_fd, &wakeups, sizeof(wakeups)) > 0) {
+            }
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            ready.insert(ready.end(), posted.begin(), posted.end());
+            posted.clear();
+        }
+    }
+
+    if (first_error) std::rethrow_exception(std::exchange(first_error, nullptr));
+}
+
+void EventLoop::post(std::coroutine_handle<> handle) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        posted.push_back(handle);
+    }
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+bool EventLoop::wait_for(int fd, bool writing, std::coroutine_handle<> handle) {
+    FdWaiters& waiting = waiters[fd];
+    (writing ? waiting.writer : waiting.reader) = handle;
+
+    // Regular files can't be polled, and are always ready
+    epoll_event event{};
+    event.data.fd = fd;
+    event.events = EPOLLONESHOT | (waiting.reader ? EPOLLIN : 0u) | (waiting.writer ? EPOLLOUT : 0u);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0) return true;
+    if (errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) return true;
+
+    if (errno == EPERM) {
+        (writing ? waiting.writer : waiting.reader) = nullptr;
+        if (!waiting.reader && !waiting.writer) waiters.erase(fd);
+        return false;
+    }
+    throw UtilException(std::format("Error: Couldn't poll descriptor {}: {}", fd, std::strerror(errno)));
+}
+
+void EventLoop::arm(int fd, const FdWaiters& waiting) {
+    epoll_event event{};
+    event.data.fd = fd;
+    event.events = EPOLLONESHOT | (waiting.reader ? EPOLLIN : 0u) | (waiting.writer ? EPOLLOUT : 0u);
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void EventLoop::dispatch(int fd, uint32_t events) {
+    auto found = waiters.find(fd);
+    if (found == waiters.end()) return;
+    FdWaiters& waiting = found->second;
+
+    // Errors and hang-ups wake both sides, whose next read or write reports them
+    bool failed = events & (EPOLLERR | EPOLLHUP);
+    std::coroutine_handle<> reader = (events & EPOLLIN) || failed ? std::exchange(waiting.reader, nullptr) : nullptr;
+    std::coroutine_handle<> writer = (events & EPOLLOUT) || failed ? std::exchange(waiting.writer, nullptr) : nullptr;
+
+    // A one-shot event disarms the descriptor, so whoever is still waiting needs it rearmed
+    if (waiting.reader || waiting.writer) arm(fd, waiting);
+    else waiters.erase(found);
+
+    if (reader) ready.push_back(reader);
+    if (writer) ready.push_back(writer);
+}
+
+CpuExecutor::CpuExecutor(size_t threads) {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) workers.emplace_back(&CpuExecutor::work_loop, this);
+}
+
+CpuExecutor::~CpuExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void CpuExecutor::RunAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    executor->submit([this, handle] {
+        try {
+            work();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        loop->post(handle);
+    });
+}
+
+void CpuExecutor::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void CpuExecutor::work_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty()) return;
+
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+AsyncFdSource::AsyncFdSource(EventLoop& loop, int fd) : loop(loop), fd(fd) {
+    set_nonblocking(fd);
+}
+
+task<size_t> AsyncFdSource::read(unsigned char* data, size_t size) {
+    while (true) {
+        ssize_t result = ::read(fd, data, size);
+        if (result >= 0) co_return static_cast<size_t>(result);
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) co_await loop.readable(fd);
+        else if (errno != EINTR) throw FileError(std::format("Error: Couldn't read descriptor {}: {}", fd, std::strerror(errno)));
+    }
+}
+
+AsyncFdSink::AsyncFdSink(EventLoop& loop, int fd) : loop(loop), fd(fd) {
+    set_nonblocking(fd);
+}
+
+task<void> AsyncFdSink::write(const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t result = ::write(fd, data, size);
+        if (result >= 0) {
+            data += result;
+            size -= static_cast<size_t>(result);
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) co_await loop.writable(fd);
+        else if (errno != EINTR) throw FileError(std::format("Error: Couldn't write descriptor {}: {}", fd, std::strerror(errno)));
+    }
+}
+
+task<void> encrypt_async(EventLoop& loop, AsyncSource& source, AsyncSink& sink, const unsigned char* key, CpuExecutor* executor) {
+    crypto_secretstream_xchacha20poly1305_state crypto_state;
+    unsigned char header[HEADER_SIZE];
+    crypto_secretstream_xchacha20poly1305_init_push(&crypto_state, header, key);
+    co_await sink.write(header, HEADER_SIZE);
+
+    PooledBuffer plaintext = BufferPool::instance().acquire(PLAINTEXT_BATCH);
+    PooledBuffer ciphertext = BufferPool::instance().acquire(CIPHERTEXT_BATCH);
+
+    // Records are always full until the last, which is short (or empty) and carries the final tag
+    bool done = false;
+    while (!done) {
+        size_t filled = co_await read_full(source, plaintext.data(), PLAINTEXT_BATCH);
+        done = filled < PLAINTEXT_BATCH;
+
+        size_t sealed_size = 0;
+        co_await run_on(loop, executor, [&] {
+            size_t offset = 0;
+            while (offset < filled || (done && offset == filled)) {
+                size_t length = std::min(filled - offset, STREAM_CHUNK_SIZE);
+                bool last = done && length < STREAM_CHUNK_SIZE;
+
+                unsigned long long out_len;
+                crypto_secretstream_xchacha20poly1305_push(&crypto_state, ciphertext.data() + sealed_size, &out_len,
+                    plaintext.data() + offset, length, NULL, 0,
+                    last ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE);
+                sealed_size += static_cast<size_t>(out_len);
+                offset += length;
+                if (last) break;
+            }
+        });
+
+        co_await sink.write(ciphertext.data(), sealed_size);
+    }
+
+    sodium_memzero(&crypto_state, sizeof(crypto_state));
+}
+
+task<void> decrypt_async(EventLoop& loop, AsyncSource& source, AsyncSink& sink, const unsigned char* key, CpuExecutor* executor) {
+    unsigned char header[HEADER_SIZE];
+    if (co_await read_full(source, header, HEADER_SIZE) != HEADER_SIZE) throw AuthError("Decryption failed. The input is truncated");
+
+    crypto_secretstream_xchacha20poly1305_state crypto_state;
+    if (crypto_secretstream_xchacha20poly1305_init_pull(&crypto_state, header, key) != 0) throw KeyError("Invalid header or key");
+
+    PooledBuffer ciphertext = BufferPool::instance().acquire(CIPHERTEXT_BATCH);
+    PooledBuffer plaintext = BufferPool::instance().acquire(PLAINTEXT_BATCH);
+
+    bool final = false;
+    while (!final) {
+        // Batches hold whole records, so only the last read can end mid-record
+        size_t filled = co_await read_full(source, ciphertext.data(), CIPHERTEXT_BATCH);
+        if (filled == 0) throw AuthError("Decryption failed. The input is truncated");
+
+        size_t opened_size = 0;
+        size_t consumed = 0;
+        co_await run_on(loop, executor, [&] {
+            while (consumed < filled && !final) {
+                size_t length = std::min(filled - consumed, STREAM_RECORD_SIZE);
+                unsigned long long out_len;
+                unsigned char tag;
+                if (crypto_secretstream_xchacha20poly1305_pull(&crypto_state, plaintext.data() + opened_size, &out_len, &tag,
+                    ciphertext.data() + consumed, length, NULL, 0) != 0) {
+                    throw AuthError("Decryption failed. The input maybe corrupt");
+                }
+                opened_size += static_cast<size_t>(out_len);
+                consumed += length;
+                final = tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+            }
+        });
+
+        if (consumed < filled) throw AuthError("Decryption failed. The input has data after the end of the stream");
+        if (!final && filled < CIPHERTEXT_BATCH) throw AuthError("Decryption failed. The input is truncated");
+        co_await sink.write(plaintext.data(), opened_size);
+    }
+
+    unsigned char trailing;
+    if (co_await source.read(&trailing, 1) != 0) throw AuthError("Decryption failed. The input has data after the end of the stream");
+    sodium_memzero(&crypto_state, sizeof(crypto_state));
+}
+#endif
@@ -0,0 +1,282 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Coroutine API for event-loop services: a stream is encrypted or decrypted by a coroutine that
+ * suspends whenever its input or output would block, so one thread can keep thousands of streams
+ * in flight. Sealing and opening can be handed to a CpuExecutor to keep the loop responsive.
+ * Linux only (epoll)
+ */
+#if defined(__linux__)
+
+template <class T = void>
+class task;
+
+namespace async_detail {
+    struct PromiseBase {
+        std::coroutine_handle<> continuation{ std::noop_coroutine() };
+        std::exception_ptr error;
+
+        // Hands control straight back to whoever awaited the task
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template <class Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                return handle.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    template <class T>
+    struct Promise : PromiseBase {
+        std::optional<T> value;
+
+        task<T> get_return_object();
+        void return_value(T result) { value = std::move(result); }
+        T take() {
+            if (error) std::rethrow_exception(error);
+            return std::move(*value);
+        }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase {
+        task<void> get_return_object();
+        void return_void() {}
+        void take() {
+            if (error) std::rethrow_exception(error);
+        }
+    };
+}
+
+/*
+ * @brief A lazily started coroutine producing a `T`. It runs when awaited, and resumes its
+ * awaiter when it finishes, rethrowing anything it threw
+ */
+template <class T>
+class task {
+public:
+    using promise_type = async_detail::Promise<T>;
+
+    task() = default;
+    explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return handle.promise().take(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <class T>
+task<T> async_detail::Promise<T>::get_return_object() {
+    return task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline task<void> async_detail::Promise<void>::get_return_object() {
+    return task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+/*
+ * @brief A single-threaded epoll loop. Coroutines await `readable()`/`writable()` on non-blocking
+ * descriptors; regular files are always ready, so awaiting them doesn't suspend
+ */
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Starts `work` on the next turn of the loop. The loop runs until every spawned task is done
+    void spawn(task<void> work);
+
+    // Runs until every spawned task has finished, then rethrows the first exception one threw, if any
+    void run();
+
+    // Resumes `handle` on the loop thread. Safe to call from any thread
+    void post(std::coroutine_handle<> handle);
+
+    struct FdAwaiter {
+        EventLoop* loop;
+        int fd;
+        bool writing;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) { return loop->wait_for(fd, writing, handle); }
+        void await_resume() const noexcept {}
+    };
+
+    FdAwaiter readable(int fd) { return { this, fd, false }; }
+    FdAwaiter writable(int fd) { return { this, fd, true }; }
+
+private:
+    struct FdWaiters {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+    };
+
+    struct Detached;
+    static Detached run_detached(EventLoop* loop, task<void> work);
+
+    // Returns false, so the awaiter resumes at once, where the descriptor can't be polled
+    bool wait_for(int fd, bool writing, std::coroutine_handle<> handle);
+    void arm(int fd, const FdWaiters& waiting);
+    void dispatch(int fd, uint32_t events);
+
+    int epoll_fd{ -1 };
+    int wake_fd{ -1 };
+    std::unordered_map<int, FdWaiters> waiters;
+    std::deque<std::coroutine_handle<>> ready;
+    size_t active{ 0 };
+    std::exception_ptr first_error;
+
+    std::mutex posted_mutex;
+    std::vector<std::coroutine_handle<>> posted;
+};
+
+/*
+ * @brief A pool of worker threads for CPU-bound work. `co_await executor.run(loop, work)` runs
+ * `work` on a worker and resumes the coroutine back on `loop`, rethrowing anything `work` threw
+ */
+class CpuExecutor {
+public:
+    explicit CpuExecutor(size_t threads = std::thread::hardware_concurrency());
+    ~CpuExecutor();
+
+    CpuExecutor(const CpuExecutor&) = delete;
+    CpuExecutor& operator=(const CpuExecutor&) = delete;
+
+    struct RunAwaiter {
+        CpuExecutor* executor;
+        EventLoop* loop;
+        std::function<void()> work;
+        std::exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() {
+            if (error) std::rethrow_exception(error);
+        }
+    };
+
+    RunAwaiter run(EventLoop& loop, std::function<void()> work) { return { this, &loop, std::move(work), nullptr }; }
+
+private:
+    void submit(std::function<void()> job);
+    void work_loop();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    bool stopping{ false };
+};
+
+class AsyncSource {
+public:
+    virtual ~AsyncSource() = default;
+
+    // Reads up to `size` bytes, suspending until some are available. Returns 0 at the end of the input
+    virtual task<size_t> read(unsigned char* data, size_t size) = 0;
+};
+
+class AsyncSink {
+public:
+    virtual ~AsyncSink() = default;
+
+    // Writes all `size` bytes, suspending whenever the output is full
+    virtual task<void> write(const unsigned char* data, size_t size) = 0;
+};
+
+/*
+ * @brief Reads a descriptor owned by the caller, such as a pipe or socket, which is switched to non-blocking mode
+ */
+class AsyncFdSource : public AsyncSource {
+public:
+    AsyncFdSource(EventLoop& loop, int fd);
+    task<size_t> read(unsigned char* data, size_t size) override;
+
+private:
+    EventLoop& loop;
+    int fd;
+};
+
+/*
+ * @brief Writes a descriptor owned by the caller, such as a pipe or socket, which is switched to non-blocking mode
+ */
+class AsyncFdSink : public AsyncSink {
+public:
+    AsyncFdSink(EventLoop& loop, int fd);
+    task<void> write(const unsigned char* data, size_t size) override;
+
+private:
+    EventLoop& loop;
+    int fd;
+};
+
+/*
+ * @brief Encrypts everything `source` produces into `sink` in the stream format `encrypt()` writes.
+ * With an `executor`, sealing runs there and the loop only does I/O. `key` must stay valid until the task finishes
+ */
+task<void> encrypt_async(EventLoop& loop, AsyncSource& source, AsyncSink& sink, const unsigned char* key, CpuExecutor* executor = nullptr);
+
+/*
+ * @brief Decrypts a stream written by `encrypt()` or `encrypt_async()` from `source` into `sink`.
+ * Throws AuthError if it doesn't authenticate, is truncated or has data after its end. Plaintext
+ * is passed on as each batch of records authenticates, so a failure can follow some output
+ */
+task<void> decrypt_async(EventLoop& loop, AsyncSource& source, AsyncSink& sink, const unsigned char* key, CpuExecutor* executor = nullptr);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <exception>
+
+#include "src/chunk_reader.hpp"
+#include "src/indexed.hpp"
+#include "src/small.hpp"
+#include "src/kernel.hpp"
+#include "src/segmented.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+#include "utilities/buffer_pool.h"
+
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+#include <sodium/utils.h>
+
+namespace {
+    constexpr size_t HEADER_SIZE{ crypto_secretstream_xchacha20poly1305_HEADERBYTES };
+    constexpr size_t ABYTES{ crypto_secretstream_xchacha20poly1305_ABYTES };
+
+    // Records are grouped so a chunk costs one read, like the other formats' 64 KiB chunks
+    constexpr uint64_t RECORDS_PER_CHUNK{ 16 };
+
+    /*
+     * Each secretstream record's state depends on every record before it, so a chunk can't be
+     * opened on its own. Instead the state in front of every chunk seen so far is kept: going
+     * back costs one chunk, and only going past the furthest chunk yet opened costs a scan
+     */
+    class StreamChunkReader : public ChunkReader {
+    public:
+        StreamChunkReader(const std::string& path, const unsigned char* key)
+            : file(path, std::ios::binary), sealed(RECORDS_PER_CHUNK * STREAM_RECORD_SIZE) {
+            if (!file.is_open()) throw FileError("Error: Couldn't open input file `" + path + '`');
+
+            uint64_t file_size = std::filesystem::file_size(path);
+            unsigned char header[HEADER_SIZE];
+            if (file_size < HEADER_SIZE + ABYTES || !file.read(reinterpret_cast<char*>(header), HEADER_SIZE)) {
+                throw AuthError("Decryption failed. The input file is truncated");
+            }
+
+            // Every record but the last is full, and the last holds at least its tag
+            uint64_t body_size = file_size - HEADER_SIZE;
+            record_count = body_size / STREAM_RECORD_SIZE + 1;
+            last_record_length = static_cast<size_t>(body_size - (record_count - 1) * STREAM_RECORD_SIZE);
+            if (last_record_length < ABYTES) throw AuthError("Decryption failed. The input file is truncated");
+            plaintext_size = body_size - record_count * ABYTES;
+
+            checkpoints.emplace_back();
+            if (crypto_secretstream_xchacha20poly1305_init_pull(&checkpoints.back(), header, key) != 0) {
+                throw KeyError("Invalid header or key");
+            }
+        }
+
+        ~StreamChunkReader() override {
+            sodium_memzero(checkpoints.data(), checkpoints.size() * sizeof(checkpoints[0]));
+        }
+
+        uint64_t size() const override { return plaintext_size; }
+        size_t chunk_size() const override { return RECORDS_PER_CHUNK * STREAM_CHUNK_SIZE; }
+        uint64_t chunk_count() const override { return (record_count + RECORDS_PER_CHUNK - 1) / RECORDS_PER_CHUNK; }
+
+        size_t read_chunk(uint64_t index, unsigned char* out) override {
+            while (checkpoints.size() <= index) {
+                crypto_secretstream_xchacha20poly1305_state state = checkpoints.back();
+                open_chunk(checkpoints.size() - 1, state, out);
+                checkpoints.push_back(state);
+            }
+
+            crypto_secretstream_xchacha20poly1305_state state = checkpoints[index];
+            size_t length = open_chunk(index, state, out);
+            if (checkpoints.size() == index + 1 && index + 1 < chunk_count()) checkpoints.push_back(state);
+            sodium_memzero(&state, sizeof(state));
+            return length;
+        }
+
+    private:
+        size_t open_chunk(uint64_t index, crypto_secretstream_xchacha20poly1305_state& state, unsigned char* out) {
+            uint64_t first = index * RECORDS_PER_CHUNK;
+            uint64_t records = std::min(RECORDS_PER_CHUNK, record_count - first);
+            bool holds_last = first + records == record_count;
+            size_t sealed_size = static_cast<size_t>((records - 1) * STREAM_RECORD_SIZE) + (holds_last ? last_record_length : STREAM_RECORD_SIZE);
+
+            file.seekg(static_cast<std::streamoff>(HEADER_SIZE + first * STREAM_RECORD_SIZE));
+            if (!file.read(reinterpret_cast<char*>(sealed.data()), static_cast<std::streamsize>(sealed_size))) {
+                file.clear();
+                throw FileError("Error: Couldn't read the input file");
+            }
+
+            size_t length = 0;
+            for (uint64_t record = 0; record < records; ++record) {
+                bool last = first + record + 1 == record_count;
+                size_t record_size = last ? last_record_length : STREAM_RECORD_SIZE;
+
+                unsigned long long opened_length;
+                unsigned char tag;
+                if (crypto_secretstream_xchacha20poly1305_pull(&state, out + length, &opened_length, &tag,
+                    sealed.data() + record * STREAM_RECORD_SIZE, record_size, NULL, 0) != 0) {
+                    throw AuthError("Decryption failed. The input file maybe corrupt");
+                }
+
+                // Only the final tag proves nothing was cut off, and nothing may follow it
+                bool final = tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+                if (last && !final) throw AuthError("Decryption failed. The input file is truncated");
+                if (!last && final) throw AuthError("Decryption failed. The input file has data after the end of the stream");
+                length += static_cast<size_t>(opened_length);
+            }
+            return length;
+        }
+
+        std::ifstream file;
+        std::vector<unsigned char> sealed;
+        uint64_t record_count{ 0 };
+        size_t last_record_length{ 0 };
+        uint64_t plaintext_size{ 0 };
+        std::vector<crypto_secretstream_xchacha20poly1305_state> checkpoints;
+    };
+}
+
+std::unique_ptr<ChunkReader> open_chunk_reader(const std::string& input_path, const unsigned char* key) {
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+    unsigned char magic[MAGIC_SIZE]{};
+    std::function<std::unique_ptr<ChunkReader>()> open_container;
+    if (input_file.read(reinterpret_cast<char*>(magic), MAGIC_SIZE)) {
+        if (has_magic(magic, SMALL_MAGIC)) open_container = [&] { return open_small_reader(input_path, key); };
+        else if (has_magic(magic, INDEXED_MAGIC)) open_container = [&] { return open_indexed_reader(input_path, key); };
+        else if (has_magic(magic, KERNEL_MAGIC)) open_container = [&] { return open_kernel_reader(input_path, key); };
+        else if (has_magic(magic, SEGMENTED_MAGIC)) open_container = [&] { return open_segmented_reader(input_path, key); };
+        else if (has_magic(magic, PACK_MAGIC)) {
+            open_container = [&]() -> std::unique_ptr<ChunkReader> {
+                throw UtilException("`" + input_path + "` is a pack of several files. Extract it with --decrypt instead");
+            };
+        }
+        else if (has_magic(magic, RECORDS_MAGIC)) {
+            open_container = [&]() -> std::unique_ptr<ChunkReader> {
+                throw UtilException("`" + input_path + "` is a record log. Decrypt it or scan it with --decrypt instead");
+            };
+        }
+        else if (has_magic(magic, RECIPE_MAGIC)) {
+            open_container = [&]() -> std::unique_ptr<ChunkReader> {
+                throw UtilException("`" + input_path + "` is a chunk store recipe, which can only be restored with --store");
+            };
+        }
+    }
+    input_file.close();
+
+    if (open_container) {
+        // The random header of a plain stream can start with a magic, as in decrypt(). Opening the stream or
+        // the kernel format checks nothing, so whichever is used has to authenticate its first chunk
+        auto authenticated = [](std::unique_ptr<ChunkReader> reader) {
+            if (reader->chunk_count() > 0) {
+                PooledBuffer chunk = BufferPool::instance().acquire(reader->chunk_size());
+                reader->read_chunk(0, chunk.data());
+            }
+            return reader;
+        };
+        try {
+            return authenticated(open_container());
+        }
+        catch (const UtilException&) {
+            std::exception_ptr container_failure = std::current_exception();
+            try {
+                return authenticated(std::make_unique<StreamChunkReader>(input_path, key));
+            }
+            catch (const UtilException&) {
+                std::rethrow_exception(container_failure);
+            }
+        }
+    }
+
+    return std::make_unique<StreamChunkReader>(input_path, key);
+}
\ No newline at end of file
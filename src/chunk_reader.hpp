@@ -0,0 +1,48 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * @brief Random access to the plaintext of an encrypted file, one chunk at a time. Every chunk
+ * but the last holds `chunk_size()` bytes, and the last can be empty where a format ends with
+ * an empty final record. Calls must not overlap, but may come from different threads
+ */
+class ChunkReader {
+public:
+    virtual ~ChunkReader() = default;
+
+    // The plaintext size, known without decrypting anything
+    virtual uint64_t size() const = 0;
+    virtual size_t chunk_size() const = 0;
+    virtual uint64_t chunk_count() const = 0;
+
+    /*
+     * @brief Decrypts chunk `index` into `out`, which holds `chunk_size()` bytes, and returns its
+     * length. Throws AuthError if the chunk doesn't authenticate or is out of place
+     */
+    virtual size_t read_chunk(uint64_t index, unsigned char* out) = 0;
+};
+
+/*
+ * @brief Opens any single-file format written by this tool for random access. Throws
+ * for packs and chunk store recipes, which don't hold a single plaintext
+ */
+std::unique_ptr<ChunkReader> open_chunk_reader(const std::string& input_path, const unsigned char* key);
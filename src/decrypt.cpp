@@ -16,84 +16,197 @@
 */
 
 #include <iostream>
-#include <format>
 #include <fstream>
-#include <vector>
+#include <format>
 #include <string>
-
-#include "utilities/get_secret_input.h"
+#include <span>
+#include <functional>
+#include <exception>
+#include <filesystem>
+
+#include "src/indexed.hpp"
+#include "src/small.hpp"
+#include "src/kernel.hpp"
+#include "src/pack.hpp"
+#include "src/records.hpp"
+#include "src/segmented.hpp"
+#include "src/format.hpp"
 #include "utilities/exception.h"
+#include "utilities/file_io.h"
+#include "utilities/source_sink.h"
+#include "utilities/buffer_pool.h"
+#include "utilities/perf_counters.h"
+#include "utilities/trace.h"
+#include "utilities/progress.h"
 
 #include <sodium/crypto_secretstream_xchacha20poly1305.h>
-#include <sodium/utils.h>
 
-void decrypt(const std::string& input_path, const std::string& output_path) {
-    // Read from the input encrypted file
-    std::ifstream input_file(input_path, std::ios::binary);
-    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+namespace {
+    // Opens the records that follow a plain stream header, checking the stream ends exactly at its final record
+    void decrypt_records(const unsigned char* header, Source& source, Sink& sink, const unsigned char* key, Trace* trace) {
+        crypto_secretstream_xchacha20poly1305_state crypto_state;
 
-    // Check the validity of the output file
-    std::ofstream output_file(output_path, std::ios::binary);
-    if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
-
-    // Ask the user for the secret key
-    std::cout << "Enter the secret key (hex): ";
-    std::string key_hex = get_secret_input();
+        // Initialize decryption stream with the header and key
+        if (crypto_secretstream_xchacha20poly1305_init_pull(&crypto_state, header, key) != 0) {
+            throw KeyError("Invalid header or key");
+        }
 
-    if (key_hex.empty()) throw KeyError("No key was entered");
+        PooledBuffer decrypted_chunk = BufferPool::instance().acquire(STREAM_CHUNK_SIZE);
+        unsigned long long decrypted_len;
+        unsigned char tag = 0;
+
+        // Process the input in records of the plaintext chunk plus the 17-byte tag (16-byte authentication tag + 1-byte control tag)
+        // until the final tag is found
+        uint64_t chunk_index = 0;
+        do {
+            std::span<const unsigned char> ciphertext_chunk;
+            {
+                Trace::Scope trace_scope(trace, "read chunk", chunk_index);
+                ciphertext_chunk = source.borrow(STREAM_RECORD_SIZE);
+            }
+
+            if (ciphertext_chunk.empty()) break; // Reached EOF
+
+            {
+                Trace::Scope trace_scope(trace, "open chunk", chunk_index);
+                if (crypto_secretstream_xchacha20poly1305_pull(
+                    &crypto_state,
+                    decrypted_chunk.data(),
+                    &decrypted_len,
+                    &tag,
+                    ciphertext_chunk.data(),
+                    ciphertext_chunk.size(),
+                    NULL, 0) != 0) {
+                    throw AuthError("Decryption failed. The input file maybe corrupt");
+                }
+            }
+
+            // Write decrypted plaintext chunk to the output
+            {
+                Trace::Scope trace_scope(trace, "write chunk", chunk_index);
+                sink.write({ decrypted_chunk.data(), static_cast<size_t>(decrypted_len) });
+            }
+
+            if (trace) {
+                trace->counter("input buffered", source.buffered());
+                trace->counter("output pending", sink.pending());
+            }
+            ++chunk_index;
+
+            // Check the tag to see if it was the last tag
+        } while (tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL);
+
+        // A stream cut at a record boundary authenticates up to the cut, so only the final tag proves it's complete
+        if (tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL) {
+            throw AuthError("Decryption failed. The input file is truncated");
+        }
 
-    unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
-    // Convert the hex key from the user's input into raw bytes
-    if (sodium_hex2bin(key, sizeof(key), key_hex.c_str(), key_hex.length(), NULL, NULL, NULL) != 0) {
-        throw KeyError("Invalid hex key provided");
+        unsigned char trailing;
+        if (source.read_into({ &trailing, 1 }) != 0) {
+            throw AuthError("Decryption failed. The input file has data after the end of the stream");
+        }
     }
 
-    // Read the 24-byte header from the start of the file
-    unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
-    input_file.read(reinterpret_cast<char*>(header), sizeof(header));
+    /*
+     * Decrypts a plain stream file. Only this path counts towards the total perf stage, as the containers
+     * don't report their reads and writes; everything from opening the input to the final flush is in it
+     */
+    void decrypt_stream_file(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options) {
+        PerfCounters::Scope perf_scope(io_options.perf, PerfStage::Total);
+
+        FileSource source(input_path, io_options);
+
+        // Read the 24-byte header from the start of the file
+        unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+        if (source.read_into(header) != sizeof(header)) throw AuthError("Decryption failed. The input file is truncated");
+
+        // Check the validity of the output file
+        FileSink sink(output_path, io_options);
+
+        // The plaintext size follows from the ciphertext size, so reserve it in one go
+        sink.reserve(stream_plaintext_size(source.size()));
 
-    crypto_secretstream_xchacha20poly1305_state crypto_state;
+        decrypt_records(header, source, sink, key, io_options.trace);
 
-    // Initialize decryption stream with the header and key
-    if (crypto_secretstream_xchacha20poly1305_init_pull(&crypto_state, header, key) != 0) {
-        throw KeyError("Invalid header or key");
+        if (io_options.perf) io_options.perf->add_bytes(source.size());
+        source.close();
+        sink.close();
+    }
+}
+
+void decrypt(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options) {
+    // Containers other than the plain secretstream file are told apart by their magic
+    unsigned char magic[MAGIC_SIZE]{};
+    bool has_header = false;
+    {
+        std::ifstream probe(input_path, std::ios::binary);
+        if (!probe.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+        has_header = static_cast<bool>(probe.read(reinterpret_cast<char*>(magic), MAGIC_SIZE));
     }
 
-    constexpr size_t CHUNK_SIZE{ 4096 };
-
-    // The input chunk buffer needs space for the plaintext plus the 17-byte tag (16-byte authentication tag + 1-byte control tag)
-    std::vector<unsigned char> ciphertext_chunk(CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES);
-    std::vector<unsigned char> decrypted_chunk(CHUNK_SIZE);
-    unsigned long long decrypted_len;
-    unsigned char tag;
-
-    // Process the input file in chunks until the final tag is found
-    do {
-        input_file.read(reinterpret_cast<char*>(ciphertext_chunk.data()), ciphertext_chunk.size());
-        size_t bytes_read = input_file.gcount();
-
-        if (bytes_read == 0) break; // Reached EOF
-
-        if (crypto_secretstream_xchacha20poly1305_pull(
-            &crypto_state,
-            decrypted_chunk.data(),
-            &decrypted_len,
-            &tag,
-            ciphertext_chunk.data(),
-            bytes_read,
-            NULL, 0) != 0) {
-            throw UtilException("Decryption failed. The input file maybe corrupt");
+    std::function<void()> decrypt_container;
+    if (has_header) {
+        if (has_magic(magic, SMALL_MAGIC)) decrypt_container = [&] { decrypt_small(input_path, output_path, key, io_options.report); };
+        else if (has_magic(magic, INDEXED_MAGIC)) decrypt_container = [&] { decrypt_indexed(input_path, output_path, key, io_options.report); };
+        else if (has_magic(magic, KERNEL_MAGIC)) decrypt_container = [&] { decrypt_kernel(input_path, output_path, key, io_options); };
+        else if (has_magic(magic, PACK_MAGIC)) decrypt_container = [&] { unpack_files(input_path, output_path, key); };
+        else if (has_magic(magic, SEGMENTED_MAGIC)) decrypt_container = [&] { decrypt_segmented(input_path, output_path, key, 0, io_options.report); };
+        else if (has_magic(magic, RECORDS_MAGIC)) decrypt_container = [&] { decrypt_record_log(input_path, output_path, key, 0, io_options.report); };
+        else if (has_magic(magic, RECIPE_MAGIC)) {
+            decrypt_container = [&] { throw UtilException("`" + input_path + "` is a chunk store recipe. Pass the store directory with --store"); };
         }
+    }
 
-        // Write decrypted plaintext chunk to the output file
-        output_file.write(reinterpret_cast<const char*>(decrypted_chunk.data()), decrypted_len);
-
-        // Check the tag to see if it was the last tag
-    } while (tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL);
+    if (decrypt_container) {
+        try {
+            decrypt_container();
+
+            // The containers other than the kernel format do their own I/O, so the requested handling didn't apply
+            if (!has_magic(magic, KERNEL_MAGIC)) {
+                if (io_options.direct || io_options.drop_cache || io_options.throttle || io_options.trace) {
+                    std::cerr << std::format("Warning: `{}` is a container that does its own I/O; --direct, --no-cache-pollution, throttling and --trace don't apply to it", input_path) << std::endl;
+                }
+                if (io_options.progress) io_options.progress->add(std::filesystem::file_size(input_path));
+            }
+            return;
+        }
+        catch (const UtilException&) {
+            // The random header of a plain stream can start with a magic. If the file doesn't open as that
+            // container, try it as a stream, and report the container's error if that fails too
+            std::exception_ptr container_failure = std::current_exception();
+            try {
+                decrypt_stream_file(input_path, output_path, key, io_options);
+            }
+            catch (const UtilException&) {
+                std::rethrow_exception(container_failure);
+            }
+            if (io_options.report) std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
+            return;
+        }
+    }
 
-    input_file.close();
-    output_file.close();
+    decrypt_stream_file(input_path, output_path, key, io_options);
 
-    std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
+    if (io_options.report) std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
     return;
+}
+
+void decrypt(Source& source, Sink& sink, const unsigned char* key, Trace* trace) {
+    unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    size_t header_len = source.read_into(header);
+    if (header_len < sizeof(header)) throw AuthError("Decryption failed. The input file is truncated");
+
+    // The other containers need random access to their files, so only the plain stream is read from a source.
+    // A stream's random header can start with a magic too, so a container is only reported once the stream fails
+    bool container = has_magic(header, SMALL_MAGIC) || has_magic(header, INDEXED_MAGIC) || has_magic(header, KERNEL_MAGIC) ||
+        has_magic(header, PACK_MAGIC) || has_magic(header, RECORDS_MAGIC) ||
+        has_magic(header, SEGMENTED_MAGIC) || has_magic(header, RECIPE_MAGIC);
+
+    try {
+        decrypt_records(header, source, sink, key, trace);
+    }
+    catch (const UtilException&) {
+        if (container) throw UtilException("The input isn't a plain stream. Decrypt it from its file instead");
+        throw;
+    }
 }
\ No newline at end of file
@@ -18,4 +18,13 @@
 #pragma once
 #include <string>
 
-void decrypt(const std::string& input_path, const std::string& output_path);
\ No newline at end of file
+#include "utilities/file_io.h"
+#include "utilities/source_sink.h"
+
+void decrypt(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options = {});
+
+/*
+ * @brief Decrypts a stream-format file from `source` into `sink`. The other container formats need
+ * the path overload. Doesn't close either end
+ */
+void decrypt(Source& source, Sink& sink, const unsigned char* key, Trace* trace = nullptr);
\ No newline at end of file
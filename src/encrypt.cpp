@@ -17,82 +17,125 @@
 
 #include <iostream>
 #include <format>
-#include <fstream>
-#include <vector>
+#include <filesystem>
 #include <string>
+#include <optional>
+#include <span>
 
-#include "utilities/get_secret_input.h"
+#include "src/encrypt.hpp"
+#include "src/small.hpp"
+#include "src/format.hpp"
 #include "utilities/exception.h"
+#include "utilities/file_io.h"
+#include "utilities/source_sink.h"
+#include "utilities/digests.h"
+#include "utilities/buffer_pool.h"
+#include "utilities/perf_counters.h"
+#include "utilities/trace.h"
+#include "utilities/progress.h"
+#include "utilities/metrics.h"
 
 #include <sodium/crypto_secretstream_xchacha20poly1305.h>
-#include <sodium/utils.h>
 
-void encrypt(const std::string& input_path, const std::string& output_path) {
-    // Read from the input plaintext file
-    std::ifstream input_file(input_path, std::ios::binary);
-    if (!input_file.is_open()) {
-        throw FileError("Error: Couldn't open input file `" + input_path + '`');
+void encrypt(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options) {
+    // Digests are taken from the ciphertext on its way to the file, while it's still in cache
+    std::optional<PartDigests> digests;
+    if (io_options.digest_part_size) digests.emplace(*io_options.digest_part_size);
+    auto write_digests = [&] {
+        if (!digests) return;
+        digests->finish();
+        digests->write_manifest(digest_manifest_path(output_path), std::filesystem::path(output_path).filename().string());
+    };
+
+    // When asked, inputs smaller than one chunk are sealed in one shot, skipping the stream and its buffers
+    bool small_io = !io_options.direct && !io_options.drop_cache && !io_options.throttle && !io_options.perf && !io_options.trace;
+    std::error_code size_error;
+    uint64_t input_size = std::filesystem::file_size(input_path, size_error);
+    if (io_options.small_format && small_io && input_size < SMALL_FILE_LIMIT && !size_error &&
+        encrypt_small(input_path, output_path, key, digests ? &*digests : nullptr)) {
+        if (io_options.progress) io_options.progress->add(input_size);
+        if (io_options.metrics) {
+            io_options.metrics->add_read(input_size);
+            io_options.metrics->add_written(std::filesystem::file_size(output_path));
+        }
+        write_digests();
+        return;
     }
 
-    // Check the validity of the output file
-    std::ofstream output_file(output_path, std::ios::binary);
-    if (!output_file.is_open()) {
-        throw FileError("Error: Couldn't open output file `" + output_path + '`');
-    }
+    // Everything from here on, including the final flush, counts towards the total stage
+    PerfCounters::Scope perf_scope(io_options.perf, PerfStage::Total);
 
-    // Ask the user for the secret key
-    std::cout << "Enter the secret key (hex): ";
-    std::string key_hex = get_secret_input();
+    FileSource source(input_path, io_options);
+    FileSink file_sink(output_path, io_options);
 
-    if (key_hex.empty()) throw KeyError("No key was entered");
+    std::optional<DigestSink> digest_sink;
+    if (digests) digest_sink.emplace(file_sink, *digests);
+    Sink& sink = digest_sink ? static_cast<Sink&>(*digest_sink) : file_sink;
 
-    unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
-    // Convert the hex key from the user's input into raw bytes
-    if (sodium_hex2bin(key, sizeof(key), key_hex.c_str(), key_hex.length(), NULL, NULL, NULL) != 0) {
-        throw KeyError("Invalid hex key provided");
-    }
+    // The ciphertext size is known up front, so let the filesystem reserve it in one go
+    sink.reserve(stream_ciphertext_size(source.size()));
+
+    encrypt(source, sink, key, io_options.trace);
+
+    if (io_options.perf) io_options.perf->add_bytes(source.size());
+    source.close();
+    sink.close();
 
-    constexpr size_t CHUNK_SIZE{ 4096 };
+    write_digests();
 
+    std::cout << std::format("Successfully encrypted `{}` to `{}`", input_path, output_path) << std::endl;
+    return;
+}
+
+void encrypt(Source& source, Sink& sink, const unsigned char* key, Trace* trace) {
     unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
     crypto_secretstream_xchacha20poly1305_state crypto_state;
 
     // Initialize the stream and get the header
     crypto_secretstream_xchacha20poly1305_init_push(&crypto_state, header, key);
 
-    // Write the header to the start of the output file
-    output_file.write(reinterpret_cast<const char*>(header), sizeof(header));
-
-    std::vector<unsigned char> plaintext_chunk(CHUNK_SIZE);
+    // Write the header to the start of the output
+    sink.write({ header, sizeof(header) });
 
     // The ciphertext needs space for the plaintext plus an authentication tag
-    std::vector<unsigned char> ciphertext_chunk(CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES);
+    PooledBuffer ciphertext_chunk = BufferPool::instance().acquire(STREAM_RECORD_SIZE);
     unsigned long long out_len;
     unsigned char tag;
 
-    // Process the file in chunks
+    // Process the input in chunks. Only a short chunk can be the last, so input that ends on a
+    // chunk boundary gets an empty final chunk
+    uint64_t chunk_index = 0;
     do {
-        input_file.read(reinterpret_cast<char*>(plaintext_chunk.data()), CHUNK_SIZE);
-        size_t bytes_read = input_file.gcount();
-
-        tag = input_file.eof() ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
-
-        crypto_secretstream_xchacha20poly1305_push(
-            &crypto_state,
-            ciphertext_chunk.data(),
-            &out_len,
-            plaintext_chunk.data(),
-            bytes_read,
-            NULL, 0, tag
-        );
-
-        // Write the encrypted chunk to the output file
-        output_file.write(reinterpret_cast<const char*>(ciphertext_chunk.data()), out_len);
-    } while (!input_file.eof());
-
-    input_file.close();
-    output_file.close();
-
-    std::cout << std::format("Successfully encrypted `{}` to `{}`", input_path, output_path) << std::endl;
-    return;
+        std::span<const unsigned char> plaintext_chunk;
+        {
+            Trace::Scope trace_scope(trace, "read chunk", chunk_index);
+            plaintext_chunk = source.borrow(STREAM_CHUNK_SIZE);
+        }
+
+        tag = plaintext_chunk.size() < STREAM_CHUNK_SIZE ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
+
+        {
+            Trace::Scope trace_scope(trace, "seal chunk", chunk_index);
+            crypto_secretstream_xchacha20poly1305_push(
+                &crypto_state,
+                ciphertext_chunk.data(),
+                &out_len,
+                plaintext_chunk.data(),
+                plaintext_chunk.size(),
+                NULL, 0, tag
+            );
+        }
+
+        // Write the encrypted chunk to the output
+        {
+            Trace::Scope trace_scope(trace, "write chunk", chunk_index);
+            sink.write({ ciphertext_chunk.data(), static_cast<size_t>(out_len) });
+        }
+
+        if (trace) {
+            trace->counter("input buffered", source.buffered());
+            trace->counter("output pending", sink.pending());
+        }
+        ++chunk_index;
+    } while (tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL);
 }
\ No newline at end of file
@@ -18,4 +18,18 @@
 #pragma once
 #include <string>
 
-void encrypt(const std::string& input_path, const std::string& output_path);
\ No newline at end of file
+#include "utilities/file_io.h"
+#include "utilities/source_sink.h"
+
+/*
+ * @brief Encrypts a file in the stream format. With `io_options.small_format`, an input under SMALL_FILE_LIMIT is
+ * sealed in the one-shot small format instead, which only the path-based readers (decrypt(), open_chunk_reader())
+ * open; decrypt(Source&, Sink&), decrypt_async() and decrypting_streambuf read the stream format alone
+ */
+void encrypt(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options = {});
+
+/*
+ * @brief Encrypts everything `source` produces into `sink` in the stream format, the one the path
+ * overload writes unless asked for the small format. Doesn't close either end
+ */
+void encrypt(Source& source, Sink& sink, const unsigned char* key, Trace* trace = nullptr);
\ No newline at end of file
@@ -0,0 +1,311 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+
+#include "src/encrypted_stream.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#include <sodium/utils.h>
+
+decrypting_streambuf::decrypting_streambuf(const std::string& input_path, const unsigned char* key, size_t cache_chunks)
+    : reader(open_chunk_reader(input_path, key)), cache_chunks(std::max<size_t>(cache_chunks, 2)) {
+}
+
+decrypting_streambuf::~decrypting_streambuf() {
+    if (prefetch_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            stopping = true;
+        }
+        prefetch_wake.notify_all();
+        prefetch_thread.join();
+    }
+
+    // The cache holds plaintext
+    for (Chunk& chunk : cache) sodium_memzero(chunk.data.data(), chunk.data.size());
+    sodium_memzero(prefetched.data.data(), prefetched.data.size());
+}
+
+uint64_t decrypting_streambuf::position() const {
+    return eback() ? base + static_cast<uint64_t>(gptr() - eback()) : base;
+}
+
+decrypting_streambuf::int_type decrypting_streambuf::underflow() {
+    if (gptr() && gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+    // Drop the get area first: loading may evict the chunk it points into
+    uint64_t target = position();
+    setg(nullptr, nullptr, nullptr);
+    base = target;
+
+    if (target >= reader->size()) {
+        // The end of the plaintext can only be trusted once the chunk that closes the file has authenticated
+        if (!final_verified && reader->chunk_count() > 0) load(reader->chunk_count() - 1);
+        return traits_type::eof();
+    }
+
+    uint64_t index = target / reader->chunk_size();
+    uint64_t start = index * reader->chunk_size();
+    const Chunk& chunk = load(index);
+    if (start + chunk.length <= target) throw AuthError("Decryption failed. The input file maybe corrupt");
+
+    char* data = reinterpret_cast<char*>(const_cast<unsigned char*>(chunk.data.data()));
+    setg(data, data + (target - start), data + chunk.length);
+    base = start;
+    return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize decrypting_streambuf::showmanyc() {
+    uint64_t current = position();
+    if (current >= reader->size()) return -1;
+    return static_cast<std::streamsize>(reader->size() - current);
+}
+
+decrypting_streambuf::pos_type decrypting_streambuf::seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) {
+    off_type origin = 0;
+    if (direction == std::ios_base::cur) origin = static_cast<off_type>(position());
+    else if (direction == std::ios_base::end) origin = static_cast<off_type>(reader->size());
+    return seekpos(pos_type(origin + offset), which);
+}
+
+decrypting_streambuf::pos_type decrypting_streambuf::seekpos(pos_type position, std::ios_base::openmode which) {
+    off_type target = static_cast<off_type>(position);
+    if (!(which & std::ios_base::in) || target < 0 || static_cast<uint64_t>(target) > reader->size()) {
+        return pos_type(off_type(-1));
+    }
+
+    // Within the current chunk only the read pointer moves; otherwise the next read loads the chunk
+    uint64_t offset = static_cast<uint64_t>(target);
+    if (eback() && offset >= base && offset < base + static_cast<uint64_t>(egptr() - eback())) {
+        setg(eback(), eback() + (offset - base), egptr());
+    }
+    else {
+        setg(nullptr, nullptr, nullptr);
+        base = offset;
+    }
+    return position;
+}
+
+const decrypting_streambuf::Chunk& decrypting_streambuf::load(uint64_t index) {
+    auto found = cached.find(index);
+    if (found == cached.end()) {
+        collect_prefetch();
+        found = cached.find(index);
+    }
+
+    Chunk* chunk;
+    if (found != cached.end()) {
+        cache.splice(cache.begin(), cache, found->second);
+        chunk = &cache.front();
+    }
+    else {
+        Chunk loaded;
+        loaded.index = index;
+        loaded.data = spare_buffer();
+        loaded.length = reader->read_chunk(index, loaded.data.data());
+        chunk = &insert(std::move(loaded));
+    }
+
+    if (index + 1 == reader->chunk_count()) final_verified = true;
+
+    // Reading on from the start or from the previous chunk counts as sequential
+    bool sequential = last_loaded == NO_CHUNK ? index == 0 : index == last_loaded + 1;
+    last_loaded = index;
+    if (sequential && index + 1 < reader->chunk_count() && !cached.count(index + 1)) prefetch(index + 1);
+
+    return *chunk;
+}
+
+decrypting_streambuf::Chunk& decrypting_streambuf::insert(Chunk chunk) {
+    uint64_t index = chunk.index;
+    cache.push_front(std::move(chunk));
+    cached[index] = cache.begin();
+    return cache.front();
+}
+
+// Reuses the least recently used chunk's buffer once the cache is full
+std::vector<unsigned char> decrypting_streambuf::spare_buffer() {
+    if (cache.size() < cache_chunks) return std::vector<unsigned char>(reader->chunk_size());
+
+    std::vector<unsigned char> data = std::move(cache.back().data);
+    cached.erase(cache.back().index);
+    cache.pop_back();
+    return data;
+}
+
+void decrypting_streambuf::prefetch(uint64_t index) {
+    std::vector<unsigned char> data = spare_buffer();
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        prefetched.index = index;
+        prefetched.data = std::move(data);
+        prefetched.length = 0;
+        prefetching = true;
+    }
+
+    if (!prefetch_thread.joinable()) prefetch_thread = std::thread(&decrypting_streambuf::run_prefetch, this);
+    prefetch_wake.notify_all();
+}
+
+// Waits for the chunk being prefetched, if any, and caches it
+void decrypting_streambuf::collect_prefetch() {
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    if (prefetched.index == NO_CHUNK) return;
+    prefetch_wake.wait(lock, [this] { return !prefetching; });
+
+    Chunk chunk = std::move(prefetched);
+    prefetched = Chunk();
+
+    // A chunk that failed to prefetch is left for the read that needs it, which reports the error
+    if (prefetch_error) {
+        prefetch_error = nullptr;
+        return;
+    }
+    lock.unlock();
+    insert(std::move(chunk));
+}
+
+void decrypting_streambuf::run_prefetch() {
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    while (true) {
+        prefetch_wake.wait(lock, [this] { return stopping || prefetching; });
+        if (stopping) return;
+
+        uint64_t index = prefetched.index;
+        unsigned char* out = prefetched.data.data();
+        lock.unlock();
+
+        size_t length = 0;
+        std::exception_ptr error;
+        try {
+            length = reader->read_chunk(index, out);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        prefetched.length = length;
+        prefetch_error = error;
+        prefetching = false;
+        prefetch_wake.notify_all();
+    }
+}
+
+encrypted_ifstream::encrypted_ifstream(const std::string& input_path, const unsigned char* key, size_t cache_chunks)
+    : std::istream(nullptr), buffer(input_path, key, cache_chunks) {
+    std::istream::rdbuf(&buffer);
+}
+
+namespace {
+    // Plaintext collected before sealing; a multiple of the record size
+    constexpr size_t SEAL_BUFFER_SIZE{ 64 * STREAM_CHUNK_SIZE };
+}
+
+encrypting_streambuf::encrypting_streambuf(const std::string& output_path, const unsigned char* key, const IoOptions& io_options)
+    : output_file(output_path, io_options),
+      plaintext(BufferPool::instance().acquire(SEAL_BUFFER_SIZE)),
+      ciphertext(BufferPool::instance().acquire(STREAM_RECORD_SIZE)) {
+    unsigned char header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    crypto_secretstream_xchacha20poly1305_init_push(&crypto_state, header, key);
+    output_file.write(header, sizeof(header));
+
+    char* start = reinterpret_cast<char*>(plaintext.data());
+    setp(start, start + plaintext.size());
+}
+
+encrypting_streambuf::~encrypting_streambuf() {
+    try {
+        close();
+    }
+    catch (...) {
+    }
+    sodium_memzero(&crypto_state, sizeof(crypto_state));
+}
+
+encrypting_streambuf::int_type encrypting_streambuf::overflow(int_type ch) {
+    if (!open) return traits_type::eof();
+
+    seal(false);
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int encrypting_streambuf::sync() {
+    if (!open) return -1;
+
+    seal(false);
+    return 0;
+}
+
+void encrypting_streambuf::close() {
+    if (!open) return;
+    open = false;
+
+    seal(true);
+    setp(nullptr, nullptr);
+    output_file.close();
+}
+
+// Seals every whole record in the put area, and with `final` the rest as the last record
+void encrypting_streambuf::seal(bool final) {
+    size_t buffered = static_cast<size_t>(pptr() - pbase());
+    size_t sealed = 0;
+
+    while (buffered - sealed >= STREAM_CHUNK_SIZE || final) {
+        size_t length = std::min(buffered - sealed, STREAM_CHUNK_SIZE);
+
+        // A record is only final if it is short, so a multiple of the record size ends with an empty one
+        bool last = final && length < STREAM_CHUNK_SIZE;
+        unsigned long long out_len;
+        crypto_secretstream_xchacha20poly1305_push(
+            &crypto_state,
+            ciphertext.data(),
+            &out_len,
+            plaintext.data() + sealed,
+            length,
+            NULL, 0,
+            last ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE);
+        output_file.write(ciphertext.data(), out_len);
+
+        sealed += length;
+        if (last) break;
+    }
+
+    // Keep the partial record at the front of the buffer
+    std::memmove(plaintext.data(), plaintext.data() + sealed, buffered - sealed);
+    char* start = reinterpret_cast<char*>(plaintext.data());
+    setp(start, start + plaintext.size());
+    pbump(static_cast<int>(buffered - sealed));
+}
+
+encrypted_ofstream::encrypted_ofstream(const std::string& output_path, const unsigned char* key, const IoOptions& io_options)
+    : std::ostream(nullptr), buffer(output_path, key, io_options) {
+    std::ostream::rdbuf(&buffer);
+}
+
+void encrypted_ofstream::close() {
+    buffer.close();
+}
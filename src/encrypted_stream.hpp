@@ -0,0 +1,174 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstddef>
+#include <cstdint>
+
+#include "src/chunk_reader.hpp"
+#include "utilities/file_io.h"
+#include "utilities/buffer_pool.h"
+
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+
+/*
+ * @brief A read-only, seekable stream buffer over the plaintext of an encrypted file. Chunks are
+ * decrypted lazily, the most recently used ones are kept, and while reads are sequential the
+ * next chunk is decrypted on a background thread. A seek into the indexed or kernel format costs
+ * at most one chunk; the plain stream format can only be opened front to back, so seeking past
+ * the furthest chunk yet read costs a scan up to it, and seeking back costs one chunk.
+ * A chunk that fails to authenticate throws AuthError, which the stream turns into badbit
+ */
+class decrypting_streambuf : public std::streambuf {
+public:
+    static constexpr size_t DEFAULT_CACHE_CHUNKS{ 16 };
+
+    // Throws if the file can't be opened or isn't a single-file format of ours
+    decrypting_streambuf(const std::string& input_path, const unsigned char* key, size_t cache_chunks = DEFAULT_CACHE_CHUNKS);
+    ~decrypting_streambuf() override;
+
+    decrypting_streambuf(const decrypting_streambuf&) = delete;
+    decrypting_streambuf& operator=(const decrypting_streambuf&) = delete;
+
+    // The plaintext size, known without decrypting anything
+    uint64_t size() const { return reader->size(); }
+
+protected:
+    int_type underflow() override;
+    std::streamsize showmanyc() override;
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override;
+
+private:
+    static constexpr uint64_t NO_CHUNK{ UINT64_MAX };
+
+    struct Chunk {
+        uint64_t index{ NO_CHUNK };
+        std::vector<unsigned char> data;
+        size_t length{ 0 };
+    };
+
+    uint64_t position() const;
+    const Chunk& load(uint64_t index);
+    Chunk& insert(Chunk chunk);
+    std::vector<unsigned char> spare_buffer();
+
+    void prefetch(uint64_t index);
+    void collect_prefetch();
+    void run_prefetch();
+
+    std::unique_ptr<ChunkReader> reader;
+    size_t cache_chunks;
+
+    // Most recently used first; `cached` maps chunk indices into it
+    std::list<Chunk> cache;
+    std::unordered_map<uint64_t, std::list<Chunk>::iterator> cached;
+
+    // Offset of the start of the get area, or of the next read when there is none
+    uint64_t base{ 0 };
+    uint64_t last_loaded{ NO_CHUNK };
+    bool final_verified{ false };
+
+    // One chunk is decrypted ahead at a time. The reader is only used by whoever holds
+    // `prefetching`, so the prefetch thread and a read never touch it at once
+    std::thread prefetch_thread;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_wake;
+    bool prefetching{ false };
+    bool stopping{ false };
+    Chunk prefetched;
+    std::exception_ptr prefetch_error;
+};
+
+/*
+ * @brief An `std::istream` over the plaintext of an encrypted file, read through a `decrypting_streambuf`
+ */
+class encrypted_ifstream : public std::istream {
+public:
+    encrypted_ifstream(const std::string& input_path, const unsigned char* key, size_t cache_chunks = decrypting_streambuf::DEFAULT_CACHE_CHUNKS);
+
+    decrypting_streambuf* rdbuf() { return &buffer; }
+    uint64_t size() const { return buffer.size(); }
+
+private:
+    decrypting_streambuf buffer;
+};
+
+/*
+ * @brief A write-only stream buffer that seals what is written into the plain stream format
+ * `encrypt()` writes, so `decrypt()` and `decrypting_streambuf` read it back. Writes are
+ * collected in a large buffer and sealed a record at a time; memory stays bounded whatever
+ * the size of the output. Records are fixed-size, so `sync()` seals every whole record but keeps
+ * a partial one until more data or `close()` completes it; sealed records reach the file as the
+ * output buffer fills, and all of them by `close()`
+ */
+class encrypting_streambuf : public std::streambuf {
+public:
+    encrypting_streambuf(const std::string& output_path, const unsigned char* key, const IoOptions& io_options = {});
+
+    // Closes the stream if `close()` wasn't called, without throwing
+    ~encrypting_streambuf() override;
+
+    encrypting_streambuf(const encrypting_streambuf&) = delete;
+    encrypting_streambuf& operator=(const encrypting_streambuf&) = delete;
+
+    // Seals what's left with the final tag and closes the file. Throws if the file can't be written
+    void close();
+    bool is_open() const { return open; }
+
+protected:
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    void seal(bool final);
+
+    OutputFile output_file;
+    crypto_secretstream_xchacha20poly1305_state crypto_state;
+    PooledBuffer plaintext;
+    PooledBuffer ciphertext;
+    bool open{ true };
+};
+
+/*
+ * @brief An `std::ostream` that encrypts into a file through an `encrypting_streambuf`. Without
+ * `close()`, a file is only finished when the stream is destroyed
+ */
+class encrypted_ofstream : public std::ostream {
+public:
+    encrypted_ofstream(const std::string& output_path, const unsigned char* key, const IoOptions& io_options = {});
+
+    encrypting_streambuf* rdbuf() { return &buffer; }
+    bool is_open() const { return buffer.is_open(); }
+
+    // Flushes and finishes the file. Throws if it can't be written
+    void close();
+
+private:
+    encrypting_streambuf buffer;
+};
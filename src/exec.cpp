@@ -0,0 +1,172 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#include "src/exec.hpp"
+#include "src/decrypt.hpp"
+#include "src/chunk_reader.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+#if !defined(_WIN32)
+namespace {
+    // A pipe this size holds a whole output buffer, so the command drains one while the next is decrypted
+    constexpr int PIPE_SIZE{ 1024 * 1024 };
+    constexpr int MIN_PIPE_SIZE{ 64 * 1024 };
+
+    struct FdCloser {
+        int fd;
+        ~FdCloser() {
+            if (fd >= 0) close(fd);
+        }
+    };
+
+    // Unprivileged processes are capped by /proc/sys/fs/pipe-max-size, so settle for what's allowed
+    void grow_pipe(int fd) {
+#if defined(F_SETPIPE_SZ)
+        for (int size = PIPE_SIZE; size >= MIN_PIPE_SIZE; size /= 2) {
+            if (fcntl(fd, F_SETPIPE_SZ, size) >= 0) return;
+        }
+#else
+        (void)fd;
+#endif
+    }
+
+    int wait_for(pid_t pid) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) return 1;
+        }
+        if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        return WEXITSTATUS(status);
+    }
+
+    // Writing to a command that has stopped reading should fail the write, not kill us
+    struct IgnoreSigpipe {
+        struct sigaction previous {};
+        IgnoreSigpipe() {
+            struct sigaction ignore {};
+            ignore.sa_handler = SIG_IGN;
+            sigemptyset(&ignore.sa_mask);
+            sigaction(SIGPIPE, &ignore, &previous);
+        }
+        ~IgnoreSigpipe() {
+            sigaction(SIGPIPE, &previous, nullptr);
+        }
+    };
+}
+
+int decrypt_to_command(const std::string& input_path, const std::string& command, const unsigned char* key, const IoOptions& io_options) {
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+    unsigned char magic[MAGIC_SIZE]{};
+    bool pack_magic = input_file.read(reinterpret_cast<char*>(magic), MAGIC_SIZE) && has_magic(magic, PACK_MAGIC);
+    input_file.close();
+
+    // Throws for a pack, unless it's really a plain stream whose header starts with the magic
+    if (pack_magic) open_chunk_reader(input_path, key);
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) throw FileError(std::format("Error: Couldn't create a pipe: {}", std::strerror(errno)));
+    FdCloser read_end{ pipe_fds[0] };
+    FdCloser write_end{ pipe_fds[1] };
+
+    // Only the command may hold the read end, and only we may hold the write end, or the
+    // command would never see the end of its input
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    grow_pipe(pipe_fds[1]);
+
+    IgnoreSigpipe ignore_sigpipe;
+
+    pid_t pid = fork();
+    if (pid < 0) throw UtilException(std::format("Couldn't start `{}`: {}", command, std::strerror(errno)));
+
+    if (pid == 0) {
+        // Its own process group, so a failure can kill a whole pipeline and not just the shell
+        setpgid(0, 0);
+        signal(SIGPIPE, SIG_DFL);
+        if (dup2(pipe_fds[0], STDIN_FILENO) < 0) _exit(127);
+        close(pipe_fds[0]);
+        execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    setpgid(pid, pid);
+
+    close(read_end.fd);
+    read_end.fd = -1;
+
+    // O_DIRECT on a pipe switches it to packet mode, and there is nothing to preallocate or evict.
+    // The command shares our stdout, so the pipe's path isn't reported there
+    IoOptions pipe_options = io_options;
+    pipe_options.direct = false;
+    pipe_options.drop_cache = false;
+    pipe_options.preallocate = false;
+    pipe_options.report = false;
+
+    // Kill it before the pipe closes, so it never mistakes partial plaintext for the whole file
+    auto abort_command = [pid] {
+        kill(-pid, SIGKILL);
+        wait_for(pid);
+    };
+
+    try {
+        decrypt(input_path, std::format("/dev/fd/{}", pipe_fds[1]), key, pipe_options);
+    }
+    catch (const AuthError&) {
+        abort_command();
+        throw;
+    }
+    catch (const UtilException&) {
+        // A command that stops reading early, like `head`, breaks the pipe; like a shell
+        // pipeline, what counts then is the command's own exit status
+        int status = 0;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            int code = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+            std::cerr << std::format("Warning: `{}` exited with status {} before reading all of the plaintext", command, code) << std::endl;
+            return code;
+        }
+
+        abort_command();
+        throw;
+    }
+    catch (...) {
+        // Anything else, e.g. a filesystem error or running out of memory, also leaves the plaintext incomplete
+        abort_command();
+        throw;
+    }
+
+    close(write_end.fd);
+    write_end.fd = -1;
+    return wait_for(pid);
+}
+#else
+int decrypt_to_command(const std::string&, const std::string&, const unsigned char*, const IoOptions&) {
+    throw UtilException("Decrypting into a command is only supported on POSIX systems");
+}
+#endif
@@ -0,0 +1,28 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+
+#include "utilities/file_io.h"
+
+/*
+ * @brief Runs `command` through `/bin/sh -c` and streams the plaintext of `input_path` (any
+ * format but a pack) into its standard input, so nothing is written to disk. If decryption
+ * fails, the command is killed before it can see the end of its input. Returns the command's
+ * exit status, or 128 + the signal that ended it
+ */
+int decrypt_to_command(const std::string& input_path, const std::string& command, const unsigned char* key, const IoOptions& io_options = {});
@@ -0,0 +1,87 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sodium/crypto_kdf.h>
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+
+// The plain stream `encrypt()` writes: header (24) | (ciphertext of up to STREAM_CHUNK_SIZE bytes | tag (17))*
+constexpr size_t STREAM_CHUNK_SIZE{ 4096 };
+constexpr size_t STREAM_RECORD_SIZE{ STREAM_CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES };
+
+// A final chunk is always written, and it's empty when the plaintext is a multiple of the chunk size
+inline uint64_t stream_ciphertext_size(uint64_t plaintext_size) {
+    uint64_t chunks = plaintext_size / STREAM_CHUNK_SIZE + 1;
+    return crypto_secretstream_xchacha20poly1305_HEADERBYTES + chunks * crypto_secretstream_xchacha20poly1305_ABYTES + plaintext_size;
+}
+
+// Inverse of `stream_ciphertext_size()` for a well-formed stream; 0 if it can't be one
+inline uint64_t stream_plaintext_size(uint64_t ciphertext_size) {
+    if (ciphertext_size < crypto_secretstream_xchacha20poly1305_HEADERBYTES + crypto_secretstream_xchacha20poly1305_ABYTES) return 0;
+    uint64_t body = ciphertext_size - crypto_secretstream_xchacha20poly1305_HEADERBYTES;
+    uint64_t chunks = (body + STREAM_RECORD_SIZE - 1) / STREAM_RECORD_SIZE;
+    return body - chunks * crypto_secretstream_xchacha20poly1305_ABYTES;
+}
+
+// Every container written by this tool, except the plain secretstream file that
+// `encrypt()` produces, starts with one of these 4-byte magics so `decrypt()` can
+// tell the formats apart. The secretstream header is random, so it starts with one
+// of the 7 magics with probability about 7 * 2^-32; `decrypt()` then falls back to
+// the stream when the file doesn't open as the container its magic names.
+constexpr size_t MAGIC_SIZE{ 4 };
+constexpr unsigned char INDEXED_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'I', '1' };
+constexpr unsigned char RECIPE_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'R', '1' };
+constexpr unsigned char SMALL_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'S', '1' };
+constexpr unsigned char PACK_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'P', '1' };
+constexpr unsigned char KERNEL_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'K', '1' };
+constexpr unsigned char RECORDS_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'L', '1' };
+constexpr unsigned char SEGMENTED_MAGIC[MAGIC_SIZE]{ 'C', 'U', 'G', '1' };
+
+inline bool has_magic(const unsigned char* data, const unsigned char (&magic)[MAGIC_SIZE]) {
+    return std::memcmp(data, magic, MAGIC_SIZE) == 0;
+}
+
+// All integers stored in container headers and manifests are little-endian
+inline void store_u32(unsigned char* out, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline uint32_t load_u32(const unsigned char* in) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i) value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    return value;
+}
+
+inline void store_u64(unsigned char* out, uint64_t value) {
+    for (size_t i = 0; i < 8; ++i) out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline uint64_t load_u64(const unsigned char* in) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return value;
+}
+
+// Derives an independent 32-byte subkey per purpose so the user's key is never
+// used directly by two different constructions
+inline void derive_subkey(unsigned char* subkey, uint64_t subkey_id, const char (&context)[crypto_kdf_CONTEXTBYTES + 1], const unsigned char* key) {
+    crypto_kdf_derive_from_key(subkey, 32, subkey_id, context, key);
+}
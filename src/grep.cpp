@@ -0,0 +1,304 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+
+#include "src/grep.hpp"
+#include "src/decrypt.hpp"
+#include "src/records.hpp"
+#include "src/chunk_reader.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+#include "utilities/source_sink.h"
+#include "utilities/buffer_pool.h"
+
+#include <sodium/utils.h>
+#include <re2/re2.h>
+
+namespace {
+    // A line longer than this is searched in pieces instead of being held whole
+    constexpr size_t MAX_LINE_SIZE{ 1024 * 1024 };
+    // Each file's output is handed over in batches so workers don't contend on every line
+    constexpr size_t OUTPUT_BATCH_SIZE{ 64 * 1024 };
+
+    class Matcher {
+    public:
+        Matcher(const std::string& pattern, bool regex) : pattern(pattern) {
+            if (pattern.empty()) throw UtilException("The search pattern is empty");
+            if (!regex) return;
+
+            RE2::Options regex_options;
+            regex_options.set_log_errors(false);
+            // Multi-line, so `^` and `$` anchor to every line rather than to the whole plaintext
+            expression = std::make_unique<RE2>("(?m)" + pattern, regex_options);
+            if (!expression->ok()) {
+                // Compiled as given, so the error quotes the user's pattern and not the prefixed one
+                RE2 as_given(pattern, regex_options);
+                throw UtilException(std::format("Invalid regular expression `{}`: {}", pattern, as_given.ok() ? expression->error() : as_given.error()));
+            }
+        }
+
+        /*
+         * How far a match can reach back from the end of a piece into the next one. A regular expression's
+         * match has no bound, so pieces of an overlong line are matched on their own and a match across
+         * them is missed
+         */
+        size_t overlap() const { return expression ? 0 : pattern.size() - 1; }
+
+        /*
+         * Finds the first match at or after `from`. A literal is found with `std::string_view::find`,
+         * which skips to candidates with memchr (vectorised in the common C libraries); a regular
+         * expression is tried one line at a time with RE2, which needs no stack per character of the line
+         */
+        bool find(std::string_view text, size_t from, size_t& position, size_t& length) const {
+            if (!expression) {
+                size_t found = text.find(pattern, from);
+                if (found == std::string_view::npos) return false;
+                position = found;
+                length = pattern.size();
+                return true;
+            }
+
+            while (from < text.size()) {
+                size_t line_end = text.find('\n', from);
+                if (line_end == std::string_view::npos) line_end = text.size();
+
+                // What precedes `from` is context, so a search resuming mid-line doesn't match `^` there
+                re2::StringPiece context(text.data(), line_end);
+                re2::StringPiece match;
+                if (expression->Match(context, from, line_end, RE2::UNANCHORED, &match, 1)) {
+                    position = static_cast<size_t>(match.data() - text.data());
+                    length = match.size();
+                    return true;
+                }
+                from = line_end + 1;
+            }
+            return false;
+        }
+
+    private:
+        std::string pattern;
+        std::unique_ptr<RE2> expression;
+    };
+
+    /*
+     * Searches plaintext as it's decrypted. Only complete lines are searched, and the incomplete
+     * last line is kept for the next write, so a match split across chunks is still found
+     */
+    class MatchSink : public Sink {
+    public:
+        MatchSink(const Matcher& matcher, bool offsets, const std::function<void(const GrepMatch&)>& on_match)
+            : matcher(matcher), offsets(offsets), on_match(on_match) {
+        }
+
+        ~MatchSink() override {
+            sodium_memzero(buffer.data(), buffer.size());
+        }
+
+        void write(std::span<const unsigned char> data) override {
+            size_t previous_size = buffer.size();
+            buffer.insert(buffer.end(), data.begin(), data.end());
+            search(previous_size, false);
+        }
+
+        void close() override {
+            if (closed) return;
+            closed = true;
+            search(0, true);
+        }
+
+        uint64_t matches() const { return match_count; }
+
+    private:
+        // `new_data` is where this write's bytes start; the kept bytes in front of it hold no newline
+        void search(size_t new_data, bool final) {
+            std::string_view text(buffer.data(), buffer.size());
+
+            size_t newline = text.substr(new_data).rfind('\n');
+            size_t end = newline == std::string_view::npos ? 0 : new_data + newline + 1;
+            size_t keep_from = end;
+            if (final) {
+                end = keep_from = text.size();
+            }
+            else if (end == 0 && text.size() > MAX_LINE_SIZE) {
+                // Keep enough of an overlong line for a literal match to straddle into its next piece
+                end = text.size();
+                keep_from = text.size() - std::min(matcher.overlap(), text.size());
+            }
+            if (end == 0) return;
+
+            std::string_view region = text.substr(0, end);
+            size_t from = 0;
+            size_t position, length;
+            while (from < region.size() && matcher.find(region, from, position, length)) {
+                ++match_count;
+                if (offsets) {
+                    on_match({ region.substr(position, length), base_offset + position });
+                    from = position + std::max<size_t>(length, 1);
+                    continue;
+                }
+
+                size_t line_start = position == 0 ? std::string_view::npos : region.rfind('\n', position - 1);
+                line_start = line_start == std::string_view::npos ? 0 : line_start + 1;
+                size_t line_end = region.find('\n', position);
+                if (line_end == std::string_view::npos) line_end = region.size();
+
+                on_match({ region.substr(line_start, line_end - line_start), base_offset + line_start });
+                from = line_end + 1;
+            }
+
+            sodium_memzero(buffer.data(), keep_from);
+            buffer.erase(buffer.begin(), buffer.begin() + keep_from);
+            base_offset += keep_from;
+        }
+
+        const Matcher& matcher;
+        bool offsets;
+        const std::function<void(const GrepMatch&)>& on_match;
+        std::vector<char> buffer;
+        uint64_t base_offset{ 0 };
+        uint64_t match_count{ 0 };
+        bool closed{ false };
+    };
+
+    uint64_t search_file(const std::string& input_path, const Matcher& matcher, const unsigned char* key, bool offsets,
+        const std::function<void(const GrepMatch&)>& on_match) {
+        unsigned char magic[MAGIC_SIZE]{};
+        bool has_header = false;
+        {
+            std::ifstream probe(input_path, std::ios::binary);
+            if (!probe.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+            has_header = static_cast<bool>(probe.read(reinterpret_cast<char*>(magic), MAGIC_SIZE));
+        }
+
+        MatchSink sink(matcher, offsets, on_match);
+        auto search_stream = [&] {
+            // The plain stream's 4 KiB records are searched in larger batches
+            FileSource source(input_path);
+            BufferedSink batched(sink);
+            decrypt(source, batched, key);
+            batched.close();
+        };
+
+        if (has_header && has_magic(magic, RECORDS_MAGIC)) {
+            // The batches are opened in parallel, and every record is searched as one line
+            const unsigned char newline = '\n';
+            try {
+                scan_record_log(input_path, key, {}, [&](std::string_view record) {
+                    sink.write({ reinterpret_cast<const unsigned char*>(record.data()), record.size() });
+                    sink.write({ &newline, 1 });
+                });
+            }
+            catch (const UtilException&) {
+                // As in decrypt(), a plain stream's random header can start with the magic
+                std::exception_ptr container_failure = std::current_exception();
+                try {
+                    search_stream();
+                }
+                catch (const UtilException&) {
+                    std::rethrow_exception(container_failure);
+                }
+            }
+        }
+        else if (has_header && (has_magic(magic, SMALL_MAGIC) || has_magic(magic, INDEXED_MAGIC) || has_magic(magic, KERNEL_MAGIC) ||
+            has_magic(magic, SEGMENTED_MAGIC) || has_magic(magic, PACK_MAGIC) || has_magic(magic, RECIPE_MAGIC))) {
+            // Throws for packs and recipes, which don't hold a single plaintext
+            std::unique_ptr<ChunkReader> reader = open_chunk_reader(input_path, key);
+            PooledBuffer chunk = BufferPool::instance().acquire(reader->chunk_size());
+            for (uint64_t index = 0; index < reader->chunk_count(); ++index) {
+                size_t length = reader->read_chunk(index, chunk.data());
+                sink.write({ chunk.data(), length });
+            }
+        }
+        else {
+            search_stream();
+        }
+
+        sink.close();
+        return sink.matches();
+    }
+}
+
+uint64_t grep_file(const std::string& input_path, const std::string& pattern, const unsigned char* key, const GrepOptions& options,
+    const std::function<void(const GrepMatch&)>& on_match) {
+    Matcher matcher(pattern, options.regex);
+    return search_file(input_path, matcher, key, options.offsets, on_match);
+}
+
+GrepSummary grep_files(const std::vector<std::string>& input_paths, const std::string& pattern, const unsigned char* key,
+    const GrepOptions& options, std::ostream& out) {
+    // An invalid pattern fails before any file is opened
+    Matcher matcher(pattern, options.regex);
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(input_paths.size(), 1)));
+
+    GrepSummary summary;
+    std::mutex mutex;
+    std::atomic<size_t> next_file{ 0 };
+    bool prefix = input_paths.size() > 1;
+
+    auto work = [&] {
+        std::string pending;
+        auto flush = [&] {
+            std::lock_guard lock(mutex);
+            out << pending;
+            pending.clear();
+        };
+
+        for (size_t i = next_file++; i < input_paths.size(); i = next_file++) {
+            const std::string& input_path = input_paths[i];
+            try {
+                uint64_t matches = search_file(input_path, matcher, key, options.offsets, [&](const GrepMatch& match) {
+                    if (prefix) pending += input_path + ':';
+                    if (options.offsets) pending += std::to_string(match.offset) + ':';
+                    pending.append(match.text);
+                    pending += '\n';
+                    if (pending.size() >= OUTPUT_BATCH_SIZE) flush();
+                });
+                flush();
+
+                std::lock_guard lock(mutex);
+                if (matches > 0) ++summary.files_matched;
+            }
+            catch (const std::exception& e) {
+                // Matches found before a later chunk failed to authenticate are still printed
+                flush();
+                std::lock_guard lock(mutex);
+                std::cerr << std::format("Skipping `{}`: {}", input_path, e.what()) << std::endl;
+                ++summary.files_failed;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i) workers.emplace_back(work);
+    work();
+    for (std::thread& worker : workers) worker.join();
+
+    out.flush();
+    return summary;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+
+struct GrepOptions {
+    // The pattern is an RE2 regular expression matched within each line, rather than a literal
+    bool regex{ false };
+
+    // Report every match with its byte offset in the plaintext, rather than the lines holding one
+    bool offsets{ false };
+
+    // Files searched at once; 0 means one per core
+    unsigned threads{ 0 };
+};
+
+struct GrepMatch {
+    // The matching line, or just the match with `offsets`
+    std::string_view text;
+    // Where `text` starts in the plaintext
+    uint64_t offset{ 0 };
+};
+
+struct GrepSummary {
+    size_t files_matched{ 0 };
+    size_t files_failed{ 0 };
+};
+
+/*
+ * @brief Decrypts any single-file format or record log in memory and calls `on_match` for every line
+ * holding `pattern` (or every match, with `offsets`) in order, including matches that straddle a
+ * chunk boundary. The plaintext is never written anywhere. Returns the number of matches
+ */
+uint64_t grep_file(const std::string& input_path, const std::string& pattern, const unsigned char* key, const GrepOptions& options,
+    const std::function<void(const GrepMatch&)>& on_match);
+
+/*
+ * @brief Searches several files in parallel and prints to `out` like grep: the matching lines, or
+ * `offset:match` with `offsets`, prefixed with the file name when there's more than one file.
+ * Lines of different files may interleave, but each file's lines stay in order. A file that fails
+ * is reported on stderr and the rest are still searched
+ */
+GrepSummary grep_files(const std::vector<std::string>& input_paths, const std::string& pattern, const unsigned char* key,
+    const GrepOptions& options, std::ostream& out);
\ No newline at end of file
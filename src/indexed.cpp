@@ -0,0 +1,369 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#include "src/indexed.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#include <sodium/crypto_aead_xchacha20poly1305.h>
+#include <sodium/crypto_generichash.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+namespace {
+    // Container layout:
+    //   header   = magic (4) | chunk size (u32) | file id (16)
+    //   slot i   = nonce (24) | ciphertext | tag (16), stored at HEADER_SIZE + i * slot size
+    //   manifest = nonce (24) | sealed(plaintext size (u64) | chunk count (u64) | fingerprint (16) * count) | tag (16)
+    //   trailer  = sealed manifest size (u64)
+    // Every slot sits at a fixed offset, so a changed chunk can be resealed without touching its neighbours
+    constexpr size_t INDEXED_CHUNK_SIZE{ 64 * 1024 };
+    constexpr size_t MAX_CHUNK_SIZE{ 64 * 1024 * 1024 };
+    constexpr size_t FILE_ID_SIZE{ 16 };
+    constexpr size_t HEADER_SIZE{ MAGIC_SIZE + 4 + FILE_ID_SIZE };
+    constexpr size_t NONCE_SIZE{ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t TAG_SIZE{ crypto_aead_xchacha20poly1305_ietf_ABYTES };
+    constexpr size_t FINGERPRINT_SIZE{ crypto_generichash_BYTES_MIN };
+    constexpr size_t MANIFEST_FIXED_SIZE{ 16 };
+    constexpr size_t TRAILER_SIZE{ 8 };
+    constexpr size_t CHUNK_AD_SIZE{ FILE_ID_SIZE + 8 };
+
+    struct Keys {
+        unsigned char seal[32];
+        unsigned char fingerprint[32];
+
+        explicit Keys(const unsigned char* key) {
+            derive_subkey(seal, 1, "CUINDEX1", key);
+            derive_subkey(fingerprint, 2, "CUINDEX1", key);
+        }
+
+        ~Keys() {
+            sodium_memzero(seal, sizeof(seal));
+            sodium_memzero(fingerprint, sizeof(fingerprint));
+        }
+    };
+
+    struct Container {
+        unsigned char header[HEADER_SIZE];
+        uint32_t chunk_size{ 0 };
+        uint64_t plaintext_size{ 0 };
+        std::vector<unsigned char> fingerprints;
+
+        uint64_t chunk_count() const { return fingerprints.size() / FINGERPRINT_SIZE; }
+        const unsigned char* file_id() const { return header + MAGIC_SIZE + 4; }
+
+        uint64_t slot_offset(uint64_t index) const {
+            return HEADER_SIZE + index * (NONCE_SIZE + chunk_size + TAG_SIZE);
+        }
+
+        uint64_t manifest_offset() const {
+            return HEADER_SIZE + chunk_count() * (NONCE_SIZE + TAG_SIZE) + plaintext_size;
+        }
+
+        size_t chunk_length(uint64_t index) const {
+            return static_cast<size_t>(std::min<uint64_t>(chunk_size, plaintext_size - index * chunk_size));
+        }
+    };
+
+    void compute_fingerprint(unsigned char* out, const unsigned char* data, size_t size, const Keys& keys) {
+        crypto_generichash(out, FINGERPRINT_SIZE, data, size, keys.fingerprint, sizeof(keys.fingerprint));
+    }
+
+    // Binds every chunk to its container and position so slots can't be swapped or moved
+    void build_chunk_ad(unsigned char* ad, const Container& container, uint64_t index) {
+        std::memcpy(ad, container.file_id(), FILE_ID_SIZE);
+        store_u64(ad + FILE_ID_SIZE, index);
+    }
+
+    /*
+     * Reads the header and manifest of the container in `file`.
+     * Returns false if `file` isn't a chunk-indexed container at all, and throws if
+     * it is one but its manifest doesn't authenticate under `keys`
+     */
+    bool read_container(std::ifstream& file, uint64_t file_size, const Keys& keys, Container& container) {
+        if (file_size < HEADER_SIZE + NONCE_SIZE + MANIFEST_FIXED_SIZE + TAG_SIZE + TRAILER_SIZE) return false;
+
+        file.read(reinterpret_cast<char*>(container.header), HEADER_SIZE);
+        if (!file || !has_magic(container.header, INDEXED_MAGIC)) return false;
+
+        container.chunk_size = load_u32(container.header + MAGIC_SIZE);
+        if (container.chunk_size == 0 || container.chunk_size > MAX_CHUNK_SIZE) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+
+        unsigned char trailer[TRAILER_SIZE];
+        file.seekg(file_size - TRAILER_SIZE);
+        file.read(reinterpret_cast<char*>(trailer), TRAILER_SIZE);
+        uint64_t sealed_size = load_u64(trailer);
+
+        if (sealed_size < NONCE_SIZE + MANIFEST_FIXED_SIZE + TAG_SIZE || sealed_size > file_size - HEADER_SIZE - TRAILER_SIZE) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+
+        std::vector<unsigned char> sealed(sealed_size);
+        file.seekg(file_size - TRAILER_SIZE - sealed_size);
+        file.read(reinterpret_cast<char*>(sealed.data()), sealed_size);
+        if (!file) throw FileError("Error: Couldn't read the manifest");
+
+        std::vector<unsigned char> manifest(sealed_size - NONCE_SIZE - TAG_SIZE);
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            manifest.data(), NULL, NULL,
+            sealed.data() + NONCE_SIZE, sealed_size - NONCE_SIZE,
+            container.header, HEADER_SIZE,
+            sealed.data(), keys.seal) != 0) {
+            throw AuthError("Couldn't open the manifest. The key is wrong or the file is corrupt");
+        }
+
+        container.plaintext_size = load_u64(manifest.data());
+        uint64_t chunk_count = load_u64(manifest.data() + 8);
+        container.fingerprints.assign(manifest.begin() + MANIFEST_FIXED_SIZE, manifest.end());
+
+        uint64_t expected_count = (container.plaintext_size + container.chunk_size - 1) / container.chunk_size;
+        if (container.chunk_count() != chunk_count || chunk_count != expected_count ||
+            container.manifest_offset() != file_size - TRAILER_SIZE - sealed_size) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+
+        return true;
+    }
+
+    // Opens slot `index`, read into `slot`, into `out`
+    void open_slot(const unsigned char* slot, const Container& container, const Keys& keys, uint64_t index, unsigned char* out) {
+        size_t length = container.chunk_length(index);
+        unsigned char ad[CHUNK_AD_SIZE];
+        build_chunk_ad(ad, container, index);
+
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            out, NULL, NULL,
+            slot + NONCE_SIZE, length + TAG_SIZE,
+            ad, sizeof(ad),
+            slot, keys.seal) != 0) {
+            throw AuthError("Decryption failed. The input file maybe corrupt");
+        }
+
+        // A chunk left over from an older generation of the container authenticates,
+        // but won't match the fingerprint the current manifest recorded for its slot
+        unsigned char fingerprint[FINGERPRINT_SIZE];
+        compute_fingerprint(fingerprint, out, length, keys);
+        if (std::memcmp(fingerprint, container.fingerprints.data() + index * FINGERPRINT_SIZE, FINGERPRINT_SIZE) != 0) {
+            throw AuthError("Decryption failed. The input file maybe corrupt");
+        }
+    }
+
+    // Every slot sits at a fixed offset, so any chunk is one read and one decryption away
+    class IndexedChunkReader : public ChunkReader {
+    public:
+        IndexedChunkReader(const std::string& input_path, const unsigned char* key)
+            : file(input_path, std::ios::binary), keys(key) {
+            if (!file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+            if (!read_container(file, std::filesystem::file_size(input_path), keys, container)) {
+                throw UtilException("Decryption failed. The input file maybe corrupt");
+            }
+            slot.resize(NONCE_SIZE + container.chunk_size + TAG_SIZE);
+        }
+
+        uint64_t size() const override { return container.plaintext_size; }
+        size_t chunk_size() const override { return container.chunk_size; }
+        uint64_t chunk_count() const override { return container.chunk_count(); }
+
+        size_t read_chunk(uint64_t index, unsigned char* out) override {
+            size_t length = container.chunk_length(index);
+            file.seekg(static_cast<std::streamoff>(container.slot_offset(index)));
+            if (!file.read(reinterpret_cast<char*>(slot.data()), static_cast<std::streamsize>(NONCE_SIZE + length + TAG_SIZE))) {
+                file.clear();
+                throw AuthError("Decryption failed. The input file maybe corrupt");
+            }
+
+            open_slot(slot.data(), container, keys, index, out);
+            return length;
+        }
+
+    private:
+        std::ifstream file;
+        Keys keys;
+        Container container;
+        std::vector<unsigned char> slot;
+    };
+
+    // Seals the manifest at the end of the last slot and returns the final container size
+    uint64_t write_manifest(std::fstream& file, const Container& container, const Keys& keys) {
+        std::vector<unsigned char> manifest(MANIFEST_FIXED_SIZE + container.fingerprints.size());
+        store_u64(manifest.data(), container.plaintext_size);
+        store_u64(manifest.data() + 8, container.chunk_count());
+        std::copy(container.fingerprints.begin(), container.fingerprints.end(), manifest.begin() + MANIFEST_FIXED_SIZE);
+
+        std::vector<unsigned char> sealed(NONCE_SIZE + manifest.size() + TAG_SIZE + TRAILER_SIZE);
+        randombytes_buf(sealed.data(), NONCE_SIZE);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(
+            sealed.data() + NONCE_SIZE, NULL,
+            manifest.data(), manifest.size(),
+            container.header, HEADER_SIZE,
+            NULL, sealed.data(), keys.seal);
+        store_u64(sealed.data() + sealed.size() - TRAILER_SIZE, sealed.size() - TRAILER_SIZE);
+
+        file.seekp(container.manifest_offset());
+        file.write(reinterpret_cast<const char*>(sealed.data()), sealed.size());
+
+        return container.manifest_offset() + sealed.size();
+    }
+}
+
+void encrypt_indexed(const std::string& input_path, const std::string& output_path, const unsigned char* key) {
+    // Read from the input plaintext file
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) {
+        throw FileError("Error: Couldn't open input file `" + input_path + '`');
+    }
+
+    Keys keys(key);
+
+    // Pick up the manifest of a previous run, if there's one to update
+    Container previous;
+    bool updating = false;
+    {
+        std::ifstream existing_file(output_path, std::ios::binary);
+        if (existing_file.is_open()) {
+            updating = read_container(existing_file, std::filesystem::file_size(output_path), keys, previous);
+        }
+    }
+
+    Container container;
+    if (updating) {
+        std::memcpy(container.header, previous.header, HEADER_SIZE);
+        container.chunk_size = previous.chunk_size;
+    }
+    else {
+        std::memcpy(container.header, INDEXED_MAGIC, MAGIC_SIZE);
+        container.chunk_size = INDEXED_CHUNK_SIZE;
+        store_u32(container.header + MAGIC_SIZE, container.chunk_size);
+        randombytes_buf(container.header + MAGIC_SIZE + 4, FILE_ID_SIZE);
+    }
+
+    // An existing container is patched in place, so it must not be truncated on open
+    std::fstream output_file(output_path, updating ? std::ios::in | std::ios::out | std::ios::binary : std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!output_file.is_open()) {
+        throw FileError("Error: Couldn't open output file `" + output_path + '`');
+    }
+
+    if (!updating) output_file.write(reinterpret_cast<const char*>(container.header), HEADER_SIZE);
+
+    std::vector<unsigned char> plaintext_chunk(container.chunk_size);
+    std::vector<unsigned char> slot(NONCE_SIZE + container.chunk_size + TAG_SIZE);
+    unsigned char fingerprint[FINGERPRINT_SIZE];
+    unsigned char ad[CHUNK_AD_SIZE];
+    uint64_t resealed = 0;
+
+    // Only the chunks whose fingerprint differs from the previous manifest get resealed and written
+    while (true) {
+        input_file.read(reinterpret_cast<char*>(plaintext_chunk.data()), container.chunk_size);
+        size_t bytes_read = input_file.gcount();
+
+        if (bytes_read == 0) break; // Reached EOF
+
+        uint64_t index = container.chunk_count();
+        compute_fingerprint(fingerprint, plaintext_chunk.data(), bytes_read, keys);
+
+        bool unchanged = index < previous.chunk_count() &&
+            std::memcmp(fingerprint, previous.fingerprints.data() + index * FINGERPRINT_SIZE, FINGERPRINT_SIZE) == 0;
+
+        if (!unchanged) {
+            randombytes_buf(slot.data(), NONCE_SIZE);
+            build_chunk_ad(ad, container, index);
+            crypto_aead_xchacha20poly1305_ietf_encrypt(
+                slot.data() + NONCE_SIZE, NULL,
+                plaintext_chunk.data(), bytes_read,
+                ad, sizeof(ad),
+                NULL, slot.data(), keys.seal);
+
+            output_file.seekp(container.slot_offset(index));
+            output_file.write(reinterpret_cast<const char*>(slot.data()), NONCE_SIZE + bytes_read + TAG_SIZE);
+            ++resealed;
+        }
+
+        container.fingerprints.insert(container.fingerprints.end(), fingerprint, fingerprint + FINGERPRINT_SIZE);
+        container.plaintext_size += bytes_read;
+
+        if (bytes_read < container.chunk_size) break;
+    }
+
+    // Nothing changed at all: leave the container untouched
+    bool modified = !updating || resealed != 0 || container.chunk_count() != previous.chunk_count();
+
+    uint64_t container_size = 0;
+    if (modified) container_size = write_manifest(output_file, container, keys);
+
+    input_file.close();
+    output_file.close();
+    if (output_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+
+    // Drop whatever is left of a previous, longer container
+    if (modified) std::filesystem::resize_file(output_path, container_size);
+
+    std::cout << std::format("Successfully encrypted `{}` to `{}` ({} of {} chunks resealed)",
+        input_path, output_path, resealed, container.chunk_count()) << std::endl;
+}
+
+void decrypt_indexed(const std::string& input_path, const std::string& output_path, const unsigned char* key, bool report) {
+    // Read from the input encrypted file
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+    Keys keys(key);
+    Container container;
+    if (!read_container(input_file, std::filesystem::file_size(input_path), keys, container)) {
+        throw UtilException("Decryption failed. The input file maybe corrupt");
+    }
+
+    // Check the validity of the output file
+    std::ofstream output_file(output_path, std::ios::binary);
+    if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+    std::vector<unsigned char> slot(NONCE_SIZE + container.chunk_size + TAG_SIZE);
+    std::vector<unsigned char> decrypted_chunk(container.chunk_size);
+
+    // The slots are contiguous, so after the header they are read sequentially
+    input_file.seekg(HEADER_SIZE);
+
+    for (uint64_t index = 0; index < container.chunk_count(); ++index) {
+        size_t length = container.chunk_length(index);
+
+        input_file.read(reinterpret_cast<char*>(slot.data()), NONCE_SIZE + length + TAG_SIZE);
+        if (!input_file) throw AuthError("Decryption failed. The input file maybe corrupt");
+        open_slot(slot.data(), container, keys, index, decrypted_chunk.data());
+
+        output_file.write(reinterpret_cast<const char*>(decrypted_chunk.data()), length);
+    }
+
+    input_file.close();
+    output_file.close();
+
+    if (report) std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
+}
+
+std::unique_ptr<ChunkReader> open_indexed_reader(const std::string& input_path, const unsigned char* key) {
+    return std::make_unique<IndexedChunkReader>(input_path, key);
+}
@@ -0,0 +1,39 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <memory>
+
+#include "src/chunk_reader.hpp"
+
+/*
+ * @brief Encrypts into a chunk-indexed container whose chunks are sealed independently.
+ * If `output_path` already holds such a container, only the chunks whose plaintext
+ * changed since it was written are resealed and patched in place
+ */
+void encrypt_indexed(const std::string& input_path, const std::string& output_path, const unsigned char* key);
+
+/*
+ * @brief Decrypts a chunk-indexed container written by `encrypt_indexed()`, printing a line when done if `report` is set
+ */
+void decrypt_indexed(const std::string& input_path, const std::string& output_path, const unsigned char* key, bool report = true);
+
+/*
+ * @brief Opens a chunk-indexed container for random access. Its manifest is authenticated up front
+ */
+std::unique_ptr<ChunkReader> open_indexed_reader(const std::string& input_path, const unsigned char* key);
@@ -0,0 +1,450 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#include "src/kernel.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+#include "utilities/file_io.h"
+#include "utilities/buffer_pool.h"
+#include "utilities/throttle.h"
+#include "utilities/progress.h"
+#include "utilities/metrics.h"
+
+#include <sodium/crypto_aead_chacha20poly1305.h>
+#include <sodium/crypto_generichash.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+#if defined(__linux__)
+    #include <linux/if_alg.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+
+    #ifndef SOL_ALG
+        #define SOL_ALG 279
+    #endif
+#endif
+
+namespace {
+    /*
+     * Layout: magic (4) | salt (16) | (ciphertext of up to CHUNK_SIZE bytes | tag (16))*
+     * Like the stream format, a final record is always written and is empty when the plaintext
+     * is a multiple of the chunk size. Each file gets its own key, a keyed hash of a random salt,
+     * so the record counter can serve as the nonce. The nonce also carries a final flag, and the
+     * header is the associated data of every record, so records can't be dropped, reordered or
+     * moved between files
+     */
+    constexpr size_t SALT_SIZE{ 16 };
+    constexpr size_t HEADER_SIZE{ MAGIC_SIZE + SALT_SIZE };
+    constexpr size_t CHUNK_SIZE{ 64 * 1024 };
+    constexpr size_t TAG_SIZE{ crypto_aead_chacha20poly1305_ietf_ABYTES };
+    constexpr size_t NONCE_SIZE{ crypto_aead_chacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t KEY_SIZE{ crypto_aead_chacha20poly1305_ietf_KEYBYTES };
+    constexpr size_t RECORD_SIZE{ CHUNK_SIZE + TAG_SIZE };
+
+    struct FileKey {
+        unsigned char bytes[KEY_SIZE];
+
+        FileKey(const unsigned char* salt, const unsigned char* key) {
+            unsigned char subkey[KEY_SIZE];
+            derive_subkey(subkey, 1, "CUKERNEL", key);
+            crypto_generichash(bytes, sizeof(bytes), salt, SALT_SIZE, subkey, sizeof(subkey));
+            sodium_memzero(subkey, sizeof(subkey));
+        }
+
+        ~FileKey() {
+            sodium_memzero(bytes, sizeof(bytes));
+        }
+    };
+
+    void record_nonce(unsigned char* nonce, uint64_t index, bool final) {
+        store_u64(nonce, index);
+        store_u32(nonce + 8, final ? 1 : 0);
+    }
+
+    // Returns the plaintext length of record `index` out of `count` for a file of `plaintext_size` bytes
+    size_t chunk_length(uint64_t index, uint64_t count, uint64_t plaintext_size) {
+        return index + 1 < count ? CHUNK_SIZE : static_cast<size_t>(plaintext_size - index * CHUNK_SIZE);
+    }
+
+    void count_read(const IoOptions& io_options, size_t bytes) {
+        if (io_options.progress) io_options.progress->add(bytes);
+        if (io_options.metrics) io_options.metrics->add_read(bytes);
+    }
+
+    // Records are bound to their index, so any one of them opens on its own
+    class KernelChunkReader : public ChunkReader {
+    public:
+        KernelChunkReader(const std::string& input_path, const unsigned char* key)
+            : file(input_path, std::ios::binary), sealed(RECORD_SIZE) {
+            if (!file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+            uint64_t file_size = std::filesystem::file_size(input_path);
+            if (file_size < HEADER_SIZE + TAG_SIZE || !file.read(reinterpret_cast<char*>(header), HEADER_SIZE) || !has_magic(header, KERNEL_MAGIC)) {
+                throw UtilException("Decryption failed. The input file maybe corrupt");
+            }
+            file_key = std::make_unique<FileKey>(header + MAGIC_SIZE, key);
+
+            // Every record but the last is full, and the last holds at least its tag
+            uint64_t body_size = file_size - HEADER_SIZE;
+            count = body_size / RECORD_SIZE + 1;
+            last_length = static_cast<size_t>(body_size - (count - 1) * RECORD_SIZE);
+            if (last_length < TAG_SIZE) throw AuthError("Decryption failed. The input file is truncated");
+            plaintext_size = body_size - count * TAG_SIZE;
+        }
+
+        uint64_t size() const override { return plaintext_size; }
+        size_t chunk_size() const override { return CHUNK_SIZE; }
+        uint64_t chunk_count() const override { return count; }
+
+        size_t read_chunk(uint64_t index, unsigned char* out) override {
+            size_t length = index + 1 < count ? RECORD_SIZE : last_length;
+            file.seekg(static_cast<std::streamoff>(HEADER_SIZE + index * RECORD_SIZE));
+            if (!file.read(reinterpret_cast<char*>(sealed.data()), static_cast<std::streamsize>(length))) {
+                file.clear();
+                throw AuthError("Decryption failed. The input file maybe corrupt");
+            }
+
+            unsigned char nonce[NONCE_SIZE];
+            record_nonce(nonce, index, index + 1 == count);
+            unsigned long long opened_length;
+            if (crypto_aead_chacha20poly1305_ietf_decrypt(out, &opened_length, NULL, sealed.data(), length,
+                header, HEADER_SIZE, nonce, file_key->bytes) != 0) {
+                throw AuthError("Decryption failed. The input file maybe corrupt");
+            }
+            return static_cast<size_t>(opened_length);
+        }
+
+    private:
+        std::ifstream file;
+        std::vector<unsigned char> sealed;
+        unsigned char header[HEADER_SIZE];
+        std::unique_ptr<FileKey> file_key;
+        uint64_t count{ 0 };
+        size_t last_length{ 0 };
+        uint64_t plaintext_size{ 0 };
+    };
+
+#if defined(__linux__)
+    constexpr const char* ALGORITHM{ "rfc7539(chacha20,poly1305)" };
+
+    /*
+     * @brief One AF_ALG AEAD operation socket. Each operation takes the header from memory with
+     * sendmsg() and the record from the file with splice() through a pipe, so the record's bytes
+     * reach the cipher without being copied into user space. The kernel doesn't support splicing
+     * the result back out, so that is read into a buffer
+     */
+    class AlgSocket {
+    public:
+        // Returns nullptr and sets `error` if the kernel can't provide the algorithm
+        static std::unique_ptr<AlgSocket> open(const unsigned char* key, std::string& error) {
+            auto alg = std::unique_ptr<AlgSocket>(new AlgSocket());
+
+            alg->tfm_fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            if (alg->tfm_fd < 0) {
+                error = std::format("AF_ALG sockets aren't available: {}", std::strerror(errno));
+                return nullptr;
+            }
+
+            sockaddr_alg address{};
+            address.salg_family = AF_ALG;
+            std::strcpy(reinterpret_cast<char*>(address.salg_type), "aead");
+            std::strcpy(reinterpret_cast<char*>(address.salg_name), ALGORITHM);
+
+            if (bind(alg->tfm_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                setsockopt(alg->tfm_fd, SOL_ALG, ALG_SET_KEY, key, KEY_SIZE) != 0 ||
+                setsockopt(alg->tfm_fd, SOL_ALG, ALG_SET_AEAD_AUTHSIZE, nullptr, TAG_SIZE) != 0) {
+                error = std::format("the kernel doesn't provide {}: {}", ALGORITHM, std::strerror(errno));
+                return nullptr;
+            }
+
+            alg->op_fd = accept4(alg->tfm_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (alg->op_fd < 0 || pipe2(alg->pipe_fds, O_CLOEXEC) != 0) {
+                error = std::format("couldn't set up the {} socket: {}", ALGORITHM, std::strerror(errno));
+                return nullptr;
+            }
+
+            // Best effort: a pipe that holds a whole record splices it in one go
+            fcntl(alg->pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(RECORD_SIZE));
+            return alg;
+        }
+
+        ~AlgSocket() {
+            for (int fd : { op_fd, tfm_fd, pipe_fds[0], pipe_fds[1] }) {
+                if (fd >= 0) close(fd);
+            }
+        }
+
+        AlgSocket(const AlgSocket&) = delete;
+        AlgSocket& operator=(const AlgSocket&) = delete;
+
+        /*
+         * @brief Seals (or opens) `length` bytes at `offset` in `in_fd` with `header` as associated data.
+         * `out` receives the header followed by the result and must hold `out_size` bytes.
+         * Throws AuthError if a record fails to open
+         */
+        void run(bool encrypting, const unsigned char* nonce, const unsigned char* header,
+            int in_fd, uint64_t offset, size_t length, unsigned char* out, size_t out_size) {
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(af_alg_iv) + NONCE_SIZE) + CMSG_SPACE(sizeof(uint32_t))]{};
+
+            msghdr message{};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+
+            cmsghdr* header_op = CMSG_FIRSTHDR(&message);
+            header_op->cmsg_level = SOL_ALG;
+            header_op->cmsg_type = ALG_SET_OP;
+            header_op->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+            uint32_t operation = encrypting ? ALG_OP_ENCRYPT : ALG_OP_DECRYPT;
+            std::memcpy(CMSG_DATA(header_op), &operation, sizeof(operation));
+
+            cmsghdr* header_iv = CMSG_NXTHDR(&message, header_op);
+            header_iv->cmsg_level = SOL_ALG;
+            header_iv->cmsg_type = ALG_SET_IV;
+            header_iv->cmsg_len = CMSG_LEN(sizeof(af_alg_iv) + NONCE_SIZE);
+            af_alg_iv* iv = reinterpret_cast<af_alg_iv*>(CMSG_DATA(header_iv));
+            iv->ivlen = NONCE_SIZE;
+            std::memcpy(iv->iv, nonce, NONCE_SIZE);
+
+            cmsghdr* header_assoc = CMSG_NXTHDR(&message, header_iv);
+            header_assoc->cmsg_level = SOL_ALG;
+            header_assoc->cmsg_type = ALG_SET_AEAD_ASSOCLEN;
+            header_assoc->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+            uint32_t assoc_length = HEADER_SIZE;
+            std::memcpy(CMSG_DATA(header_assoc), &assoc_length, sizeof(assoc_length));
+
+            iovec header_iov{ const_cast<unsigned char*>(header), HEADER_SIZE };
+            message.msg_iov = &header_iov;
+            message.msg_iovlen = 1;
+
+            // MSG_MORE holds the operation open until the spliced record arrives
+            if (sendmsg(op_fd, &message, length > 0 ? MSG_MORE : 0) != static_cast<ssize_t>(HEADER_SIZE)) {
+                throw UtilException(std::format("Error: AF_ALG sendmsg failed: {}", std::strerror(errno)));
+            }
+
+            loff_t file_offset = static_cast<loff_t>(offset);
+            size_t remaining = length;
+            while (remaining > 0) {
+                ssize_t filled = splice(in_fd, &file_offset, pipe_fds[1], nullptr, remaining, SPLICE_F_MOVE);
+                if (filled <= 0) {
+                    if (filled < 0 && errno == EINTR) continue;
+                    throw FileError(std::format("Error: Couldn't splice the input: {}", filled == 0 ? "unexpected end of file" : std::strerror(errno)));
+                }
+                remaining -= static_cast<size_t>(filled);
+
+                // The operation starts once a splice arrives without SPLICE_F_MORE
+                size_t in_pipe = static_cast<size_t>(filled);
+                while (in_pipe > 0) {
+                    ssize_t moved = splice(pipe_fds[0], nullptr, op_fd, nullptr, in_pipe, SPLICE_F_MOVE | (remaining > 0 ? SPLICE_F_MORE : 0));
+                    if (moved <= 0) {
+                        if (moved < 0 && errno == EINTR) continue;
+                        throw UtilException(std::format("Error: Couldn't splice into the AF_ALG socket: {}", std::strerror(errno)));
+                    }
+                    in_pipe -= static_cast<size_t>(moved);
+                }
+            }
+
+            size_t received = 0;
+            while (received < out_size) {
+                ssize_t result = read(op_fd, out + received, out_size - received);
+                if (result < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EBADMSG) throw AuthError("Decryption failed. The input file maybe corrupt");
+                    throw UtilException(std::format("Error: AF_ALG read failed: {}", std::strerror(errno)));
+                }
+                if (result == 0) break;
+                received += static_cast<size_t>(result);
+            }
+            if (received != out_size) throw UtilException("Error: AF_ALG returned a short result");
+        }
+
+    private:
+        AlgSocket() = default;
+
+        int tfm_fd{ -1 };
+        int op_fd{ -1 };
+        int pipe_fds[2]{ -1, -1 };
+    };
+
+    // Only encryption warns: it's what --kernel-crypto asked for, while decryption works the same either way
+    std::unique_ptr<AlgSocket> open_kernel_cipher(const unsigned char* file_key, bool warn) {
+        std::string error;
+        std::unique_ptr<AlgSocket> alg = AlgSocket::open(file_key, error);
+        if (!alg && warn) std::cerr << std::format("Warning: {}, using libsodium instead", error) << std::endl;
+        return alg;
+    }
+
+    struct FdCloser {
+        int fd;
+        ~FdCloser() { close(fd); }
+    };
+
+    int open_input_fd(const std::string& path, uint64_t& size) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) close(fd);
+            throw FileError("Error: Couldn't open input file `" + path + '`');
+        }
+        size = static_cast<uint64_t>(info.st_size);
+        return fd;
+    }
+#endif
+}
+
+void encrypt_kernel(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options) {
+    unsigned char header[HEADER_SIZE];
+    std::memcpy(header, KERNEL_MAGIC, MAGIC_SIZE);
+    randombytes_buf(header + MAGIC_SIZE, SALT_SIZE);
+    FileKey file_key(header + MAGIC_SIZE, key);
+    unsigned char nonce[NONCE_SIZE];
+
+#if defined(__linux__)
+    if (std::unique_ptr<AlgSocket> alg = open_kernel_cipher(file_key.bytes, true)) {
+        uint64_t plaintext_size = 0;
+        int in_fd = open_input_fd(input_path, plaintext_size);
+        FdCloser in_closer{ in_fd };
+        PooledBuffer sealed = BufferPool::instance().acquire(HEADER_SIZE + RECORD_SIZE);
+
+        OutputFile output_file(output_path, io_options);
+        uint64_t count = plaintext_size / CHUNK_SIZE + 1;
+        output_file.preallocate(HEADER_SIZE + count * TAG_SIZE + plaintext_size);
+        output_file.write(header, HEADER_SIZE);
+
+        for (uint64_t index = 0; index < count; ++index) {
+            size_t length = chunk_length(index, count, plaintext_size);
+            if (io_options.throttle) io_options.throttle->before_read(length);
+
+            record_nonce(nonce, index, index + 1 == count);
+            alg->run(true, nonce, header, in_fd, index * CHUNK_SIZE, length, sealed.data(), HEADER_SIZE + length + TAG_SIZE);
+            count_read(io_options, length);
+
+            // The kernel hands the associated data back in front of the result
+            output_file.write(sealed.data() + HEADER_SIZE, length + TAG_SIZE);
+        }
+
+        output_file.close();
+        std::cout << std::format("Successfully encrypted `{}` to `{}` (AF_ALG)", input_path, output_path) << std::endl;
+        return;
+    }
+#endif
+
+    InputFile input_file(input_path, io_options);
+    OutputFile output_file(output_path, io_options);
+    PooledBuffer plaintext = BufferPool::instance().acquire(CHUNK_SIZE);
+    PooledBuffer sealed = BufferPool::instance().acquire(RECORD_SIZE);
+    uint64_t plaintext_size = input_file.size();
+    output_file.preallocate(HEADER_SIZE + (plaintext_size / CHUNK_SIZE + 1) * TAG_SIZE + plaintext_size);
+    output_file.write(header, HEADER_SIZE);
+
+    uint64_t index = 0;
+    do {
+        size_t length = input_file.read(plaintext.data(), CHUNK_SIZE);
+        record_nonce(nonce, index++, input_file.eof());
+
+        unsigned long long sealed_length;
+        crypto_aead_chacha20poly1305_ietf_encrypt(sealed.data(), &sealed_length, plaintext.data(), length,
+            header, HEADER_SIZE, NULL, nonce, file_key.bytes);
+        output_file.write(sealed.data(), sealed_length);
+    } while (!input_file.eof());
+
+    input_file.close();
+    output_file.close();
+    std::cout << std::format("Successfully encrypted `{}` to `{}`", input_path, output_path) << std::endl;
+}
+
+void decrypt_kernel(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options) {
+    InputFile input_file(input_path, io_options);
+    uint64_t file_size = input_file.size();
+
+    unsigned char header[HEADER_SIZE];
+    if (file_size < HEADER_SIZE + TAG_SIZE || input_file.read(header, HEADER_SIZE) != HEADER_SIZE || !has_magic(header, KERNEL_MAGIC)) {
+        throw UtilException("Decryption failed. The input file maybe corrupt");
+    }
+    FileKey file_key(header + MAGIC_SIZE, key);
+
+    // Every record but the last is full, and the last holds at least its tag
+    uint64_t body_size = file_size - HEADER_SIZE;
+    uint64_t count = body_size / RECORD_SIZE + 1;
+    size_t last_length = static_cast<size_t>(body_size - (count - 1) * RECORD_SIZE);
+    if (last_length < TAG_SIZE) throw UtilException("Decryption failed. The input file maybe corrupt");
+    uint64_t plaintext_size = body_size - count * TAG_SIZE;
+
+    PooledBuffer sealed = BufferPool::instance().acquire(HEADER_SIZE + RECORD_SIZE);
+    PooledBuffer plaintext = BufferPool::instance().acquire(HEADER_SIZE + RECORD_SIZE);
+    unsigned char nonce[NONCE_SIZE];
+
+    OutputFile output_file(output_path, io_options);
+    output_file.preallocate(plaintext_size);
+
+#if defined(__linux__)
+    if (std::unique_ptr<AlgSocket> alg = open_kernel_cipher(file_key.bytes, false)) {
+        input_file.close();
+        uint64_t spliced_size = 0;
+        int in_fd = open_input_fd(input_path, spliced_size);
+        FdCloser in_closer{ in_fd };
+
+        for (uint64_t index = 0; index < count; ++index) {
+            size_t length = index + 1 < count ? RECORD_SIZE : last_length;
+            if (io_options.throttle) io_options.throttle->before_read(length);
+
+            record_nonce(nonce, index, index + 1 == count);
+            alg->run(false, nonce, header, in_fd, HEADER_SIZE + index * RECORD_SIZE, length, plaintext.data(), HEADER_SIZE + length - TAG_SIZE);
+            count_read(io_options, length);
+
+            output_file.write(plaintext.data() + HEADER_SIZE, length - TAG_SIZE);
+        }
+
+        output_file.close();
+        if (io_options.report) std::cout << std::format("Successfully decrypted `{}` to `{}` (AF_ALG)", input_path, output_path) << std::endl;
+        return;
+    }
+#endif
+
+    for (uint64_t index = 0; index < count; ++index) {
+        size_t length = index + 1 < count ? RECORD_SIZE : last_length;
+        if (input_file.read(sealed.data(), length) != length) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+        record_nonce(nonce, index, index + 1 == count);
+        unsigned long long opened_length;
+        if (crypto_aead_chacha20poly1305_ietf_decrypt(plaintext.data(), &opened_length, NULL, sealed.data(), length,
+            header, HEADER_SIZE, nonce, file_key.bytes) != 0) {
+            throw AuthError("Decryption failed. The input file maybe corrupt");
+        }
+        output_file.write(plaintext.data(), opened_length);
+    }
+
+    input_file.close();
+    output_file.close();
+    if (io_options.report) std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
+}
+
+std::unique_ptr<ChunkReader> open_kernel_reader(const std::string& input_path, const unsigned char* key) {
+    return std::make_unique<KernelChunkReader>(input_path, key);
+}
@@ -0,0 +1,42 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <memory>
+
+#include "src/chunk_reader.hpp"
+
+#include "utilities/file_io.h"
+
+/*
+ * @brief Encrypts with ChaCha20-Poly1305 (RFC 7539) in the kernel through AF_ALG, splicing the
+ * input straight from the file into the cipher socket. Falls back to libsodium, with a warning,
+ * where AF_ALG or the algorithm isn't available; both write the same format
+ */
+void encrypt_kernel(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options = {});
+
+/*
+ * @brief Decrypts a file written by `encrypt_kernel()`, in the kernel when possible and with libsodium otherwise
+ */
+void decrypt_kernel(const std::string& input_path, const std::string& output_path, const unsigned char* key, const IoOptions& io_options = {});
+
+/*
+ * @brief Opens a file written by `encrypt_kernel()` for random access. Records are opened with
+ * libsodium, since one record at a time gains nothing from AF_ALG's splicing
+ */
+std::unique_ptr<ChunkReader> open_kernel_reader(const std::string& input_path, const unsigned char* key);
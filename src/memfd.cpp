@@ -0,0 +1,197 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <format>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#include "src/memfd.hpp"
+#include "src/decrypt.hpp"
+#include "src/chunk_reader.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__linux__)
+namespace {
+    // Sealed so that neither the sender nor anyone it passes the fd to can change the plaintext
+    constexpr int REQUIRED_SEALS{ F_SEAL_WRITE | F_SEAL_SHRINK };
+    constexpr int APPLIED_SEALS{ REQUIRED_SEALS | F_SEAL_GROW | F_SEAL_SEAL };
+
+    struct FdCloser {
+        int fd;
+        ~FdCloser() {
+            if (fd >= 0) close(fd);
+        }
+    };
+}
+
+int decrypt_to_memfd(const std::string& input_path, const unsigned char* key, const IoOptions& io_options) {
+    // A pack holds many files and has nowhere to go in a single memfd
+    std::ifstream input_file(input_path, std::ios::binary);
+    unsigned char magic[MAGIC_SIZE]{};
+    bool pack_magic = input_file.read(reinterpret_cast<char*>(magic), MAGIC_SIZE) && has_magic(magic, PACK_MAGIC);
+    input_file.close();
+
+    // Throws for a pack, unless it's really a plain stream whose header starts with the magic
+    if (pack_magic) open_chunk_reader(input_path, key);
+
+    int memfd = memfd_create("cryptoutils-plaintext", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0) throw FileError(std::format("Error: memfd_create failed: {}", std::strerror(errno)));
+    FdCloser closer{ memfd };
+
+    // Going through /dev/fd lets every format's decrypter write to the memfd as if it were a named file, as
+    // decrypt_to_command() does with its pipe. O_DIRECT and cache dropping mean nothing for memory, so they're
+    // turned off, and the caller reports the handoff rather than a path that's gone once the memfd is passed on
+    IoOptions memory_options = io_options;
+    memory_options.direct = false;
+    memory_options.drop_cache = false;
+    memory_options.report = false;
+    decrypt(input_path, std::format("/dev/fd/{}", memfd), key, memory_options);
+
+    if (fcntl(memfd, F_ADD_SEALS, APPLIED_SEALS) != 0) {
+        throw FileError(std::format("Error: Couldn't seal the memfd: {}", std::strerror(errno)));
+    }
+
+    closer.fd = -1;
+    return memfd;
+}
+
+void decrypt_to_socket(const std::string& input_path, const std::string& socket_path, const unsigned char* key, const IoOptions& io_options) {
+    int memfd = decrypt_to_memfd(input_path, key, io_options);
+    FdCloser closer{ memfd };
+    send_memfd(socket_path, memfd);
+}
+
+void send_memfd(int socket_fd, int memfd) {
+    off_t size = lseek(memfd, 0, SEEK_END);
+    if (size < 0) throw FileError(std::format("Error: Couldn't size the memfd: {}", std::strerror(errno)));
+
+    unsigned char size_bytes[8];
+    store_u64(size_bytes, static_cast<uint64_t>(size));
+    iovec payload{ size_bytes, sizeof(size_bytes) };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msghdr message{};
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr* rights = CMSG_FIRSTHDR(&message);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(rights), &memfd, sizeof(int));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != static_cast<ssize_t>(sizeof(size_bytes))) {
+        throw FileError(std::format("Error: Couldn't pass the memfd over the socket: {}", std::strerror(errno)));
+    }
+}
+
+void send_memfd(const std::string& socket_path, int memfd) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) throw FileError("Error: The socket path `" + socket_path + "` is too long");
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    FdCloser closer{ socket_fd };
+    if (socket_fd < 0 || connect(socket_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        throw FileError(std::format("Error: Couldn't connect to `{}`: {}", socket_path, std::strerror(errno)));
+    }
+
+    send_memfd(socket_fd, memfd);
+}
+
+int receive_memfd(int socket_fd, uint64_t& size) {
+    unsigned char size_bytes[8];
+    iovec payload{ size_bytes, sizeof(size_bytes) };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msghdr message{};
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (received < 0 && errno == EINTR);
+
+    cmsghdr* rights = CMSG_FIRSTHDR(&message);
+    if (received != static_cast<ssize_t>(sizeof(size_bytes)) || !rights ||
+        rights->cmsg_level != SOL_SOCKET || rights->cmsg_type != SCM_RIGHTS || rights->cmsg_len != CMSG_LEN(sizeof(int))) {
+        throw FileError("Error: Didn't receive a memfd over the socket");
+    }
+
+    int memfd;
+    std::memcpy(&memfd, CMSG_DATA(rights), sizeof(int));
+    FdCloser closer{ memfd };
+
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if (seals < 0 || (seals & REQUIRED_SEALS) != REQUIRED_SEALS) {
+        throw FileError("Error: The received file isn't sealed against writes");
+    }
+
+    // The sender's word isn't enough: mapping past the end of the file would fault the consumer
+    struct stat status;
+    if (fstat(memfd, &status) != 0) throw FileError(std::format("Error: Couldn't size the received memfd: {}", std::strerror(errno)));
+    if (load_u64(size_bytes) != static_cast<uint64_t>(status.st_size)) {
+        throw FileError(std::format("Error: The received memfd holds {} bytes, not the {} announced", status.st_size, load_u64(size_bytes)));
+    }
+
+    size = static_cast<uint64_t>(status.st_size);
+    closer.fd = -1;
+    return memfd;
+}
+#else
+int decrypt_to_memfd(const std::string&, const unsigned char*, const IoOptions&) {
+    throw UtilException("Decrypting to a memfd is only supported on Linux");
+}
+
+void decrypt_to_socket(const std::string&, const std::string&, const unsigned char*, const IoOptions&) {
+    throw UtilException("Decrypting to a memfd is only supported on Linux");
+}
+
+void send_memfd(int, int) {
+    throw UtilException("Passing a memfd is only supported on Linux");
+}
+
+void send_memfd(const std::string&, int) {
+    throw UtilException("Passing a memfd is only supported on Linux");
+}
+
+int receive_memfd(int, uint64_t&) {
+    throw UtilException("Receiving a memfd is only supported on Linux");
+}
+#endif
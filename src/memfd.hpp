@@ -0,0 +1,52 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <cstdint>
+
+#include "utilities/file_io.h"
+
+/*
+ * @brief Decrypts `input_path` (any format but a pack) into an anonymous memory file instead of
+ * a named one, then seals it against writes and size changes. Returns the file descriptor, which
+ * the caller closes. Prints nothing, so the caller can report the handoff. Linux only
+ */
+int decrypt_to_memfd(const std::string& input_path, const unsigned char* key, const IoOptions& io_options = {});
+
+/*
+ * @brief Decrypts into a sealed memfd and passes it to the process listening on the UNIX socket
+ * at `socket_path`, so the plaintext never touches a disk
+ */
+void decrypt_to_socket(const std::string& input_path, const std::string& socket_path, const unsigned char* key, const IoOptions& io_options = {});
+
+/*
+ * @brief Passes `memfd` and its size over the connected UNIX socket `socket_fd` with SCM_RIGHTS
+ */
+void send_memfd(int socket_fd, int memfd);
+
+/*
+ * @brief Connects to the UNIX socket listening at `socket_path` and passes `memfd` over it
+ */
+void send_memfd(const std::string& socket_path, int memfd);
+
+/*
+ * @brief Receives a descriptor sent by `send_memfd()` and sets `size`. Throws unless it is sealed
+ * against writes and shrinking, so the consumer can mmap it without the data changing underneath,
+ * and unless the size the sender announced is the memfd's actual size
+ */
+int receive_memfd(int socket_fd, uint64_t& size);
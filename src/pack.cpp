@@ -0,0 +1,273 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <set>
+#include <cstring>
+
+#include "src/pack.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#include <sodium/crypto_aead_xchacha20poly1305.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+namespace {
+    // Pack layout:
+    //   header  = magic (4) | pack id (16)
+    //   entry i = nonce (24) | ciphertext | tag (16), bound to the pack id and i
+    //   index   = nonce (24) | sealed(entry count (u64) | (offset (u64) | size (u64) | name length (u16) | name) * count) | tag (16)
+    //   trailer = sealed index size (u64)
+    constexpr size_t PACK_ID_SIZE{ 16 };
+    constexpr size_t HEADER_SIZE{ MAGIC_SIZE + PACK_ID_SIZE };
+    constexpr size_t NONCE_SIZE{ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t TAG_SIZE{ crypto_aead_xchacha20poly1305_ietf_ABYTES };
+    constexpr size_t TRAILER_SIZE{ 8 };
+    constexpr size_t ENTRY_AD_SIZE{ PACK_ID_SIZE + 8 };
+    constexpr size_t INDEX_ENTRY_FIXED_SIZE{ 8 + 8 + 2 };
+    // Every entry is sealed in one shot, so a pack is meant for small files only
+    constexpr uint64_t MAX_ENTRY_SIZE{ 16 * 1024 * 1024 };
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint64_t size;
+        std::string name;
+    };
+
+    void build_entry_ad(unsigned char* ad, const unsigned char* header, uint64_t index) {
+        std::memcpy(ad, header + MAGIC_SIZE, PACK_ID_SIZE);
+        store_u64(ad + PACK_ID_SIZE, index);
+    }
+
+    // Names are stored relative, and a name that could escape the output directory is refused
+    bool is_safe_name(const std::filesystem::path& name) {
+        if (name.empty() || name.is_absolute() || name.has_root_name()) return false;
+        for (const auto& part : name) {
+            if (part == "..") return false;
+        }
+        return true;
+    }
+
+    std::vector<IndexEntry> parse_index(const std::vector<unsigned char>& index, uint64_t entries_end) {
+        if (index.size() < 8) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+        uint64_t count = load_u64(index.data());
+        std::vector<IndexEntry> entries;
+        size_t position = 8;
+        uint64_t expected_offset = HEADER_SIZE;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            if (index.size() - position < INDEX_ENTRY_FIXED_SIZE) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+            IndexEntry entry;
+            entry.offset = load_u64(index.data() + position);
+            entry.size = load_u64(index.data() + position + 8);
+            size_t name_length = index[position + 16] | (index[position + 17] << 8);
+            position += INDEX_ENTRY_FIXED_SIZE;
+
+            if (index.size() - position < name_length) throw UtilException("Decryption failed. The input file maybe corrupt");
+            entry.name.assign(reinterpret_cast<const char*>(index.data() + position), name_length);
+            position += name_length;
+
+            // Entries are contiguous and in index order
+            if (entry.offset != expected_offset || entry.size > MAX_ENTRY_SIZE) {
+                throw UtilException("Decryption failed. The input file maybe corrupt");
+            }
+            expected_offset += NONCE_SIZE + entry.size + TAG_SIZE;
+            entries.push_back(std::move(entry));
+        }
+
+        if (position != index.size() || expected_offset != entries_end) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+        return entries;
+    }
+}
+
+void pack_files(const std::vector<std::string>& input_paths, const std::string& pack_path, const unsigned char* key) {
+    std::set<std::string> names;
+    for (const auto& input_path : input_paths) {
+        std::filesystem::path name = std::filesystem::path(input_path).lexically_normal();
+        if (!is_safe_name(name)) {
+            throw FileError("Error: `" + input_path + "` must be a relative path inside the current directory to be packed");
+        }
+        if (name.generic_string().size() > UINT16_MAX) {
+            throw FileError("Error: The path `" + input_path + "` is too long to be packed");
+        }
+        if (!names.insert(name.generic_string()).second) {
+            throw FileError("Error: `" + input_path + "` is listed more than once");
+        }
+    }
+
+    // Check the validity of the output file
+    std::ofstream pack_file(pack_path, std::ios::binary);
+    if (!pack_file.is_open()) {
+        throw FileError("Error: Couldn't open output file `" + pack_path + '`');
+    }
+
+    unsigned char subkey[32];
+    derive_subkey(subkey, 1, "CUPACK_1", key);
+
+    unsigned char header[HEADER_SIZE];
+    std::memcpy(header, PACK_MAGIC, MAGIC_SIZE);
+    randombytes_buf(header + MAGIC_SIZE, PACK_ID_SIZE);
+    pack_file.write(reinterpret_cast<const char*>(header), HEADER_SIZE);
+
+    std::vector<unsigned char> index(8);
+    std::vector<unsigned char> plaintext;
+    std::vector<unsigned char> sealed;
+    unsigned char ad[ENTRY_AD_SIZE];
+    uint64_t offset = HEADER_SIZE;
+
+    for (uint64_t i = 0; i < input_paths.size(); ++i) {
+        const std::string& input_path = input_paths[i];
+
+        std::ifstream input_file(input_path, std::ios::binary);
+        if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+        uint64_t size = std::filesystem::file_size(input_path);
+        if (size > MAX_ENTRY_SIZE) {
+            throw FileError(std::format("Error: `{}` is larger than {} bytes, encrypt it on its own with --encrypt", input_path, MAX_ENTRY_SIZE));
+        }
+
+        plaintext.resize(size);
+        input_file.read(reinterpret_cast<char*>(plaintext.data()), size);
+        if (static_cast<uint64_t>(input_file.gcount()) != size) throw FileError("Error: Couldn't read input file `" + input_path + '`');
+
+        sealed.resize(NONCE_SIZE + size + TAG_SIZE);
+        randombytes_buf(sealed.data(), NONCE_SIZE);
+        build_entry_ad(ad, header, i);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(
+            sealed.data() + NONCE_SIZE, NULL,
+            plaintext.data(), size,
+            ad, sizeof(ad),
+            NULL, sealed.data(), subkey);
+        pack_file.write(reinterpret_cast<const char*>(sealed.data()), sealed.size());
+
+        std::string name = std::filesystem::path(input_path).lexically_normal().generic_string();
+        unsigned char entry[INDEX_ENTRY_FIXED_SIZE];
+        store_u64(entry, offset);
+        store_u64(entry + 8, size);
+        entry[16] = static_cast<unsigned char>(name.size());
+        entry[17] = static_cast<unsigned char>(name.size() >> 8);
+        index.insert(index.end(), entry, entry + INDEX_ENTRY_FIXED_SIZE);
+        index.insert(index.end(), name.begin(), name.end());
+
+        offset += sealed.size();
+    }
+    sodium_memzero(plaintext.data(), plaintext.size());
+    store_u64(index.data(), input_paths.size());
+
+    std::vector<unsigned char> sealed_index(NONCE_SIZE + index.size() + TAG_SIZE + TRAILER_SIZE);
+    randombytes_buf(sealed_index.data(), NONCE_SIZE);
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        sealed_index.data() + NONCE_SIZE, NULL,
+        index.data(), index.size(),
+        header, HEADER_SIZE,
+        NULL, sealed_index.data(), subkey);
+    store_u64(sealed_index.data() + sealed_index.size() - TRAILER_SIZE, sealed_index.size() - TRAILER_SIZE);
+    pack_file.write(reinterpret_cast<const char*>(sealed_index.data()), sealed_index.size());
+    sodium_memzero(subkey, sizeof(subkey));
+
+    pack_file.close();
+    if (pack_file.fail()) throw FileError("Error: Couldn't write output file `" + pack_path + '`');
+
+    std::cout << std::format("Successfully packed {} files into `{}`", input_paths.size(), pack_path) << std::endl;
+}
+
+void unpack_files(const std::string& pack_path, const std::string& output_dir, const unsigned char* key) {
+    // Read from the input pack file
+    std::ifstream pack_file(pack_path, std::ios::binary);
+    if (!pack_file.is_open()) throw FileError("Error: Couldn't open input file `" + pack_path + '`');
+
+    uint64_t file_size = std::filesystem::file_size(pack_path);
+    if (file_size < HEADER_SIZE + NONCE_SIZE + 8 + TAG_SIZE + TRAILER_SIZE) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+    unsigned char header[HEADER_SIZE];
+    pack_file.read(reinterpret_cast<char*>(header), HEADER_SIZE);
+    if (!has_magic(header, PACK_MAGIC)) throw UtilException("`" + pack_path + "` isn't a pack");
+
+    unsigned char trailer[TRAILER_SIZE];
+    pack_file.seekg(file_size - TRAILER_SIZE);
+    pack_file.read(reinterpret_cast<char*>(trailer), TRAILER_SIZE);
+    uint64_t sealed_size = load_u64(trailer);
+    if (sealed_size < NONCE_SIZE + 8 + TAG_SIZE || sealed_size > file_size - HEADER_SIZE - TRAILER_SIZE) {
+        throw UtilException("Decryption failed. The input file maybe corrupt");
+    }
+
+    uint64_t index_offset = file_size - TRAILER_SIZE - sealed_size;
+    std::vector<unsigned char> sealed(sealed_size);
+    pack_file.seekg(index_offset);
+    pack_file.read(reinterpret_cast<char*>(sealed.data()), sealed_size);
+
+    unsigned char subkey[32];
+    derive_subkey(subkey, 1, "CUPACK_1", key);
+
+    std::vector<unsigned char> index(sealed_size - NONCE_SIZE - TAG_SIZE);
+    if (!pack_file || crypto_aead_xchacha20poly1305_ietf_decrypt(
+        index.data(), NULL, NULL,
+        sealed.data() + NONCE_SIZE, sealed_size - NONCE_SIZE,
+        header, HEADER_SIZE,
+        sealed.data(), subkey) != 0) {
+        sodium_memzero(subkey, sizeof(subkey));
+        throw AuthError("Decryption failed. The input file maybe corrupt");
+    }
+
+    std::vector<IndexEntry> entries = parse_index(index, index_offset);
+
+    std::vector<unsigned char> plaintext;
+    unsigned char ad[ENTRY_AD_SIZE];
+    pack_file.seekg(HEADER_SIZE);
+
+    // Entries are contiguous, so the whole pack is read front to back in one pass
+    for (uint64_t i = 0; i < entries.size(); ++i) {
+        const IndexEntry& entry = entries[i];
+        if (!is_safe_name(entry.name)) throw UtilException("Pack entry `" + entry.name + "` would be written outside the output directory");
+
+        sealed.resize(NONCE_SIZE + entry.size + TAG_SIZE);
+        plaintext.resize(entry.size);
+        pack_file.read(reinterpret_cast<char*>(sealed.data()), sealed.size());
+
+        build_entry_ad(ad, header, i);
+        if (!pack_file || crypto_aead_xchacha20poly1305_ietf_decrypt(
+            plaintext.data(), NULL, NULL,
+            sealed.data() + NONCE_SIZE, entry.size + TAG_SIZE,
+            ad, sizeof(ad),
+            sealed.data(), subkey) != 0) {
+            sodium_memzero(subkey, sizeof(subkey));
+            throw AuthError("Decryption failed. The input file maybe corrupt");
+        }
+
+        std::filesystem::path output_path = std::filesystem::path(output_dir) / entry.name;
+        std::filesystem::create_directories(output_path.parent_path());
+
+        std::ofstream output_file(output_path, std::ios::binary);
+        if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path.string() + '`');
+        output_file.write(reinterpret_cast<const char*>(plaintext.data()), entry.size);
+        if (!output_file) throw FileError("Error: Couldn't write output file `" + output_path.string() + '`');
+    }
+    sodium_memzero(subkey, sizeof(subkey));
+    sodium_memzero(plaintext.data(), plaintext.size());
+
+    std::cout << std::format("Successfully unpacked {} files from `{}` to `{}`", entries.size(), pack_path, output_dir) << std::endl;
+}
@@ -0,0 +1,30 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+ * @brief Seals many small files into a single pack with an encrypted index
+ */
+void pack_files(const std::vector<std::string>& input_paths, const std::string& pack_path, const unsigned char* key);
+
+/*
+ * @brief Extracts every file of a pack written by `pack_files()` into `output_dir`
+ */
+void unpack_files(const std::string& pack_path, const std::string& output_dir, const unsigned char* key);
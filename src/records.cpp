@@ -0,0 +1,617 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <charconv>
+
+#include "src/records.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#include <sodium/crypto_aead_xchacha20poly1305.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+namespace {
+    // Record log layout:
+    //   header  = magic (4) | log id (16)
+    //   batch i = nonce (24) | ciphertext of whole records | tag (16), bound to the log id and i
+    //   index   = nonce (24) | sealed(batch count (u64) | time field length (u16) | time field | (offset (u64) | size (u64) | records (u64) | min time (i64) | max time (i64)) * count) | tag (16)
+    //   trailer = sealed index size (u64)
+    // A batch only ever ends after a newline, so every batch can be opened and split into records on its own
+    constexpr size_t LOG_ID_SIZE{ 16 };
+    constexpr size_t HEADER_SIZE{ MAGIC_SIZE + LOG_ID_SIZE };
+    constexpr size_t NONCE_SIZE{ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t TAG_SIZE{ crypto_aead_xchacha20poly1305_ietf_ABYTES };
+    constexpr size_t TRAILER_SIZE{ 8 };
+    constexpr size_t BATCH_AD_SIZE{ LOG_ID_SIZE + 8 };
+    constexpr size_t INDEX_FIXED_SIZE{ 8 + 2 };
+    constexpr size_t INDEX_ENTRY_SIZE{ 5 * 8 };
+    // Batches are cut at the first record boundary past this size
+    constexpr size_t BATCH_SIZE{ 64 * 1024 };
+    // A single record may make its batch larger, up to this
+    constexpr size_t MAX_BATCH_SIZE{ 64 * 1024 * 1024 };
+    constexpr size_t READ_BLOCK_SIZE{ 1024 * 1024 };
+
+    // Batches without a stamped record get an empty time range, which no query overlaps
+    constexpr int64_t NO_MIN_TIME{ std::numeric_limits<int64_t>::max() };
+    constexpr int64_t NO_MAX_TIME{ std::numeric_limits<int64_t>::min() };
+
+    struct BatchEntry {
+        uint64_t offset{ 0 };
+        uint64_t size{ 0 };
+        uint64_t records{ 0 };
+        int64_t min_time{ NO_MIN_TIME };
+        int64_t max_time{ NO_MAX_TIME };
+    };
+
+    struct RecordLog {
+        unsigned char header[HEADER_SIZE];
+        std::string time_field;
+        std::vector<BatchEntry> batches;
+    };
+
+    struct Subkey {
+        unsigned char bytes[32];
+
+        explicit Subkey(const unsigned char* key) { derive_subkey(bytes, 1, "CULOG__1", key); }
+        ~Subkey() { sodium_memzero(bytes, sizeof(bytes)); }
+    };
+
+    void build_batch_ad(unsigned char* ad, const unsigned char* header, uint64_t index) {
+        std::memcpy(ad, header + MAGIC_SIZE, LOG_ID_SIZE);
+        store_u64(ad + LOG_ID_SIZE, index);
+    }
+
+    // Calls `visit` with every record in `data`, without its newline. The last record needn't end in one
+    template <typename Visit>
+    void for_each_record(std::string_view data, Visit&& visit) {
+        size_t start = 0;
+        while (start < data.size()) {
+            size_t end = data.find('\n', start);
+            if (end == std::string_view::npos) end = data.size();
+            visit(data.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    size_t skip_string(std::string_view text, size_t position) {
+        // `position` is just past the opening quote; returns the position just past the closing one
+        while (position < text.size()) {
+            if (text[position] == '\\') position += 2;
+            else if (text[position] == '"') return position + 1;
+            else ++position;
+        }
+        return text.size();
+    }
+
+    size_t skip_space(std::string_view text, size_t position) {
+        while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\r')) ++position;
+        return position;
+    }
+
+    /*
+     * Finds the value of top-level field `field` in a JSON object record without parsing the rest of it.
+     * Nested objects and string contents are skipped, so a matching name deeper down doesn't count
+     */
+    std::optional<int64_t> record_time(std::string_view record, const std::string& field) {
+        size_t position = skip_space(record, 0);
+        if (position >= record.size() || record[position] != '{') return std::nullopt;
+        ++position;
+
+        int depth = 1;
+        bool expecting_key = true;
+        while (position < record.size() && depth > 0) {
+            char c = record[position];
+            if (c == '"') {
+                size_t end = skip_string(record, position + 1);
+                bool is_field = depth == 1 && expecting_key && end - position - 2 == field.size() &&
+                    record.compare(position + 1, field.size(), field) == 0;
+                position = skip_space(record, end);
+
+                if (depth == 1 && expecting_key && position < record.size() && record[position] == ':') {
+                    expecting_key = false;
+                    ++position;
+                    if (!is_field) continue;
+
+                    position = skip_space(record, position);
+                    if (position < record.size() && record[position] == '"') {
+                        size_t value_end = skip_string(record, position + 1);
+                        return parse_record_time(record.substr(position + 1, value_end - position - 2));
+                    }
+                    size_t value_end = record.find_first_of(",} \t\r", position);
+                    return parse_record_time(record.substr(position, value_end == std::string_view::npos ? std::string_view::npos : value_end - position));
+                }
+                continue;
+            }
+
+            if (c == '{' || c == '[') ++depth;
+            else if (c == '}' || c == ']') --depth;
+            else if (c == ',' && depth == 1) expecting_key = true;
+            ++position;
+        }
+        return std::nullopt;
+    }
+
+    BatchEntry describe_batch(std::string_view batch, const std::string& time_field) {
+        BatchEntry entry;
+        entry.size = batch.size();
+        for_each_record(batch, [&](std::string_view record) {
+            ++entry.records;
+            std::optional<int64_t> time = record_time(record, time_field);
+            if (!time) return;
+            entry.min_time = std::min(entry.min_time, *time);
+            entry.max_time = std::max(entry.max_time, *time);
+        });
+        return entry;
+    }
+
+    bool in_range(std::optional<int64_t> time, const RecordQuery& query) {
+        if (!query.from && !query.to) return true;
+        if (!time) return false;
+        return (!query.from || *time >= *query.from) && (!query.to || *time <= *query.to);
+    }
+
+    bool batch_in_range(const BatchEntry& entry, const RecordQuery& query) {
+        if (!query.from && !query.to) return true;
+        if (entry.min_time > entry.max_time) return false;
+        return (!query.from || entry.max_time >= *query.from) && (!query.to || entry.min_time <= *query.to);
+    }
+
+    // Reads and authenticates the index. Batches are contiguous and in index order
+    RecordLog read_log(std::ifstream& file, uint64_t file_size, const Subkey& subkey) {
+        RecordLog log;
+        if (file_size < HEADER_SIZE + NONCE_SIZE + INDEX_FIXED_SIZE + TAG_SIZE + TRAILER_SIZE) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+        file.read(reinterpret_cast<char*>(log.header), HEADER_SIZE);
+        if (!file || !has_magic(log.header, RECORDS_MAGIC)) throw UtilException("The input file isn't a record log");
+
+        unsigned char trailer[TRAILER_SIZE];
+        file.seekg(file_size - TRAILER_SIZE);
+        file.read(reinterpret_cast<char*>(trailer), TRAILER_SIZE);
+        uint64_t sealed_size = load_u64(trailer);
+        if (sealed_size < NONCE_SIZE + INDEX_FIXED_SIZE + TAG_SIZE || sealed_size > file_size - HEADER_SIZE - TRAILER_SIZE) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+
+        uint64_t index_offset = file_size - TRAILER_SIZE - sealed_size;
+        std::vector<unsigned char> sealed(sealed_size);
+        file.seekg(index_offset);
+        file.read(reinterpret_cast<char*>(sealed.data()), sealed_size);
+
+        std::vector<unsigned char> index(sealed_size - NONCE_SIZE - TAG_SIZE);
+        if (!file || crypto_aead_xchacha20poly1305_ietf_decrypt(
+            index.data(), NULL, NULL,
+            sealed.data() + NONCE_SIZE, sealed_size - NONCE_SIZE,
+            log.header, HEADER_SIZE,
+            sealed.data(), subkey.bytes) != 0) {
+            throw AuthError("Couldn't open the index. The key is wrong or the file is corrupt");
+        }
+
+        uint64_t count = load_u64(index.data());
+        size_t field_length = index[8] | (index[9] << 8);
+        size_t entries_offset = INDEX_FIXED_SIZE + field_length;
+        if (index.size() < entries_offset || (index.size() - entries_offset) / INDEX_ENTRY_SIZE != count ||
+            (index.size() - entries_offset) % INDEX_ENTRY_SIZE != 0) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+        log.time_field.assign(reinterpret_cast<const char*>(index.data() + INDEX_FIXED_SIZE), field_length);
+
+        uint64_t expected_offset = HEADER_SIZE;
+        for (uint64_t i = 0; i < count; ++i) {
+            const unsigned char* in = index.data() + entries_offset + i * INDEX_ENTRY_SIZE;
+            BatchEntry entry;
+            entry.offset = load_u64(in);
+            entry.size = load_u64(in + 8);
+            entry.records = load_u64(in + 16);
+            entry.min_time = static_cast<int64_t>(load_u64(in + 24));
+            entry.max_time = static_cast<int64_t>(load_u64(in + 32));
+
+            if (entry.offset != expected_offset || entry.size == 0 || entry.size > MAX_BATCH_SIZE) {
+                throw UtilException("Decryption failed. The input file maybe corrupt");
+            }
+            expected_offset += NONCE_SIZE + entry.size + TAG_SIZE;
+            log.batches.push_back(entry);
+        }
+
+        if (expected_offset != index_offset) throw UtilException("Decryption failed. The input file maybe corrupt");
+        return log;
+    }
+
+    struct OpenedBatch {
+        std::vector<unsigned char> plaintext;
+        // Offsets and lengths of the matching records, when scanning
+        std::vector<std::pair<size_t, size_t>> records;
+        bool ready{ false };
+    };
+
+    /*
+     * Opens the batches in `selected` on `threads` workers, each with its own file handle, and hands
+     * them to `consume` in order on the calling thread. Workers stay at most a window ahead of it,
+     * which bounds memory to a few batches per thread
+     */
+    void open_batches(const std::string& input_path, const RecordLog& log, const Subkey& subkey, const std::vector<uint64_t>& selected,
+        unsigned threads, const RecordQuery* query, const std::function<void(OpenedBatch&)>& consume) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(selected.size(), 1)));
+        const size_t window = 4 * static_cast<size_t>(threads);
+
+        std::vector<OpenedBatch> slots(window);
+        std::mutex mutex;
+        std::condition_variable changed;
+        size_t next_claim = 0;
+        size_t next_consume = 0;
+        std::exception_ptr failure;
+
+        auto work = [&] {
+            std::ifstream file(input_path, std::ios::binary);
+            std::vector<unsigned char> sealed;
+            unsigned char ad[BATCH_AD_SIZE];
+
+            while (true) {
+                size_t position;
+                {
+                    std::unique_lock lock(mutex);
+                    changed.wait(lock, [&] { return failure || next_claim >= selected.size() || next_claim < next_consume + window; });
+                    if (failure || next_claim >= selected.size()) return;
+                    position = next_claim++;
+                }
+
+                try {
+                    uint64_t batch_index = selected[position];
+                    const BatchEntry& entry = log.batches[batch_index];
+                    OpenedBatch opened;
+                    opened.plaintext.resize(entry.size);
+                    sealed.resize(NONCE_SIZE + entry.size + TAG_SIZE);
+
+                    if (!file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+                    file.seekg(static_cast<std::streamoff>(entry.offset));
+                    file.read(reinterpret_cast<char*>(sealed.data()), static_cast<std::streamsize>(sealed.size()));
+
+                    build_batch_ad(ad, log.header, batch_index);
+                    if (!file || crypto_aead_xchacha20poly1305_ietf_decrypt(
+                        opened.plaintext.data(), NULL, NULL,
+                        sealed.data() + NONCE_SIZE, entry.size + TAG_SIZE,
+                        ad, sizeof(ad),
+                        sealed.data(), subkey.bytes) != 0) {
+                        throw AuthError("Decryption failed. The input file maybe corrupt");
+                    }
+
+                    if (query) {
+                        std::string_view data(reinterpret_cast<const char*>(opened.plaintext.data()), opened.plaintext.size());
+                        for_each_record(data, [&](std::string_view record) {
+                            bool has_range = query->from || query->to;
+                            if (has_range && !in_range(record_time(record, log.time_field), *query)) return;
+                            if (query->filter && !query->filter(record)) return;
+                            opened.records.emplace_back(record.data() - data.data(), record.size());
+                        });
+                    }
+
+                    std::lock_guard lock(mutex);
+                    opened.ready = true;
+                    slots[position % window] = std::move(opened);
+                }
+                catch (...) {
+                    std::lock_guard lock(mutex);
+                    if (!failure) failure = std::current_exception();
+                }
+                changed.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back(work);
+
+        try {
+            for (; next_consume < selected.size();) {
+                OpenedBatch batch;
+                {
+                    std::unique_lock lock(mutex);
+                    changed.wait(lock, [&] { return failure || slots[next_consume % window].ready; });
+                    if (failure) break;
+                    batch = std::move(slots[next_consume % window]);
+                    slots[next_consume % window].ready = false;
+                }
+
+                consume(batch);
+                sodium_memzero(batch.plaintext.data(), batch.plaintext.size());
+
+                {
+                    std::lock_guard lock(mutex);
+                    ++next_consume;
+                }
+                changed.notify_all();
+            }
+        }
+        catch (...) {
+            std::lock_guard lock(mutex);
+            if (!failure) failure = std::current_exception();
+        }
+
+        changed.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        for (OpenedBatch& slot : slots) sodium_memzero(slot.plaintext.data(), slot.plaintext.size());
+        if (failure) std::rethrow_exception(failure);
+    }
+}
+
+void encrypt_record_log(const std::string& input_path, const std::string& output_path, const unsigned char* key, const std::string& time_field) {
+    if (time_field.size() > UINT16_MAX) throw UtilException("The time field name is too long");
+
+    // Read from the input plaintext file
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+    // Check the validity of the output file
+    std::ofstream output_file(output_path, std::ios::binary);
+    if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+    Subkey subkey(key);
+    RecordLog log;
+    std::memcpy(log.header, RECORDS_MAGIC, MAGIC_SIZE);
+    randombytes_buf(log.header + MAGIC_SIZE, LOG_ID_SIZE);
+    output_file.write(reinterpret_cast<const char*>(log.header), HEADER_SIZE);
+
+    std::vector<unsigned char> sealed;
+    unsigned char ad[BATCH_AD_SIZE];
+    uint64_t offset = HEADER_SIZE;
+    uint64_t records = 0;
+
+    auto seal_batch = [&](const unsigned char* data, size_t size) {
+        if (size > MAX_BATCH_SIZE) {
+            throw UtilException(std::format("`{}` has a record longer than {} bytes", input_path, MAX_BATCH_SIZE));
+        }
+
+        BatchEntry entry = describe_batch({ reinterpret_cast<const char*>(data), size }, time_field);
+        entry.offset = offset;
+
+        uint64_t index = log.batches.size();
+        sealed.resize(NONCE_SIZE + size + TAG_SIZE);
+        randombytes_buf(sealed.data(), NONCE_SIZE);
+        build_batch_ad(ad, log.header, index);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(
+            sealed.data() + NONCE_SIZE, NULL,
+            data, size,
+            ad, sizeof(ad),
+            NULL, sealed.data(), subkey.bytes);
+        output_file.write(reinterpret_cast<const char*>(sealed.data()), sealed.size());
+
+        offset += sealed.size();
+        records += entry.records;
+        log.batches.push_back(entry);
+    };
+
+    // Cut a batch at the last newline before BATCH_SIZE, or the first one after it for a long record
+    std::vector<unsigned char> pending;
+    size_t start = 0;
+    bool at_end = false;
+    while (true) {
+        size_t available = pending.size() - start;
+        std::string_view view(reinterpret_cast<const char*>(pending.data() + start), available);
+
+        size_t cut = 0;
+        if (available >= BATCH_SIZE) {
+            size_t newline = view.rfind('\n', BATCH_SIZE - 1);
+            if (newline == std::string_view::npos) newline = view.find('\n', BATCH_SIZE);
+            if (newline != std::string_view::npos) cut = newline + 1;
+        }
+        if (cut == 0 && at_end) cut = available;
+
+        if (cut > 0) {
+            seal_batch(pending.data() + start, cut);
+            start += cut;
+            continue;
+        }
+        if (at_end) break;
+        if (available > MAX_BATCH_SIZE) {
+            throw UtilException(std::format("`{}` has a record longer than {} bytes", input_path, MAX_BATCH_SIZE));
+        }
+
+        // Keep the unfinished record and read the next block after it
+        pending.erase(pending.begin(), pending.begin() + start);
+        start = 0;
+        size_t kept = pending.size();
+        pending.resize(kept + READ_BLOCK_SIZE);
+        input_file.read(reinterpret_cast<char*>(pending.data() + kept), READ_BLOCK_SIZE);
+        pending.resize(kept + static_cast<size_t>(input_file.gcount()));
+
+        if (input_file.bad()) throw FileError("Error: Couldn't read input file `" + input_path + '`');
+        if (input_file.eof()) at_end = true;
+    }
+    sodium_memzero(pending.data(), pending.size());
+
+    std::vector<unsigned char> index(INDEX_FIXED_SIZE + time_field.size() + log.batches.size() * INDEX_ENTRY_SIZE);
+    store_u64(index.data(), log.batches.size());
+    index[8] = static_cast<unsigned char>(time_field.size());
+    index[9] = static_cast<unsigned char>(time_field.size() >> 8);
+    std::memcpy(index.data() + INDEX_FIXED_SIZE, time_field.data(), time_field.size());
+    for (size_t i = 0; i < log.batches.size(); ++i) {
+        const BatchEntry& entry = log.batches[i];
+        unsigned char* out = index.data() + INDEX_FIXED_SIZE + time_field.size() + i * INDEX_ENTRY_SIZE;
+        store_u64(out, entry.offset);
+        store_u64(out + 8, entry.size);
+        store_u64(out + 16, entry.records);
+        store_u64(out + 24, static_cast<uint64_t>(entry.min_time));
+        store_u64(out + 32, static_cast<uint64_t>(entry.max_time));
+    }
+
+    std::vector<unsigned char> sealed_index(NONCE_SIZE + index.size() + TAG_SIZE + TRAILER_SIZE);
+    randombytes_buf(sealed_index.data(), NONCE_SIZE);
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        sealed_index.data() + NONCE_SIZE, NULL,
+        index.data(), index.size(),
+        log.header, HEADER_SIZE,
+        NULL, sealed_index.data(), subkey.bytes);
+    store_u64(sealed_index.data() + sealed_index.size() - TRAILER_SIZE, sealed_index.size() - TRAILER_SIZE);
+    output_file.write(reinterpret_cast<const char*>(sealed_index.data()), sealed_index.size());
+
+    input_file.close();
+    output_file.close();
+    if (output_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+
+    std::cout << std::format("Successfully encrypted `{}` to `{}` ({} records in {} batches)",
+        input_path, output_path, records, log.batches.size()) << std::endl;
+}
+
+void decrypt_record_log(const std::string& input_path, const std::string& output_path, const unsigned char* key, unsigned threads, bool report) {
+    // Read from the input encrypted file
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+    Subkey subkey(key);
+    RecordLog log = read_log(input_file, std::filesystem::file_size(input_path), subkey);
+    input_file.close();
+
+    // Check the validity of the output file
+    std::ofstream output_file(output_path, std::ios::binary);
+    if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+    std::vector<uint64_t> selected(log.batches.size());
+    for (uint64_t i = 0; i < selected.size(); ++i) selected[i] = i;
+
+    open_batches(input_path, log, subkey, selected, threads, nullptr, [&](OpenedBatch& batch) {
+        output_file.write(reinterpret_cast<const char*>(batch.plaintext.data()), static_cast<std::streamsize>(batch.plaintext.size()));
+    });
+
+    output_file.close();
+    if (output_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+
+    if (report) std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
+}
+
+RecordScanStats scan_record_log(const std::string& input_path, const unsigned char* key, const RecordQuery& query,
+    const std::function<void(std::string_view)>& emit) {
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+    Subkey subkey(key);
+    RecordLog log = read_log(input_file, std::filesystem::file_size(input_path), subkey);
+    input_file.close();
+
+    // The index alone rules out the batches whose time range misses the query
+    std::vector<uint64_t> selected;
+    for (uint64_t i = 0; i < log.batches.size(); ++i) {
+        if (batch_in_range(log.batches[i], query)) selected.push_back(i);
+    }
+
+    RecordScanStats stats;
+    stats.batches = log.batches.size();
+    stats.batches_read = selected.size();
+
+    open_batches(input_path, log, subkey, selected, query.threads, &query, [&](OpenedBatch& batch) {
+        for (const auto& [record_offset, length] : batch.records) {
+            emit({ reinterpret_cast<const char*>(batch.plaintext.data()) + record_offset, length });
+            ++stats.records_matched;
+        }
+    });
+
+    return stats;
+}
+
+RecordScanStats extract_records(const std::string& input_path, const std::string& output_path, const unsigned char* key, const RecordQuery& query) {
+    // Check the validity of the output file
+    std::ofstream output_file(output_path, std::ios::binary);
+    if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+    RecordScanStats stats = scan_record_log(input_path, key, query, [&](std::string_view record) {
+        output_file.write(record.data(), static_cast<std::streamsize>(record.size()));
+        output_file.put('\n');
+    });
+
+    output_file.close();
+    if (output_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+
+    std::cout << std::format("Successfully extracted {} records from `{}` to `{}` ({} of {} batches read)",
+        stats.records_matched, input_path, output_path, stats.batches_read, stats.batches) << std::endl;
+    return stats;
+}
+
+std::optional<int64_t> parse_record_time(std::string_view text) {
+    if (text.empty()) return std::nullopt;
+
+    // A number, e.g. Unix seconds or milliseconds
+    int64_t value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error == std::errc() && end != text.data()) {
+        std::string_view rest(end, text.data() + text.size() - end);
+        if (rest.empty()) return value;
+        if (rest[0] == '.' && rest.size() > 1 && std::all_of(rest.begin() + 1, rest.end(), [](char c) { return c >= '0' && c <= '9'; })) return value;
+    }
+
+    // RFC 3339: YYYY-MM-DDTHH:MM:SS[.fraction](Z|+HH:MM|-HH:MM)
+    auto digits = [&](size_t at, size_t count, int& out) {
+        if (at + count > text.size()) return false;
+        out = 0;
+        for (size_t i = at; i < at + count; ++i) {
+            if (text[i] < '0' || text[i] > '9') return false;
+            out = out * 10 + (text[i] - '0');
+        }
+        return true;
+    };
+
+    int year, month, day, hour, minute, second;
+    if (!digits(0, 4, year) || text.size() < 19 || text[4] != '-' || !digits(5, 2, month) || text[7] != '-' || !digits(8, 2, day) ||
+        (text[10] != 'T' && text[10] != 't' && text[10] != ' ') ||
+        !digits(11, 2, hour) || text[13] != ':' || !digits(14, 2, minute) || text[16] != ':' || !digits(17, 2, second)) {
+        return std::nullopt;
+    }
+
+    std::chrono::year_month_day date{ std::chrono::year(year), std::chrono::month(month), std::chrono::day(day) };
+    if (!date.ok() || hour > 23 || minute > 59 || second > 60) return std::nullopt;
+
+    size_t position = 19;
+    int64_t milliseconds = 0;
+    if (position < text.size() && text[position] == '.') {
+        size_t fraction_start = ++position;
+        for (int scale = 100; position < text.size() && text[position] >= '0' && text[position] <= '9'; ++position, scale /= 10) {
+            milliseconds += (text[position] - '0') * scale;
+        }
+        if (position == fraction_start) return std::nullopt;
+    }
+
+    int64_t offset_minutes = 0;
+    if (position < text.size() && (text[position] == 'Z' || text[position] == 'z')) {
+        ++position;
+    }
+    else if (position < text.size() && (text[position] == '+' || text[position] == '-')) {
+        int offset_hours, offset_rest;
+        if (position + 6 > text.size() || !digits(position + 1, 2, offset_hours) || text[position + 3] != ':' || !digits(position + 4, 2, offset_rest)) {
+            return std::nullopt;
+        }
+        offset_minutes = (offset_hours * 60 + offset_rest) * (text[position] == '-' ? -1 : 1);
+        position += 6;
+    }
+    else {
+        return std::nullopt;
+    }
+    if (position != text.size()) return std::nullopt;
+
+    int64_t days = std::chrono::sys_days(date).time_since_epoch().count();
+    return ((days * 86400 + hour * 3600 + minute * 60 + second) - offset_minutes * 60) * 1000 + milliseconds;
+}
\ No newline at end of file
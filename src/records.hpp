@@ -0,0 +1,71 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <string_view>
+#include <functional>
+#include <optional>
+#include <cstdint>
+
+/*
+ * @brief Encrypts newline-delimited records (e.g. NDJSON logs) into a record log: whole records are
+ * sealed in independent batches, and an encrypted index keeps each batch's record count and time
+ * range. `time_field` names the top-level JSON field holding a record's timestamp
+ */
+void encrypt_record_log(const std::string& input_path, const std::string& output_path, const unsigned char* key, const std::string& time_field = "ts");
+
+/*
+ * @brief Decrypts a whole record log written by `encrypt_record_log()`, opening batches in parallel.
+ * Prints a line when done if `report` is set
+ */
+void decrypt_record_log(const std::string& input_path, const std::string& output_path, const unsigned char* key, unsigned threads = 0, bool report = true);
+
+struct RecordQuery {
+    // Only records stamped within [from, to]. Batches whose time range misses it are never read
+    std::optional<int64_t> from;
+    std::optional<int64_t> to;
+
+    // Only records this returns true for. Called from the worker threads
+    std::function<bool(std::string_view)> filter;
+
+    // Batches opened at once; 0 means one per core
+    unsigned threads{ 0 };
+};
+
+struct RecordScanStats {
+    uint64_t batches{ 0 };
+    uint64_t batches_read{ 0 };
+    uint64_t records_matched{ 0 };
+};
+
+/*
+ * @brief Opens the batches of a record log that can hold matching records in parallel, and hands
+ * every matching record, without its newline, to `emit` in file order
+ */
+RecordScanStats scan_record_log(const std::string& input_path, const unsigned char* key, const RecordQuery& query,
+    const std::function<void(std::string_view)>& emit);
+
+/*
+ * @brief Writes the records of a record log that match `query` to `output_path`, one per line
+ */
+RecordScanStats extract_records(const std::string& input_path, const std::string& output_path, const unsigned char* key, const RecordQuery& query);
+
+/*
+ * @brief Parses a timestamp the way record logs index them: an integer as written (a fraction is
+ * dropped), or an RFC 3339 time such as `2024-05-01T12:00:00.250Z` as Unix milliseconds
+ */
+std::optional<int64_t> parse_record_time(std::string_view text);
\ No newline at end of file
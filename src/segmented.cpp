@@ -0,0 +1,386 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+
+#include "src/segmented.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#include <sodium/crypto_aead_xchacha20poly1305.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+namespace {
+    // Manifest layout:
+    //   header   = magic (4) | file id (16)
+    //   manifest = nonce (24) | sealed(plaintext size (u64) | chunk size (u32) | chunks per segment (u32) | segment count (u64)) | tag (16)
+    // Segment layout, for segment s holding chunks from i = s * chunks per segment:
+    //   chunk i  = ciphertext | tag (16), with nonce = file id (16) | i (u64)
+    // The nonce binds every chunk to its file and position, so a chunk or segment that's moved,
+    // swapped or taken from another file fails to open; the sizes in the manifest catch truncation
+    constexpr size_t SEGMENT_CHUNK_SIZE{ 64 * 1024 };
+    constexpr size_t FILE_ID_SIZE{ 16 };
+    constexpr size_t HEADER_SIZE{ MAGIC_SIZE + FILE_ID_SIZE };
+    constexpr size_t NONCE_SIZE{ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t TAG_SIZE{ crypto_aead_xchacha20poly1305_ietf_ABYTES };
+    constexpr size_t SEALED_CHUNK_SIZE{ SEGMENT_CHUNK_SIZE + TAG_SIZE };
+    constexpr size_t MANIFEST_PLAINTEXT_SIZE{ 8 + 4 + 4 + 8 };
+    constexpr size_t MANIFEST_SIZE{ HEADER_SIZE + NONCE_SIZE + MANIFEST_PLAINTEXT_SIZE + TAG_SIZE };
+
+    struct Subkey {
+        unsigned char bytes[32];
+
+        explicit Subkey(const unsigned char* key) { derive_subkey(bytes, 1, "CUSEGMT1", key); }
+        ~Subkey() { sodium_memzero(bytes, sizeof(bytes)); }
+    };
+
+    struct Manifest {
+        unsigned char header[HEADER_SIZE];
+        uint64_t plaintext_size{ 0 };
+        uint32_t chunk_size{ SEGMENT_CHUNK_SIZE };
+        uint32_t chunks_per_segment{ 0 };
+        uint64_t segment_count{ 0 };
+
+        uint64_t chunk_count() const { return (plaintext_size + chunk_size - 1) / chunk_size; }
+
+        size_t chunk_length(uint64_t index) const {
+            return static_cast<size_t>(std::min<uint64_t>(chunk_size, plaintext_size - index * chunk_size));
+        }
+
+        uint64_t first_chunk(uint64_t segment) const { return segment * chunks_per_segment; }
+
+        uint64_t segment_chunks(uint64_t segment) const {
+            return std::min<uint64_t>(chunks_per_segment, chunk_count() - first_chunk(segment));
+        }
+
+        uint64_t segment_size(uint64_t segment) const {
+            uint64_t first = first_chunk(segment);
+            uint64_t chunks = segment_chunks(segment);
+            uint64_t plaintext = std::min<uint64_t>(plaintext_size - first * chunk_size, chunks * chunk_size);
+            return plaintext + chunks * TAG_SIZE;
+        }
+    };
+
+    void build_nonce(unsigned char* nonce, const Manifest& manifest, uint64_t index) {
+        std::memcpy(nonce, manifest.header + MAGIC_SIZE, FILE_ID_SIZE);
+        store_u64(nonce + FILE_ID_SIZE, index);
+    }
+
+    Manifest read_manifest(const std::string& manifest_path, const Subkey& subkey) {
+        std::ifstream file(manifest_path, std::ios::binary);
+        if (!file.is_open()) throw FileError("Error: Couldn't open input file `" + manifest_path + '`');
+
+        unsigned char sealed[MANIFEST_SIZE];
+        file.read(reinterpret_cast<char*>(sealed), MANIFEST_SIZE);
+        if (!file || file.peek() != std::ifstream::traits_type::eof() || !has_magic(sealed, SEGMENTED_MAGIC)) {
+            throw UtilException("Decryption failed. The segment manifest is corrupt");
+        }
+
+        Manifest manifest;
+        std::memcpy(manifest.header, sealed, HEADER_SIZE);
+
+        unsigned char plaintext[MANIFEST_PLAINTEXT_SIZE];
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            plaintext, NULL, NULL,
+            sealed + HEADER_SIZE + NONCE_SIZE, MANIFEST_PLAINTEXT_SIZE + TAG_SIZE,
+            manifest.header, HEADER_SIZE,
+            sealed + HEADER_SIZE, subkey.bytes) != 0) {
+            throw AuthError("Couldn't open the segment manifest. The key is wrong or the file is corrupt");
+        }
+
+        manifest.plaintext_size = load_u64(plaintext);
+        manifest.chunk_size = load_u32(plaintext + 8);
+        manifest.chunks_per_segment = load_u32(plaintext + 12);
+        manifest.segment_count = load_u64(plaintext + 16);
+
+        if (manifest.chunk_size != SEGMENT_CHUNK_SIZE || manifest.chunks_per_segment == 0 ||
+            manifest.segment_count != (manifest.chunk_count() + manifest.chunks_per_segment - 1) / manifest.chunks_per_segment) {
+            throw UtilException("Decryption failed. The segment manifest is corrupt");
+        }
+        return manifest;
+    }
+
+    // Opens chunk `index`, read into `sealed`, into `out` and returns its length
+    size_t open_chunk(const unsigned char* sealed, const Manifest& manifest, const Subkey& subkey, uint64_t index, unsigned char* out) {
+        size_t length = manifest.chunk_length(index);
+        unsigned char nonce[NONCE_SIZE];
+        build_nonce(nonce, manifest, index);
+
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+            out, NULL, NULL,
+            sealed, length + TAG_SIZE,
+            NULL, 0,
+            nonce, subkey.bytes) != 0) {
+            throw AuthError(std::format("Decryption failed. Chunk {} is corrupt, or its segment is out of place", index));
+        }
+        return length;
+    }
+
+    // Decrypts one segment, checked to be complete beforehand, to where `output` is positioned
+    void decrypt_segment(const std::string& manifest_path, const Manifest& manifest, const Subkey& subkey, uint64_t segment,
+        std::ostream& output, std::vector<unsigned char>& sealed, std::vector<unsigned char>& decrypted_chunk) {
+        std::string path = segment_path(manifest_path, segment);
+        std::ifstream segment_file(path, std::ios::binary);
+        if (!segment_file.is_open()) throw FileError("Error: Segment `" + path + "` is missing");
+
+        uint64_t first = manifest.first_chunk(segment);
+        for (uint64_t index = first; index < first + manifest.segment_chunks(segment); ++index) {
+            size_t length = manifest.chunk_length(index);
+            if (!segment_file.read(reinterpret_cast<char*>(sealed.data()), static_cast<std::streamsize>(length + TAG_SIZE))) {
+                throw AuthError(std::format("Decryption failed. Segment `{}` is truncated", path));
+            }
+            open_chunk(sealed.data(), manifest, subkey, index, decrypted_chunk.data());
+            output.write(reinterpret_cast<const char*>(decrypted_chunk.data()), static_cast<std::streamsize>(length));
+        }
+        if (!output) throw FileError("Error: Couldn't write the plaintext of segment `" + path + '`');
+    }
+
+    class SegmentedChunkReader : public ChunkReader {
+    public:
+        SegmentedChunkReader(const std::string& manifest_path, const unsigned char* key)
+            : manifest_path(manifest_path), subkey(key), manifest(read_manifest(manifest_path, subkey)), sealed(SEALED_CHUNK_SIZE) {
+        }
+
+        uint64_t size() const override { return manifest.plaintext_size; }
+        size_t chunk_size() const override { return manifest.chunk_size; }
+        uint64_t chunk_count() const override { return manifest.chunk_count(); }
+
+        size_t read_chunk(uint64_t index, unsigned char* out) override {
+            uint64_t segment = index / manifest.chunks_per_segment;
+            if (!file.is_open() || segment != open_segment) {
+                file.close();
+                file.clear();
+                std::string path = segment_path(manifest_path, segment);
+                file.open(path, std::ios::binary);
+                if (!file.is_open()) throw FileError("Error: Segment `" + path + "` is missing");
+                open_segment = segment;
+            }
+
+            size_t length = manifest.chunk_length(index);
+            file.seekg(static_cast<std::streamoff>((index - manifest.first_chunk(segment)) * SEALED_CHUNK_SIZE));
+            if (!file.read(reinterpret_cast<char*>(sealed.data()), static_cast<std::streamsize>(length + TAG_SIZE))) {
+                file.clear();
+                throw AuthError(std::format("Decryption failed. Segment {} is truncated", segment));
+            }
+            return open_chunk(sealed.data(), manifest, subkey, index, out);
+        }
+
+    private:
+        std::string manifest_path;
+        Subkey subkey;
+        Manifest manifest;
+        std::vector<unsigned char> sealed;
+        std::ifstream file;
+        uint64_t open_segment{ 0 };
+    };
+}
+
+std::string segment_path(const std::string& manifest_path, uint64_t index) {
+    return std::format("{}.{:05}", manifest_path, index);
+}
+
+void encrypt_segmented(const std::string& input_path, const std::string& output_path, const unsigned char* key, uint64_t segment_size) {
+    if (segment_size < SEALED_CHUNK_SIZE) {
+        throw UtilException(std::format("The segment size must be at least {} bytes, one sealed chunk", SEALED_CHUNK_SIZE));
+    }
+
+    // Read from the input plaintext file
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+
+    Subkey subkey(key);
+    Manifest manifest;
+    std::memcpy(manifest.header, SEGMENTED_MAGIC, MAGIC_SIZE);
+    randombytes_buf(manifest.header + MAGIC_SIZE, FILE_ID_SIZE);
+
+    // Segments hold whole chunks, so a segment is at most `segment_size` and every part but the last is the same size
+    manifest.chunks_per_segment = static_cast<uint32_t>(std::min<uint64_t>(segment_size / SEALED_CHUNK_SIZE, UINT32_MAX));
+
+    std::vector<unsigned char> plaintext_chunk(SEGMENT_CHUNK_SIZE);
+    std::vector<unsigned char> sealed(SEALED_CHUNK_SIZE);
+    unsigned char nonce[NONCE_SIZE];
+    std::ofstream segment_file;
+
+    for (uint64_t index = 0;; ++index) {
+        input_file.read(reinterpret_cast<char*>(plaintext_chunk.data()), SEGMENT_CHUNK_SIZE);
+        size_t bytes_read = static_cast<size_t>(input_file.gcount());
+        if (bytes_read == 0) break; // Reached EOF
+
+        // Start the next segment once the current one holds its share of chunks
+        if (index % manifest.chunks_per_segment == 0) {
+            if (segment_file.is_open()) {
+                segment_file.close();
+                if (segment_file.fail()) throw FileError("Error: Couldn't write segment `" + segment_path(output_path, manifest.segment_count - 1) + '`');
+            }
+            std::string path = segment_path(output_path, manifest.segment_count++);
+            segment_file.open(path, std::ios::binary | std::ios::trunc);
+            if (!segment_file.is_open()) throw FileError("Error: Couldn't open output file `" + path + '`');
+        }
+
+        build_nonce(nonce, manifest, index);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(
+            sealed.data(), NULL,
+            plaintext_chunk.data(), bytes_read,
+            NULL, 0,
+            NULL, nonce, subkey.bytes);
+        segment_file.write(reinterpret_cast<const char*>(sealed.data()), static_cast<std::streamsize>(bytes_read + TAG_SIZE));
+
+        manifest.plaintext_size += bytes_read;
+        if (bytes_read < SEGMENT_CHUNK_SIZE) break;
+    }
+    sodium_memzero(plaintext_chunk.data(), plaintext_chunk.size());
+
+    if (segment_file.is_open()) {
+        segment_file.close();
+        if (segment_file.fail()) throw FileError("Error: Couldn't write segment `" + segment_path(output_path, manifest.segment_count - 1) + '`');
+    }
+    input_file.close();
+
+    unsigned char plaintext[MANIFEST_PLAINTEXT_SIZE];
+    store_u64(plaintext, manifest.plaintext_size);
+    store_u32(plaintext + 8, manifest.chunk_size);
+    store_u32(plaintext + 12, manifest.chunks_per_segment);
+    store_u64(plaintext + 16, manifest.segment_count);
+
+    // The manifest is written last, so a manifest on disk means every segment it lists is complete
+    unsigned char sealed_manifest[MANIFEST_SIZE];
+    std::memcpy(sealed_manifest, manifest.header, HEADER_SIZE);
+    randombytes_buf(sealed_manifest + HEADER_SIZE, NONCE_SIZE);
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        sealed_manifest + HEADER_SIZE + NONCE_SIZE, NULL,
+        plaintext, sizeof(plaintext),
+        manifest.header, HEADER_SIZE,
+        NULL, sealed_manifest + HEADER_SIZE, subkey.bytes);
+
+    std::ofstream manifest_file(output_path, std::ios::binary | std::ios::trunc);
+    if (!manifest_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+    manifest_file.write(reinterpret_cast<const char*>(sealed_manifest), MANIFEST_SIZE);
+    manifest_file.close();
+    if (manifest_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+
+    std::cout << std::format("Successfully encrypted `{}` to `{}` ({} segments of up to {} bytes)",
+        input_path, output_path, manifest.segment_count, static_cast<uint64_t>(manifest.chunks_per_segment) * SEALED_CHUNK_SIZE) << std::endl;
+}
+
+void decrypt_segmented(const std::string& manifest_path, const std::string& output_path, const unsigned char* key, unsigned threads, bool report) {
+    Subkey subkey(key);
+    Manifest manifest = read_manifest(manifest_path, subkey);
+
+    // Check that every segment is there at its full size before decrypting any of them
+    for (uint64_t segment = 0; segment < manifest.segment_count; ++segment) {
+        std::string path = segment_path(manifest_path, segment);
+        std::error_code size_error;
+        uint64_t size = std::filesystem::file_size(path, size_error);
+        if (size_error) throw FileError("Error: Segment `" + path + "` is missing");
+        if (size != manifest.segment_size(segment)) {
+            throw AuthError(std::format("Decryption failed. Segment `{}` is {} bytes instead of {}", path, size, manifest.segment_size(segment)));
+        }
+    }
+
+    // A pipe or device, e.g. the command behind --exec, can't be sized or written out of order, so the
+    // segments go to it one after another
+    std::error_code status_error;
+    std::filesystem::file_status output_status = std::filesystem::status(output_path, status_error);
+    if (!status_error && std::filesystem::exists(output_status) && !std::filesystem::is_regular_file(output_status)) {
+        std::ofstream output_file(output_path, std::ios::binary);
+        if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+        std::vector<unsigned char> sealed(SEALED_CHUNK_SIZE);
+        std::vector<unsigned char> decrypted_chunk(SEGMENT_CHUNK_SIZE);
+        try {
+            for (uint64_t segment = 0; segment < manifest.segment_count; ++segment) {
+                decrypt_segment(manifest_path, manifest, subkey, segment, output_file, sealed, decrypted_chunk);
+            }
+            output_file.close();
+            if (output_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+        }
+        catch (...) {
+            sodium_memzero(decrypted_chunk.data(), decrypted_chunk.size());
+            throw;
+        }
+        sodium_memzero(decrypted_chunk.data(), decrypted_chunk.size());
+
+        if (report) std::cout << std::format("Successfully decrypted `{}` to `{}` ({} segments)", manifest_path, output_path, manifest.segment_count) << std::endl;
+        return;
+    }
+
+    // Check the validity of the output file and size it up front, so every worker can write its part in place
+    {
+        std::ofstream output_file(output_path, std::ios::binary | std::ios::trunc);
+        if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+    }
+    std::filesystem::resize_file(output_path, manifest.plaintext_size);
+
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<uint64_t>(threads, std::max<uint64_t>(manifest.segment_count, 1)));
+
+    std::atomic<uint64_t> next_segment{ 0 };
+    std::mutex failure_mutex;
+    std::exception_ptr failure;
+
+    auto work = [&] {
+        std::vector<unsigned char> sealed(SEALED_CHUNK_SIZE);
+        std::vector<unsigned char> decrypted_chunk(SEGMENT_CHUNK_SIZE);
+        std::fstream output_file(output_path, std::ios::binary | std::ios::in | std::ios::out);
+
+        try {
+            if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+            for (uint64_t segment = next_segment++; segment < manifest.segment_count; segment = next_segment++) {
+                {
+                    std::lock_guard lock(failure_mutex);
+                    if (failure) break;
+                }
+
+                output_file.seekp(static_cast<std::streamoff>(manifest.first_chunk(segment) * manifest.chunk_size));
+                decrypt_segment(manifest_path, manifest, subkey, segment, output_file, sealed, decrypted_chunk);
+            }
+
+            output_file.close();
+            if (output_file.fail()) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+        }
+        catch (...) {
+            std::lock_guard lock(failure_mutex);
+            if (!failure) failure = std::current_exception();
+        }
+        sodium_memzero(decrypted_chunk.data(), decrypted_chunk.size());
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i) workers.emplace_back(work);
+    work();
+    for (std::thread& worker : workers) worker.join();
+    if (failure) std::rethrow_exception(failure);
+
+    if (report) std::cout << std::format("Successfully decrypted `{}` to `{}` ({} segments)", manifest_path, output_path, manifest.segment_count) << std::endl;
+}
+
+std::unique_ptr<ChunkReader> open_segmented_reader(const std::string& manifest_path, const unsigned char* key) {
+    return std::make_unique<SegmentedChunkReader>(manifest_path, key);
+}
\ No newline at end of file
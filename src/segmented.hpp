@@ -0,0 +1,45 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "src/chunk_reader.hpp"
+
+/*
+ * @brief Encrypts into numbered segment files of at most `segment_size` bytes each, named
+ * `<output_path>.00000`, `<output_path>.00001` and so on, and writes an authenticated manifest
+ * to `output_path`. Segments hold whole chunks and can be uploaded, stored and opened independently
+ */
+void encrypt_segmented(const std::string& input_path, const std::string& output_path, const unsigned char* key, uint64_t segment_size);
+
+/*
+ * @brief Decrypts the segments listed by the manifest at `manifest_path` concurrently. Every segment
+ * must be present, at its expected size and in its place. Prints a line when done if `report` is set
+ */
+void decrypt_segmented(const std::string& manifest_path, const std::string& output_path, const unsigned char* key, unsigned threads = 0, bool report = true);
+
+/*
+ * @brief Opens a segmented file for random access through its manifest
+ */
+std::unique_ptr<ChunkReader> open_segmented_reader(const std::string& manifest_path, const unsigned char* key);
+
+/*
+ * @brief The path of segment `index` of the manifest at `manifest_path`
+ */
+std::string segment_path(const std::string& manifest_path, uint64_t index);
\ No newline at end of file
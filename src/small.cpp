@@ -0,0 +1,165 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <format>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "src/small.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+#include "utilities/digests.h"
+
+#include <sodium/crypto_aead_xchacha20poly1305.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+namespace {
+    // Layout: magic (4) | nonce (24) | ciphertext | tag (16), with the magic as associated data
+    constexpr size_t NONCE_SIZE{ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t TAG_SIZE{ crypto_aead_xchacha20poly1305_ietf_ABYTES };
+    constexpr size_t OVERHEAD{ MAGIC_SIZE + NONCE_SIZE + TAG_SIZE };
+
+    // Unbuffered stdio: every fread()/fwrite() below is a single syscall straight into our stack buffers
+    FILE* open_unbuffered(const std::string& path, const char* mode) {
+        FILE* file = std::fopen(path.c_str(), mode);
+        if (file) std::setvbuf(file, NULL, _IONBF, 0);
+        return file;
+    }
+
+    struct FileCloser {
+        FILE* file;
+        ~FileCloser() { if (file) std::fclose(file); }
+    };
+
+    /*
+     * Reads and opens the whole file into `plaintext`, which holds SMALL_FILE_LIMIT bytes,
+     * and returns the plaintext size
+     */
+    size_t open_small(const std::string& input_path, const unsigned char* key, unsigned char* plaintext) {
+        FILE* input_file = open_unbuffered(input_path, "rb");
+        if (!input_file) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+        FileCloser input_closer{ input_file };
+
+        // One byte of slack tells an oversized (hence corrupt) file apart from the largest valid one
+        unsigned char sealed[SMALL_FILE_LIMIT + OVERHEAD + 1];
+        size_t bytes_read = std::fread(sealed, 1, sizeof(sealed), input_file);
+
+        if (bytes_read < OVERHEAD || bytes_read >= sizeof(sealed) || !has_magic(sealed, SMALL_MAGIC)) {
+            throw UtilException("Decryption failed. The input file maybe corrupt");
+        }
+
+        unsigned char subkey[32];
+        derive_subkey(subkey, 1, "CUSMALL1", key);
+
+        int result = crypto_aead_xchacha20poly1305_ietf_decrypt(
+            plaintext, NULL, NULL,
+            sealed + MAGIC_SIZE + NONCE_SIZE, bytes_read - MAGIC_SIZE - NONCE_SIZE,
+            SMALL_MAGIC, MAGIC_SIZE,
+            sealed + MAGIC_SIZE, subkey);
+        sodium_memzero(subkey, sizeof(subkey));
+
+        if (result != 0) throw AuthError("Decryption failed. The input file maybe corrupt");
+        return bytes_read - OVERHEAD;
+    }
+
+    class SmallChunkReader : public ChunkReader {
+    public:
+        SmallChunkReader(const std::string& input_path, const unsigned char* key) {
+            plaintext_size = open_small(input_path, key, plaintext);
+        }
+
+        ~SmallChunkReader() override {
+            sodium_memzero(plaintext, sizeof(plaintext));
+        }
+
+        uint64_t size() const override { return plaintext_size; }
+        size_t chunk_size() const override { return SMALL_FILE_LIMIT; }
+        uint64_t chunk_count() const override { return 1; }
+
+        size_t read_chunk(uint64_t, unsigned char* out) override {
+            std::memcpy(out, plaintext, plaintext_size);
+            return plaintext_size;
+        }
+
+    private:
+        unsigned char plaintext[SMALL_FILE_LIMIT];
+        size_t plaintext_size{ 0 };
+    };
+}
+
+bool encrypt_small(const std::string& input_path, const std::string& output_path, const unsigned char* key, PartDigests* digests) {
+    FILE* input_file = open_unbuffered(input_path, "rb");
+    if (!input_file) throw FileError("Error: Couldn't open input file `" + input_path + '`');
+    FileCloser input_closer{ input_file };
+
+    unsigned char plaintext[SMALL_FILE_LIMIT];
+    size_t bytes_read = std::fread(plaintext, 1, sizeof(plaintext), input_file);
+
+    // The file grew (or was never small): let the stream handle it
+    if (bytes_read == sizeof(plaintext)) return false;
+    if (std::ferror(input_file)) throw FileError("Error: Couldn't read input file `" + input_path + '`');
+
+    unsigned char subkey[32];
+    derive_subkey(subkey, 1, "CUSMALL1", key);
+
+    unsigned char sealed[SMALL_FILE_LIMIT + OVERHEAD];
+    std::memcpy(sealed, SMALL_MAGIC, MAGIC_SIZE);
+    randombytes_buf(sealed + MAGIC_SIZE, NONCE_SIZE);
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        sealed + MAGIC_SIZE + NONCE_SIZE, NULL,
+        plaintext, bytes_read,
+        SMALL_MAGIC, MAGIC_SIZE,
+        NULL, sealed + MAGIC_SIZE, subkey);
+
+    sodium_memzero(subkey, sizeof(subkey));
+    sodium_memzero(plaintext, sizeof(plaintext));
+
+    FILE* output_file = open_unbuffered(output_path, "wb");
+    if (!output_file) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+    FileCloser output_closer{ output_file };
+
+    if (std::fwrite(sealed, 1, bytes_read + OVERHEAD, output_file) != bytes_read + OVERHEAD) {
+        throw FileError("Error: Couldn't write output file `" + output_path + '`');
+    }
+    if (digests) digests->update({ sealed, bytes_read + OVERHEAD });
+
+    std::cout << std::format("Successfully encrypted `{}` to `{}`", input_path, output_path) << std::endl;
+    return true;
+}
+
+void decrypt_small(const std::string& input_path, const std::string& output_path, const unsigned char* key, bool report) {
+    unsigned char plaintext[SMALL_FILE_LIMIT];
+    size_t plaintext_size = open_small(input_path, key, plaintext);
+
+    FILE* output_file = open_unbuffered(output_path, "wb");
+    if (!output_file) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+    FileCloser output_closer{ output_file };
+
+    bool written = std::fwrite(plaintext, 1, plaintext_size, output_file) == plaintext_size;
+    sodium_memzero(plaintext, sizeof(plaintext));
+    if (!written) throw FileError("Error: Couldn't write output file `" + output_path + '`');
+
+    if (report) std::cout << std::format("Successfully decrypted `{}` to `{}`", input_path, output_path) << std::endl;
+}
+
+std::unique_ptr<ChunkReader> open_small_reader(const std::string& input_path, const unsigned char* key) {
+    return std::make_unique<SmallChunkReader>(input_path, key);
+}
@@ -0,0 +1,45 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <memory>
+#include <cstddef>
+
+#include "src/chunk_reader.hpp"
+
+class PartDigests;
+
+// Inputs smaller than this are sealed in one shot instead of going through the stream
+constexpr size_t SMALL_FILE_LIMIT{ 4096 };
+
+/*
+ * @brief Encrypts a file smaller than SMALL_FILE_LIMIT with a single AEAD call, one read and one write.
+ * Returns false without writing anything if the input turns out not to be that small. The sealed bytes
+ * are also fed to `digests` when given
+ */
+bool encrypt_small(const std::string& input_path, const std::string& output_path, const unsigned char* key, PartDigests* digests = nullptr);
+
+/*
+ * @brief Decrypts a file written by `encrypt_small()`, printing a line when done if `report` is set
+ */
+void decrypt_small(const std::string& input_path, const std::string& output_path, const unsigned char* key, bool report = true);
+
+/*
+ * @brief Opens a file written by `encrypt_small()` as a single chunk, decrypted up front
+ */
+std::unique_ptr<ChunkReader> open_small_reader(const std::string& input_path, const unsigned char* key);
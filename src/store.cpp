@@ -0,0 +1,305 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "src/store.hpp"
+#include "src/format.hpp"
+#include "utilities/exception.h"
+
+#include <sodium/crypto_aead_xchacha20poly1305.h>
+#include <sodium/crypto_generichash.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+
+namespace {
+    // Chunk file   = nonce (24) | ciphertext | tag (16), stored at <store>/chunks/<id[0..2]>/<id>
+    // Recipe       = magic (4) | nonce (24) | sealed(plaintext size (u64) | chunk count (u64) | (id (32) | length (u32)) * count) | tag (16)
+    // Chunk IDs are keyed hashes of the plaintext, so equal chunks dedupe under one key and
+    // nothing about a chunk's content can be learned from its name without that key
+    constexpr size_t MIN_CHUNK_SIZE{ 2 * 1024 };
+    constexpr size_t AVG_CHUNK_SIZE{ 8 * 1024 };
+    constexpr size_t MAX_CHUNK_SIZE{ 64 * 1024 };
+    constexpr uint64_t MASK_SMALL{ (1ULL << 15) - 1 };
+    constexpr uint64_t MASK_LARGE{ (1ULL << 11) - 1 };
+    constexpr size_t READ_BUFFER_SIZE{ 1024 * 1024 };
+
+    constexpr size_t ID_SIZE{ crypto_generichash_BYTES };
+    constexpr size_t NONCE_SIZE{ crypto_aead_xchacha20poly1305_ietf_NPUBBYTES };
+    constexpr size_t TAG_SIZE{ crypto_aead_xchacha20poly1305_ietf_ABYTES };
+    constexpr size_t RECIPE_ENTRY_SIZE{ ID_SIZE + 4 };
+    constexpr size_t RECIPE_FIXED_SIZE{ 16 };
+
+    struct Keys {
+        unsigned char seal[32];
+        unsigned char id[32];
+        unsigned char gear_seed[32];
+
+        explicit Keys(const unsigned char* key) {
+            derive_subkey(seal, 1, "CUSTORE1", key);
+            derive_subkey(id, 2, "CUSTORE1", key);
+            derive_subkey(gear_seed, 3, "CUSTORE1", key);
+        }
+
+        ~Keys() {
+            sodium_memzero(seal, sizeof(seal));
+            sodium_memzero(id, sizeof(id));
+            sodium_memzero(gear_seed, sizeof(gear_seed));
+        }
+    };
+
+    /*
+     * FastCDC-style chunker over a gear rolling hash. The gear table is derived from the key,
+     * so chunk boundaries (and with them chunk sizes) don't leak content to someone without it
+     */
+    class Chunker {
+    public:
+        explicit Chunker(const Keys& keys) {
+            randombytes_buf_deterministic(gear, sizeof(gear), keys.gear_seed);
+        }
+
+        // Returns the length of the chunk starting at `data`; `size` is never more than MAX_CHUNK_SIZE
+        size_t find_cut(const unsigned char* data, size_t size) const {
+            if (size <= MIN_CHUNK_SIZE) return size;
+
+            uint64_t hash = 0;
+            size_t i = MIN_CHUNK_SIZE;
+            size_t normal_size = std::min(size, AVG_CHUNK_SIZE);
+
+            // Below the average size a stricter mask makes a cut less likely, above it a looser
+            // one makes it more likely, which keeps chunk sizes close to the average
+            for (; i < normal_size; ++i) {
+                hash = (hash << 1) + gear[data[i]];
+                if ((hash & MASK_SMALL) == 0) return i + 1;
+            }
+            for (; i < size; ++i) {
+                hash = (hash << 1) + gear[data[i]];
+                if ((hash & MASK_LARGE) == 0) return i + 1;
+            }
+            return size;
+        }
+
+    private:
+        uint64_t gear[256];
+    };
+
+    std::filesystem::path chunk_path(const std::filesystem::path& store_dir, const unsigned char* id) {
+        char id_hex[ID_SIZE * 2 + 1];
+        sodium_bin2hex(id_hex, sizeof(id_hex), id, ID_SIZE);
+        return store_dir / "chunks" / std::string(id_hex, 2) / id_hex;
+    }
+
+    // Returns true if the chunk was new and had to be encrypted and written
+    bool put_chunk(const std::filesystem::path& store_dir, const unsigned char* id, const unsigned char* data, size_t size,
+        const Keys& keys, std::vector<unsigned char>& sealed) {
+        std::filesystem::path path = chunk_path(store_dir, id);
+        if (std::filesystem::exists(path)) return false;
+
+        std::filesystem::create_directories(path.parent_path());
+
+        sealed.resize(NONCE_SIZE + size + TAG_SIZE);
+        randombytes_buf(sealed.data(), NONCE_SIZE);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(
+            sealed.data() + NONCE_SIZE, NULL,
+            data, size,
+            id, ID_SIZE,
+            NULL, sealed.data(), keys.seal);
+
+        // Written under a temporary name and renamed, so a concurrent or interrupted
+        // run never leaves a partial chunk under its final name
+        std::filesystem::path temp_path = path;
+        temp_path += std::format(".tmp{}", randombytes_uniform(UINT32_MAX));
+        {
+            std::ofstream chunk_file(temp_path, std::ios::binary);
+            chunk_file.write(reinterpret_cast<const char*>(sealed.data()), sealed.size());
+            if (!chunk_file) throw FileError("Error: Couldn't write chunk file `" + temp_path.string() + '`');
+        }
+        std::filesystem::rename(temp_path, path);
+        return true;
+    }
+
+    void get_chunk(const std::filesystem::path& store_dir, const unsigned char* id, size_t size, const Keys& keys,
+        std::vector<unsigned char>& sealed, std::vector<unsigned char>& plaintext) {
+        std::filesystem::path path = chunk_path(store_dir, id);
+        std::ifstream chunk_file(path, std::ios::binary);
+        if (!chunk_file.is_open()) throw FileError("Error: Chunk `" + path.string() + "` is missing from the store");
+
+        sealed.resize(NONCE_SIZE + size + TAG_SIZE);
+        plaintext.resize(size);
+        chunk_file.read(reinterpret_cast<char*>(sealed.data()), sealed.size());
+
+        unsigned char actual_id[ID_SIZE];
+        if (static_cast<size_t>(chunk_file.gcount()) != sealed.size() ||
+            crypto_aead_xchacha20poly1305_ietf_decrypt(
+                plaintext.data(), NULL, NULL,
+                sealed.data() + NONCE_SIZE, size + TAG_SIZE,
+                id, ID_SIZE,
+                sealed.data(), keys.seal) != 0 ||
+            crypto_generichash(actual_id, ID_SIZE, plaintext.data(), size, keys.id, sizeof(keys.id)) != 0 ||
+            std::memcmp(actual_id, id, ID_SIZE) != 0) {
+            throw AuthError("Decryption failed. Chunk `" + path.string() + "` is corrupt");
+        }
+    }
+}
+
+void store_file(const std::string& input_path, const std::string& recipe_path, const std::string& store_dir, const unsigned char* key) {
+    // Read from the input plaintext file
+    std::ifstream input_file(input_path, std::ios::binary);
+    if (!input_file.is_open()) {
+        throw FileError("Error: Couldn't open input file `" + input_path + '`');
+    }
+
+    // Check the validity of the output file
+    std::ofstream recipe_file(recipe_path, std::ios::binary);
+    if (!recipe_file.is_open()) {
+        throw FileError("Error: Couldn't open output file `" + recipe_path + '`');
+    }
+
+    std::filesystem::create_directories(store_dir);
+
+    Keys keys(key);
+    Chunker chunker(keys);
+
+    std::vector<unsigned char> buffer(READ_BUFFER_SIZE);
+    std::vector<unsigned char> sealed;
+    std::vector<unsigned char> recipe(RECIPE_FIXED_SIZE);
+    size_t start = 0;
+    size_t end = 0;
+    bool eof = false;
+    uint64_t plaintext_size = 0;
+    uint64_t chunk_count = 0;
+    uint64_t new_chunks = 0;
+    uint64_t new_bytes = 0;
+
+    while (true) {
+        // Keep at least one maximum-size chunk buffered so every cut sees its full window
+        if (!eof && end - start < MAX_CHUNK_SIZE) {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+
+            input_file.read(reinterpret_cast<char*>(buffer.data() + end), buffer.size() - end);
+            end += input_file.gcount();
+            eof = input_file.eof();
+        }
+
+        if (start == end) break;
+
+        size_t length = chunker.find_cut(buffer.data() + start, std::min(end - start, MAX_CHUNK_SIZE));
+
+        unsigned char id[ID_SIZE];
+        crypto_generichash(id, ID_SIZE, buffer.data() + start, length, keys.id, sizeof(keys.id));
+
+        if (put_chunk(store_dir, id, buffer.data() + start, length, keys, sealed)) {
+            ++new_chunks;
+            new_bytes += length;
+        }
+
+        unsigned char entry[RECIPE_ENTRY_SIZE];
+        std::memcpy(entry, id, ID_SIZE);
+        store_u32(entry + ID_SIZE, static_cast<uint32_t>(length));
+        recipe.insert(recipe.end(), entry, entry + RECIPE_ENTRY_SIZE);
+
+        plaintext_size += length;
+        ++chunk_count;
+        start += length;
+    }
+
+    store_u64(recipe.data(), plaintext_size);
+    store_u64(recipe.data() + 8, chunk_count);
+
+    // The recipe is bound to its magic, which is also the only thing in front of it
+    std::vector<unsigned char> sealed_recipe(MAGIC_SIZE + NONCE_SIZE + recipe.size() + TAG_SIZE);
+    std::memcpy(sealed_recipe.data(), RECIPE_MAGIC, MAGIC_SIZE);
+    randombytes_buf(sealed_recipe.data() + MAGIC_SIZE, NONCE_SIZE);
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        sealed_recipe.data() + MAGIC_SIZE + NONCE_SIZE, NULL,
+        recipe.data(), recipe.size(),
+        RECIPE_MAGIC, MAGIC_SIZE,
+        NULL, sealed_recipe.data() + MAGIC_SIZE, keys.seal);
+
+    recipe_file.write(reinterpret_cast<const char*>(sealed_recipe.data()), sealed_recipe.size());
+
+    input_file.close();
+    recipe_file.close();
+    if (recipe_file.fail()) throw FileError("Error: Couldn't write output file `" + recipe_path + '`');
+
+    std::cout << std::format("Successfully stored `{}` in `{}` as {} chunks ({} new, {} of {} bytes encrypted), recipe `{}`",
+        input_path, store_dir, chunk_count, new_chunks, new_bytes, plaintext_size, recipe_path) << std::endl;
+}
+
+void restore_file(const std::string& recipe_path, const std::string& output_path, const std::string& store_dir, const unsigned char* key) {
+    // Read from the recipe file
+    std::ifstream recipe_file(recipe_path, std::ios::binary);
+    if (!recipe_file.is_open()) throw FileError("Error: Couldn't open input file `" + recipe_path + '`');
+
+    std::vector<unsigned char> sealed_recipe(std::filesystem::file_size(recipe_path));
+    recipe_file.read(reinterpret_cast<char*>(sealed_recipe.data()), sealed_recipe.size());
+
+    if (sealed_recipe.size() < MAGIC_SIZE + NONCE_SIZE + RECIPE_FIXED_SIZE + TAG_SIZE || !has_magic(sealed_recipe.data(), RECIPE_MAGIC)) {
+        throw UtilException("`" + recipe_path + "` isn't a chunk store recipe");
+    }
+
+    Keys keys(key);
+    std::vector<unsigned char> recipe(sealed_recipe.size() - MAGIC_SIZE - NONCE_SIZE - TAG_SIZE);
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(
+        recipe.data(), NULL, NULL,
+        sealed_recipe.data() + MAGIC_SIZE + NONCE_SIZE, sealed_recipe.size() - MAGIC_SIZE - NONCE_SIZE,
+        RECIPE_MAGIC, MAGIC_SIZE,
+        sealed_recipe.data() + MAGIC_SIZE, keys.seal) != 0) {
+        throw AuthError("Decryption failed. The input file maybe corrupt");
+    }
+
+    uint64_t plaintext_size = load_u64(recipe.data());
+    uint64_t chunk_count = load_u64(recipe.data() + 8);
+    if (chunk_count != (recipe.size() - RECIPE_FIXED_SIZE) / RECIPE_ENTRY_SIZE ||
+        (recipe.size() - RECIPE_FIXED_SIZE) % RECIPE_ENTRY_SIZE != 0) {
+        throw UtilException("Decryption failed. The input file maybe corrupt");
+    }
+
+    // Check the validity of the output file
+    std::ofstream output_file(output_path, std::ios::binary);
+    if (!output_file.is_open()) throw FileError("Error: Couldn't open output file `" + output_path + '`');
+
+    std::vector<unsigned char> sealed;
+    std::vector<unsigned char> plaintext;
+    uint64_t restored_size = 0;
+
+    for (uint64_t i = 0; i < chunk_count; ++i) {
+        const unsigned char* entry = recipe.data() + RECIPE_FIXED_SIZE + i * RECIPE_ENTRY_SIZE;
+        size_t length = load_u32(entry + ID_SIZE);
+        if (length == 0 || length > MAX_CHUNK_SIZE) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+        get_chunk(store_dir, entry, length, keys, sealed, plaintext);
+        output_file.write(reinterpret_cast<const char*>(plaintext.data()), length);
+        restored_size += length;
+    }
+
+    if (restored_size != plaintext_size) throw UtilException("Decryption failed. The input file maybe corrupt");
+
+    recipe_file.close();
+    output_file.close();
+
+    std::cout << std::format("Successfully restored `{}` from `{}` to `{}`", recipe_path, store_dir, output_path) << std::endl;
+}
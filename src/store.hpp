@@ -0,0 +1,30 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+
+/*
+ * @brief Splits the input into content-defined chunks, encrypts only the chunks that
+ * aren't in `store_dir` yet and writes an encrypted recipe listing them to `recipe_path`
+ */
+void store_file(const std::string& input_path, const std::string& recipe_path, const std::string& store_dir, const unsigned char* key);
+
+/*
+ * @brief Reassembles the file described by the recipe at `recipe_path` from `store_dir`
+ */
+void restore_file(const std::string& recipe_path, const std::string& output_path, const std::string& store_dir, const unsigned char* key);
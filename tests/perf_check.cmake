@@ -0,0 +1,28 @@
+# Runs encryptor_bench and compares it with the stored baseline, or records a new baseline
+# when UPDATE_BASELINE is set. Invoked by the perf_throughput test and the perf_baseline target.
+
+set(CURRENT "${WORK_DIR}/perf_current.json")
+
+execute_process(
+    COMMAND "${BENCH}" --size "${SIZE}" --runs 3 --dir "${WORK_DIR}" --json "${CURRENT}"
+    RESULT_VARIABLE bench_result)
+if(NOT bench_result EQUAL 0)
+    message(FATAL_ERROR "encryptor_bench failed (${bench_result})")
+endif()
+
+if(UPDATE_BASELINE)
+    configure_file("${CURRENT}" "${BASELINE}" COPYONLY)
+    message(STATUS "Recorded ${BASELINE}")
+    return()
+endif()
+
+if(NOT EXISTS "${BASELINE}")
+    message(FATAL_ERROR "No baseline at ${BASELINE}; record one with the perf_baseline target")
+endif()
+
+execute_process(
+    COMMAND "${COMPARE}" "${BASELINE}" "${CURRENT}" --tolerance "${TOLERANCE}"
+    RESULT_VARIABLE compare_result)
+if(NOT compare_result EQUAL 0)
+    message(FATAL_ERROR "Throughput regressed by more than ${TOLERANCE}% against ${BASELINE}")
+endif()
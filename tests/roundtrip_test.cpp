@@ -0,0 +1,1401 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Round-trips files through every container format at the sizes where chunking bugs hide:
+ * empty files, exact multiples of each chunk and buffer size, and one byte either side.
+ * Also checks that tampered and truncated inputs are rejected. Run with the name of a suite.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <format>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+
+#include "src/encrypt.hpp"
+#include "src/decrypt.hpp"
+#include "src/indexed.hpp"
+#include "src/store.hpp"
+#include "src/pack.hpp"
+#include "src/kernel.hpp"
+#include "src/memfd.hpp"
+#include "src/exec.hpp"
+#include "src/encrypted_stream.hpp"
+#include "src/async.hpp"
+#include "src/records.hpp"
+#include "src/grep.hpp"
+#include "src/segmented.hpp"
+#include "src/chunk_reader.hpp"
+#include "src/format.hpp"
+#include "utilities/file_io.h"
+#include "utilities/exception.h"
+#include "utilities/source_sink.h"
+#include "utilities/digests.h"
+#include "utilities/buffer_pool.h"
+
+#include <sodium/core.h>
+#include <sodium/randombytes.h>
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+#include <sodium/crypto_hash_sha256.h>
+#include <sodium/utils.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr uint64_t KIB{ 1024 };
+
+    // Stream records, indexed chunks, the I/O buffer, the direct I/O buffer and a few multiples
+    const std::vector<uint64_t> BOUNDARIES{
+        STREAM_CHUNK_SIZE, 2 * STREAM_CHUNK_SIZE, 64 * KIB, 256 * KIB, 1024 * KIB, 3 * 1024 * KIB
+    };
+
+    int failures = 0;
+    unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+
+    // std::cout's own buffer; the suites run with it swapped for a discarded one
+    std::streambuf* stdout_buffer = nullptr;
+
+    void check(bool condition, const std::string& what) {
+        if (condition) return;
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+
+    std::vector<uint64_t> test_sizes() {
+        std::vector<uint64_t> sizes{ 0, 1 };
+        for (uint64_t boundary : BOUNDARIES) {
+            sizes.push_back(boundary - 1);
+            sizes.push_back(boundary);
+            sizes.push_back(boundary + 1);
+        }
+        return sizes;
+    }
+
+    void write_random_file(const fs::path& path, uint64_t size) {
+        std::vector<unsigned char> data(size);
+        randombytes_buf(data.data(), data.size());
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!file) throw FileError("Error: Couldn't create `" + path.string() + '`');
+    }
+
+    std::string read_file(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void flip_byte(const fs::path& path, uint64_t offset) {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekg(static_cast<std::streamoff>(offset));
+        char byte = 0;
+        file.get(byte);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.put(static_cast<char>(byte ^ 0x01));
+    }
+
+    // True if `operation` throws one of the library's exceptions
+    bool rejects(const std::function<void()>& operation) {
+        try {
+            operation();
+        }
+        catch (const UtilException&) {
+            return true;
+        }
+        return false;
+    }
+
+    void round_trip(const std::string& label, const fs::path& dir, uint64_t size,
+        const std::function<void(const std::string&, const std::string&)>& seal,
+        const std::function<void(const std::string&, const std::string&)>& open) {
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = dir / "opened.dec";
+        write_random_file(plain, size);
+
+        try {
+            seal(plain.string(), sealed.string());
+            open(sealed.string(), opened.string());
+            check(read_file(plain) == read_file(opened), std::format("{}: {} bytes came back different", label, size));
+        }
+        catch (const std::exception& e) {
+            check(false, std::format("{}: {} bytes threw `{}`", label, size, e.what()));
+        }
+    }
+
+    void test_stream(const fs::path& dir) {
+        IoOptions direct;
+        direct.direct = true;
+        IoOptions drop_cache;
+        drop_cache.drop_cache = true;
+        IoOptions no_preallocate;
+        no_preallocate.preallocate = false;
+
+        IoOptions small;
+        small.small_format = true;
+
+        const std::pair<const char*, IoOptions> variants[]{
+            { "buffered", IoOptions{} }, { "direct", direct }, { "no-cache-pollution", drop_cache }, { "no-preallocate", no_preallocate }, { "small", small }
+        };
+
+        for (const auto& [name, options] : variants) {
+            for (uint64_t size : test_sizes()) {
+                round_trip(std::format("stream ({})", name), dir, size,
+                    [&](const std::string& in, const std::string& out) { encrypt(in, out, key, options); },
+                    [&](const std::string& in, const std::string& out) { decrypt(in, out, key, options); });
+            }
+        }
+
+        // Unless asked for the small format, even tiny files are sealed as a stream of exactly the documented size
+        for (uint64_t size : { uint64_t{ 0 }, uint64_t{ 100 }, 2 * STREAM_CHUNK_SIZE, 64 * KIB + 1 }) {
+            write_random_file(dir / "plain.bin", size);
+            encrypt((dir / "plain.bin").string(), (dir / "sealed.enc").string(), key);
+            check(fs::file_size(dir / "sealed.enc") == stream_ciphertext_size(size), std::format("stream: {} bytes sealed to the wrong size", size));
+        }
+
+        // A stream whose random header happens to start with a container's magic still decrypts. Pulling from a
+        // chosen header gives the state pushing would have started from, so such a stream can be made on purpose
+        std::vector<unsigned char> plaintext(3 * STREAM_CHUNK_SIZE + 10);
+        randombytes_buf(plaintext.data(), plaintext.size());
+        std::memcpy(plaintext.data() + 5000, "needle", 6);
+        for (const auto* magic : { &INDEXED_MAGIC, &RECIPE_MAGIC, &SMALL_MAGIC, &PACK_MAGIC, &KERNEL_MAGIC, &RECORDS_MAGIC, &SEGMENTED_MAGIC }) {
+            std::vector<unsigned char> sealed(crypto_secretstream_xchacha20poly1305_HEADERBYTES);
+            randombytes_buf(sealed.data(), sealed.size());
+            std::memcpy(sealed.data(), *magic, MAGIC_SIZE);
+            crypto_secretstream_xchacha20poly1305_state state;
+            crypto_secretstream_xchacha20poly1305_init_pull(&state, sealed.data(), key);
+            for (size_t at = 0;; at += STREAM_CHUNK_SIZE) {
+                size_t length = std::min(STREAM_CHUNK_SIZE, plaintext.size() - at);
+                unsigned char tag = length < STREAM_CHUNK_SIZE ? crypto_secretstream_xchacha20poly1305_TAG_FINAL : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
+                size_t offset = sealed.size();
+                sealed.resize(offset + length + crypto_secretstream_xchacha20poly1305_ABYTES);
+                crypto_secretstream_xchacha20poly1305_push(&state, sealed.data() + offset, NULL, plaintext.data() + at, length, NULL, 0, tag);
+                if (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL) break;
+            }
+
+            std::string name(reinterpret_cast<const char*>(*magic), MAGIC_SIZE);
+            std::ofstream(dir / "sealed.enc", std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(sealed.data()), static_cast<std::streamsize>(sealed.size()));
+            decrypt((dir / "sealed.enc").string(), (dir / "opened.dec").string(), key);
+            check(read_file(dir / "opened.dec") == std::string(plaintext.begin(), plaintext.end()), std::format("stream: a stream starting with {} came back different", name));
+
+            MemorySource source(sealed);
+            std::vector<unsigned char> opened;
+            MemorySink sink(opened);
+            decrypt(source, sink, key);
+            check(opened == plaintext, std::format("stream: a stream starting with {} came back different from memory", name));
+
+            // So do the readers that open any format by its path
+            encrypted_ifstream stream((dir / "sealed.enc").string(), key);
+            check(std::vector<unsigned char>(std::istreambuf_iterator<char>(stream), {}) == plaintext, std::format("stream: a stream starting with {} read back different", name));
+            std::vector<uint64_t> found;
+            GrepOptions grep_offsets;
+            grep_offsets.offsets = true;
+            grep_file((dir / "sealed.enc").string(), "needle", key, grep_offsets, [&](const GrepMatch& match) { found.push_back(match.offset); });
+            check(found == std::vector<uint64_t>{ 5000 }, std::format("stream: a stream starting with {} was searched wrong", name));
+#if defined(__linux__)
+            std::string copy_command = "cat > '" + (dir / "copied.bin").string() + "'";
+            check(decrypt_to_command((dir / "sealed.enc").string(), copy_command, key) == 0 && read_file(dir / "copied.bin") == std::string(plaintext.begin(), plaintext.end()),
+                std::format("stream: a stream starting with {} wasn't piped to a command", name));
+#endif
+
+            // Tampered, it fails both as the container and as a stream
+            sealed.back() ^= 1;
+            std::ofstream(dir / "sealed.enc", std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(sealed.data()), static_cast<std::streamsize>(sealed.size()));
+            check(rejects([&] { decrypt((dir / "sealed.enc").string(), (dir / "opened.dec").string(), key); }), std::format("stream: a tampered stream starting with {} was accepted", name));
+        }
+    }
+
+    void test_indexed(const fs::path& dir) {
+        for (uint64_t size : test_sizes()) {
+            round_trip("indexed", dir, size,
+                [](const std::string& in, const std::string& out) { encrypt_indexed(in, out, key); },
+                [](const std::string& in, const std::string& out) { decrypt(in, out, key); });
+        }
+
+        // An update must leave a container that decrypts to the new contents
+        write_random_file(dir / "plain.bin", 300 * KIB);
+        encrypt_indexed((dir / "plain.bin").string(), (dir / "sealed.enc").string(), key);
+        std::string original = read_file(dir / "sealed.enc");
+        flip_byte(dir / "plain.bin", 100 * KIB);
+        encrypt_indexed((dir / "plain.bin").string(), (dir / "sealed.enc").string(), key);
+        decrypt((dir / "sealed.enc").string(), (dir / "opened.dec").string(), key);
+        check(read_file(dir / "plain.bin") == read_file(dir / "opened.dec"), "indexed: update didn't round-trip");
+
+        // and must only have resealed the chunk holding the changed byte, the second of five, and the manifest
+        // behind the slots. A header is 24 bytes and a slot a nonce, 64 KiB of ciphertext and a tag
+        constexpr uint64_t HEADER{ 24 };
+        constexpr uint64_t SLOT{ 24 + 64 * KIB + 16 };
+        constexpr uint64_t MANIFEST{ HEADER + 4 * SLOT + 24 + (300 * KIB - 4 * 64 * KIB) + 16 };
+        std::string updated = read_file(dir / "sealed.enc");
+        check(updated.size() == original.size(), "indexed: update changed the container's size");
+        bool chunk_changed = false;
+        for (uint64_t at = 0; at < std::min(original.size(), updated.size()); ++at) {
+            if (original[at] == updated[at]) continue;
+            bool in_chunk = at >= HEADER + SLOT && at < HEADER + 2 * SLOT;
+            chunk_changed = chunk_changed || in_chunk;
+            if (!in_chunk && at < MANIFEST) {
+                check(false, std::format("indexed: update rewrote byte {} outside the changed chunk", at));
+                break;
+            }
+        }
+        check(chunk_changed, "indexed: update didn't reseal the changed chunk");
+    }
+
+    void test_store(const fs::path& dir) {
+        fs::path store = dir / "store";
+        for (uint64_t size : test_sizes()) {
+            round_trip("store", dir, size,
+                [&](const std::string& in, const std::string& out) { store_file(in, out, store.string(), key); },
+                [&](const std::string& in, const std::string& out) { restore_file(in, out, store.string(), key); });
+        }
+
+        // Storing a file again adds no chunks, and an edit only adds the chunks around it
+        fs::path dedup_store = dir / "dedup_store";
+        auto count_chunks = [&] {
+            return std::distance(fs::recursive_directory_iterator(dedup_store / "chunks"), fs::recursive_directory_iterator{}) -
+                std::distance(fs::directory_iterator(dedup_store / "chunks"), fs::directory_iterator{});
+        };
+        fs::path plain = dir / "plain.bin";
+        fs::path recipe = dir / "recipe.enc";
+        write_random_file(plain, 1024 * KIB);
+        store_file(plain.string(), recipe.string(), dedup_store.string(), key);
+        auto chunks = count_chunks();
+        check(chunks > 64, std::format("store: 1 MiB was split into only {} chunks", chunks));
+        store_file(plain.string(), recipe.string(), dedup_store.string(), key);
+        check(count_chunks() == chunks, std::format("store: storing a file again grew the store from {} to {} chunks", chunks, count_chunks()));
+
+        // Inserting a byte shifts everything after it, which content-defined cuts absorb within a chunk or two
+        std::string edited = read_file(plain);
+        edited.insert(edited.begin() + 500 * KIB, 'x');
+        std::ofstream(plain, std::ios::binary | std::ios::trunc) << edited;
+        store_file(plain.string(), recipe.string(), dedup_store.string(), key);
+        check(count_chunks() - chunks <= 3, std::format("store: a one-byte insertion added {} of {} chunks", count_chunks() - chunks, chunks));
+        restore_file(recipe.string(), (dir / "opened.dec").string(), dedup_store.string(), key);
+        check(read_file(dir / "opened.dec") == edited, "store: the edited file came back different");
+    }
+
+    void test_pack(const fs::path& dir) {
+        // Packed names are relative, so work from inside the directory
+        fs::path original_dir = fs::current_path();
+        fs::current_path(dir);
+
+        std::vector<std::string> names;
+        for (uint64_t size : test_sizes()) {
+            names.push_back(std::format("file_{}.bin", size));
+            write_random_file(names.back(), size);
+        }
+
+        try {
+            pack_files(names, "files.pack", key);
+            decrypt("files.pack", "unpacked", key);
+            for (const std::string& name : names) {
+                check(read_file(name) == read_file(fs::path("unpacked") / name), std::format("pack: `{}` came back different", name));
+            }
+        }
+        catch (const std::exception& e) {
+            check(false, std::format("pack: threw `{}`", e.what()));
+        }
+
+        fs::current_path(original_dir);
+    }
+
+    // Runs the AF_ALG path where the kernel provides it and the libsodium fallback elsewhere
+    void test_kernel(const fs::path& dir) {
+        for (uint64_t size : test_sizes()) {
+            round_trip("kernel", dir, size,
+                [](const std::string& in, const std::string& out) { encrypt_kernel(in, out, key); },
+                [](const std::string& in, const std::string& out) { decrypt(in, out, key); });
+        }
+
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = dir / "opened.dec";
+        write_random_file(plain, 200 * KIB);
+
+        encrypt_kernel(plain.string(), sealed.string(), key);
+        flip_byte(sealed, fs::file_size(sealed) / 2);
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }), "kernel: a flipped byte was accepted");
+
+        // Dropping the final record leaves a file whose new last record lacks the final flag
+        encrypt_kernel(plain.string(), sealed.string(), key);
+        fs::resize_file(sealed, fs::file_size(sealed) - (200 * KIB % (64 * KIB)) - 16);
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }), "kernel: a truncated file was accepted");
+    }
+
+    // Hands each decrypted file across a socket pair and reads it back through a mapping
+    void test_memfd(const fs::path& dir) {
+#if defined(__linux__)
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+
+        for (uint64_t size : { uint64_t{ 0 }, uint64_t{ 100 }, 3 * STREAM_CHUNK_SIZE + 5, 1024 * KIB + 1 }) {
+            write_random_file(plain, size);
+            if (size > 1024 * KIB) encrypt_indexed(plain.string(), sealed.string(), key);
+            else encrypt(plain.string(), sealed.string(), key);
+
+            int sockets[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) throw UtilException("Error: Couldn't create a socket pair");
+
+            // The memfd has no name worth printing, so the caller reports the handoff instead
+            std::ostringstream printed;
+            std::streambuf* discarded_buffer = std::cout.rdbuf(printed.rdbuf());
+            int memfd = -1;
+            try {
+                memfd = decrypt_to_memfd(sealed.string(), key);
+            }
+            catch (...) {
+                std::cout.rdbuf(discarded_buffer);
+                throw;
+            }
+            std::cout.rdbuf(discarded_buffer);
+            check(printed.str().empty(), std::format("memfd: decrypting {} bytes printed `{}`", size, printed.str()));
+            send_memfd(sockets[0], memfd);
+            close(memfd);
+
+            uint64_t received_size = 0;
+            int received = receive_memfd(sockets[1], received_size);
+            close(sockets[0]);
+            close(sockets[1]);
+            check(received_size == size, std::format("memfd: {} bytes arrived as {}", size, received_size));
+
+            std::string contents;
+            if (received_size > 0) {
+                void* mapping = mmap(nullptr, received_size, PROT_READ, MAP_SHARED, received, 0);
+                check(mapping != MAP_FAILED, std::format("memfd: couldn't map {} bytes", size));
+                if (mapping != MAP_FAILED) {
+                    contents.assign(static_cast<const char*>(mapping), received_size);
+                    munmap(mapping, received_size);
+                }
+            }
+            check(contents == read_file(plain), std::format("memfd: {} bytes came back different", size));
+
+            // The seals must stop the receiver from changing what it was given
+            check(write(received, "x", 1) < 0, std::format("memfd: a {} byte memfd accepted a write", size));
+            close(received);
+        }
+
+        encrypt(plain.string(), sealed.string(), key);
+        flip_byte(sealed, fs::file_size(sealed) / 2);
+        check(rejects([&] { close(decrypt_to_memfd(sealed.string(), key)); }), "memfd: a flipped byte was accepted");
+
+        // A sealed memfd sent with a size bigger than it is would have the consumer map past its end
+        {
+            int memfd = memfd_create("forged", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if (memfd < 0 || write(memfd, "plaintext", 9) != 9 || fcntl(memfd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+                throw UtilException("Error: Couldn't create a sealed memfd");
+            }
+
+            int sockets[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) throw UtilException("Error: Couldn't create a socket pair");
+
+            unsigned char size_bytes[8];
+            store_u64(size_bytes, 1024 * KIB);
+            iovec payload{ size_bytes, sizeof(size_bytes) };
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+            msghdr message{};
+            message.msg_iov = &payload;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr* rights = CMSG_FIRSTHDR(&message);
+            rights->cmsg_level = SOL_SOCKET;
+            rights->cmsg_type = SCM_RIGHTS;
+            rights->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(rights), &memfd, sizeof(int));
+            if (sendmsg(sockets[0], &message, 0) != static_cast<ssize_t>(sizeof(size_bytes))) throw UtilException("Error: Couldn't send the memfd");
+            close(memfd);
+
+            uint64_t received_size = 0;
+            check(rejects([&] { close(receive_memfd(sockets[1], received_size)); }), "memfd: a memfd sent with a forged size was accepted");
+            close(sockets[0]);
+            close(sockets[1]);
+        }
+#else
+        (void)dir;
+#endif
+    }
+
+    // Streams into a shell command that copies its input back out to a file
+    void test_exec(const fs::path& dir) {
+#if !defined(_WIN32)
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path copied = dir / "copied.bin";
+        std::string copy_command = "cat > '" + copied.string() + "'";
+
+        for (uint64_t size : { uint64_t{ 0 }, uint64_t{ 100 }, 3 * STREAM_CHUNK_SIZE + 5, 3 * 1024 * KIB + 1 }) {
+            write_random_file(plain, size);
+            encrypt(plain.string(), sealed.string(), key);
+            check(decrypt_to_command(sealed.string(), copy_command, key) == 0, std::format("exec: {} bytes failed", size));
+            check(read_file(copied) == read_file(plain), std::format("exec: {} bytes came back different", size));
+        }
+
+        check(decrypt_to_command(sealed.string(), "cat > /dev/null; exit 7", key) == 7, "exec: the exit status was lost");
+
+        // The command inherits our stdout, which must carry the plaintext and nothing else
+        fs::path captured = dir / "stdout.bin";
+        const std::pair<std::string, std::function<void()>> formats[]{
+            { "stream", [&] { encrypt(plain.string(), sealed.string(), key); } },
+            { "small", [&] { IoOptions small; small.small_format = true; encrypt(plain.string(), sealed.string(), key, small); } },
+            { "indexed", [&] { encrypt_indexed(plain.string(), sealed.string(), key); } },
+            { "kernel", [&] { encrypt_kernel(plain.string(), sealed.string(), key); } },
+            { "segments", [&] { encrypt_segmented(plain.string(), sealed.string(), key, 1024 * KIB); } },
+        };
+        for (uint64_t size : { uint64_t{ 100 }, 3 * 1024 * KIB + 1 }) {
+            write_random_file(plain, size);
+            for (const auto& [format, seal] : formats) {
+                seal();
+
+                // What the engine prints goes to the real stdout here, as it does in the command-line tool
+                std::streambuf* discarded_buffer = std::cout.rdbuf(stdout_buffer);
+                std::cout.flush();
+                int saved_stdout = dup(STDOUT_FILENO);
+                int capture = open(captured.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                if (saved_stdout < 0 || capture < 0 || dup2(capture, STDOUT_FILENO) < 0) throw UtilException("Error: Couldn't redirect stdout");
+                close(capture);
+
+                int status = -1;
+                try {
+                    status = decrypt_to_command(sealed.string(), "cat", key);
+                    std::cout.flush();
+                }
+                catch (...) {
+                    dup2(saved_stdout, STDOUT_FILENO);
+                    close(saved_stdout);
+                    std::cout.rdbuf(discarded_buffer);
+                    throw;
+                }
+                dup2(saved_stdout, STDOUT_FILENO);
+                close(saved_stdout);
+                std::cout.rdbuf(discarded_buffer);
+
+                check(status == 0 && read_file(captured) == read_file(plain),
+                    std::format("exec {}: stdout held {} bytes instead of the {} plaintext bytes", format, fs::file_size(captured), size));
+            }
+        }
+
+        // The command must be killed rather than see the end of a forged stream
+        fs::path marker = dir / "marker";
+        flip_byte(sealed, fs::file_size(sealed) / 2);
+        check(rejects([&] { decrypt_to_command(sealed.string(), "cat > /dev/null && touch '" + marker.string() + "'", key); }), "exec: a flipped byte was accepted");
+        check(!fs::exists(marker), "exec: the command finished after a failed decryption");
+#else
+        (void)dir;
+#endif
+    }
+
+    // Reads every format back through the seekable istream, in order and at random offsets
+    void test_istream(const fs::path& dir) {
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+
+        const std::pair<std::string, std::function<void()>> formats[]{
+            { "stream", [&] { encrypt(plain.string(), sealed.string(), key); } },
+            { "small", [&] { IoOptions small; small.small_format = true; encrypt(plain.string(), sealed.string(), key, small); } },
+            { "indexed", [&] { encrypt_indexed(plain.string(), sealed.string(), key); } },
+            { "kernel", [&] { encrypt_kernel(plain.string(), sealed.string(), key); } },
+        };
+
+        for (const auto& [format, seal] : formats) {
+            for (uint64_t size : { uint64_t{ 0 }, uint64_t{ 100 }, 64 * KIB, 64 * KIB + 1, 1024 * KIB + 3 * STREAM_CHUNK_SIZE + 5 }) {
+                write_random_file(plain, size);
+                seal();
+                std::string expected = read_file(plain);
+
+                encrypted_ifstream stream(sealed.string(), key, 4);
+                stream.exceptions(std::ios::badbit);
+                check(stream.size() == size, std::format("istream {}: {} bytes reported as {}", format, size, stream.size()));
+
+                std::string contents(std::istreambuf_iterator<char>(stream), {});
+                check(contents == expected, std::format("istream {}: {} bytes read back different", format, size));
+                if (size == 0) continue;
+
+                // Backwards, forwards and across chunk boundaries, with some reads straddling two chunks
+                for (int i = 0; i < 64; ++i) {
+                    uint64_t offset = randombytes_uniform(static_cast<uint32_t>(size));
+                    size_t length = static_cast<size_t>(std::min<uint64_t>(1 + randombytes_uniform(80 * KIB), size - offset));
+
+                    stream.clear();
+                    stream.seekg(static_cast<std::streamoff>(offset));
+                    std::string part(length, '\0');
+                    stream.read(part.data(), static_cast<std::streamsize>(length));
+                    check(stream.gcount() == static_cast<std::streamsize>(length) && part == expected.substr(offset, length),
+                        std::format("istream {}: {} bytes at {} of {} read back different", format, length, offset, size));
+                }
+
+                stream.clear();
+                stream.seekg(0, std::ios::end);
+                check(static_cast<uint64_t>(stream.tellg()) == size, std::format("istream {}: seeking to the end of {} bytes went wrong", format, size));
+            }
+
+            write_random_file(plain, 200 * KIB);
+            seal();
+            flip_byte(sealed, fs::file_size(sealed) / 2);
+            check(rejects([&] {
+                encrypted_ifstream stream(sealed.string(), key);
+                stream.exceptions(std::ios::badbit);
+                std::string contents(std::istreambuf_iterator<char>(stream), {});
+            }), std::format("istream {}: a flipped byte was accepted", format));
+        }
+
+        // The cut-off stream reads fine up to the cut, but must not pass for a complete file
+        write_random_file(plain, 5 * STREAM_CHUNK_SIZE);
+        encrypt(plain.string(), sealed.string(), key);
+        fs::resize_file(sealed, crypto_secretstream_xchacha20poly1305_HEADERBYTES + 4 * STREAM_RECORD_SIZE);
+        check(rejects([&] {
+            encrypted_ifstream stream(sealed.string(), key);
+            stream.exceptions(std::ios::badbit);
+            std::string contents(std::istreambuf_iterator<char>(stream), {});
+        }), "istream: a truncated stream was accepted");
+    }
+
+    // Writes through the encrypting ostream in uneven pieces and decrypts the result with decrypt()
+    void test_ostream(const fs::path& dir) {
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = dir / "opened.dec";
+
+        for (uint64_t size : test_sizes()) {
+            write_random_file(plain, size);
+            std::string expected = read_file(plain);
+
+            {
+                encrypted_ofstream stream(sealed.string(), key);
+                uint64_t written = 0;
+                for (uint64_t piece = 1; written < size; piece = piece * 3 + 1) {
+                    size_t length = static_cast<size_t>(std::min<uint64_t>(piece, size - written));
+                    if (length == 1) stream.put(expected[written]);
+                    else stream.write(expected.data() + written, static_cast<std::streamsize>(length));
+                    written += length;
+                    if (piece % 2 == 0) stream.flush();
+                }
+                check(stream.good(), std::format("ostream: writing {} bytes failed", size));
+
+                // Odd sizes are left for the destructor to finish
+                if (size % 2 == 0) stream.close();
+            }
+
+            check(fs::file_size(sealed) == stream_ciphertext_size(size),
+                std::format("ostream: {} bytes sealed into {} bytes instead of the stream format's {}", size, fs::file_size(sealed), stream_ciphertext_size(size)));
+            decrypt(sealed.string(), opened.string(), key);
+            check(read_file(opened) == expected, std::format("ostream: {} bytes came back different", size));
+        }
+    }
+
+#if defined(__linux__)
+    class StringSink : public AsyncSink {
+    public:
+        task<void> write(const unsigned char* data, size_t size) override {
+            contents.append(reinterpret_cast<const char*>(data), size);
+            co_return;
+        }
+
+        std::string contents;
+    };
+
+    // Feeds `data` into a pipe in pieces, so the reading side keeps suspending
+    task<void> feed_pipe(EventLoop& loop, int fd, std::string data) {
+        AsyncFdSink sink(loop, fd);
+        for (size_t offset = 0; offset < data.size(); offset += 100 * KIB) {
+            size_t length = std::min<size_t>(100 * KIB, data.size() - offset);
+            co_await sink.write(reinterpret_cast<const unsigned char*>(data.data() + offset), length);
+        }
+        close(fd);
+    }
+
+    task<void> encrypt_pipe(EventLoop& loop, int in_fd, int out_fd, CpuExecutor* executor) {
+        AsyncFdSource source(loop, in_fd);
+        AsyncFdSink sink(loop, out_fd);
+        co_await encrypt_async(loop, source, sink, key, executor);
+        close(in_fd);
+        close(out_fd);
+    }
+
+    task<void> decrypt_file(EventLoop& loop, int in_fd, StringSink& sink, CpuExecutor* executor) {
+        AsyncFdSource source(loop, in_fd);
+        co_await decrypt_async(loop, source, sink, key, executor);
+        close(in_fd);
+    }
+#endif
+
+    // Many streams at once on one loop: pipes in, regular files out, then back into memory
+    void test_async(const fs::path& dir) {
+#if defined(__linux__)
+        const std::vector<uint64_t> sizes{ 0, 1, STREAM_CHUNK_SIZE, 16 * STREAM_CHUNK_SIZE, 16 * STREAM_CHUNK_SIZE + 1, 1024 * KIB + 7 };
+        CpuExecutor executor(2);
+
+        for (CpuExecutor* used : { static_cast<CpuExecutor*>(nullptr), &executor }) {
+            std::string mode = used ? "executor" : "inline";
+            std::vector<std::string> plaintexts;
+            std::vector<fs::path> sealed_paths;
+
+            EventLoop loop;
+            for (size_t i = 0; i < 4 * sizes.size(); ++i) {
+                std::string data(static_cast<size_t>(sizes[i % sizes.size()]), '\0');
+                randombytes_buf(data.data(), data.size());
+                plaintexts.push_back(data);
+                sealed_paths.push_back(dir / std::format("sealed_{}.enc", i));
+
+                int pipe_fds[2];
+                if (pipe2(pipe_fds, O_CLOEXEC) != 0) throw UtilException("Error: Couldn't create a pipe");
+                int out_fd = open(sealed_paths.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                loop.spawn(feed_pipe(loop, pipe_fds[1], data));
+                loop.spawn(encrypt_pipe(loop, pipe_fds[0], out_fd, used));
+            }
+            loop.run();
+
+            std::vector<StringSink> sinks(plaintexts.size());
+            for (size_t i = 0; i < plaintexts.size(); ++i) {
+                fs::path opened = dir / "opened.dec";
+                decrypt(sealed_paths[i].string(), opened.string(), key);
+                check(read_file(opened) == plaintexts[i], std::format("async {}: stream {} didn't decrypt with decrypt()", mode, i));
+
+                loop.spawn(decrypt_file(loop, open(sealed_paths[i].c_str(), O_RDONLY | O_CLOEXEC), sinks[i], used));
+            }
+            loop.run();
+            for (size_t i = 0; i < plaintexts.size(); ++i) {
+                check(sinks[i].contents == plaintexts[i], std::format("async {}: stream {} came back different", mode, i));
+            }
+
+            fs::path tampered = sealed_paths.back();
+            flip_byte(tampered, fs::file_size(tampered) / 2);
+            StringSink sink;
+            loop.spawn(decrypt_file(loop, open(tampered.c_str(), O_RDONLY | O_CLOEXEC), sink, used));
+            check(rejects([&] { loop.run(); }), std::format("async {}: a flipped byte was accepted", mode));
+
+            fs::resize_file(tampered, crypto_secretstream_xchacha20poly1305_HEADERBYTES + 16 * STREAM_RECORD_SIZE);
+            loop.spawn(decrypt_file(loop, open(tampered.c_str(), O_RDONLY | O_CLOEXEC), sink, used));
+            check(rejects([&] { loop.run(); }), std::format("async {}: a truncated stream was accepted", mode));
+        }
+#else
+        (void)dir;
+#endif
+    }
+
+    // Every source against every sink, checked against the path-based engine in both directions
+    void test_backends(const fs::path& dir) {
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = dir / "opened.dec";
+
+        using SourceFactory = std::function<void(const fs::path&, const std::function<void(Source&)>&)>;
+        std::vector<std::pair<std::string, SourceFactory>> sources{
+            { "file", [](const fs::path& path, const std::function<void(Source&)>& use) {
+                FileSource source(path.string());
+                use(source);
+            } },
+            { "memory", [](const fs::path& path, const std::function<void(Source&)>& use) {
+                std::string bytes = read_file(path);
+                MemorySource source({ reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size() });
+                use(source);
+            } },
+            // A buffer smaller than a record makes borrow() fall back to copying
+            { "buffered-memory", [](const fs::path& path, const std::function<void(Source&)>& use) {
+                std::string bytes = read_file(path);
+                MemorySource inner({ reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size() });
+                BufferedSource source(inner, 3000);
+                use(source);
+            } },
+#if defined(__linux__)
+            { "mmap", [](const fs::path& path, const std::function<void(Source&)>& use) {
+                MmapSource source(path.string());
+                use(source);
+            } },
+            { "fd-buffered", [](const fs::path& path, const std::function<void(Source&)>& use) {
+                int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                FdSource inner(fd);
+                BufferedSource source(inner);
+                use(source);
+                close(fd);
+            } },
+#endif
+        };
+
+        using SinkFactory = std::function<void(const fs::path&, const std::function<void(Sink&)>&)>;
+        std::vector<std::pair<std::string, SinkFactory>> sinks{
+            { "file", [](const fs::path& path, const std::function<void(Sink&)>& use) {
+                FileSink sink(path.string());
+                use(sink);
+                sink.close();
+            } },
+            { "memory", [](const fs::path& path, const std::function<void(Sink&)>& use) {
+                std::vector<unsigned char> bytes;
+                MemorySink sink(bytes);
+                use(sink);
+                std::ofstream(path, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            } },
+#if defined(__linux__)
+            { "fd-buffered", [](const fs::path& path, const std::function<void(Sink&)>& use) {
+                int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                FdSink inner(fd);
+                BufferedSink sink(inner, 5000);
+                use(sink);
+                sink.close();
+                close(fd);
+            } },
+#endif
+        };
+
+        for (uint64_t size : test_sizes()) {
+            write_random_file(plain, size);
+            std::string expected = read_file(plain);
+
+            for (size_t source_index = 0; source_index < sources.size(); ++source_index) {
+                for (size_t sink_index = 0; sink_index < sinks.size(); ++sink_index) {
+                    // Past the I/O buffer size only one sink per source, to keep the suite quick
+                    if (size > 256 * KIB + 1 && sink_index != source_index % sinks.size()) continue;
+
+                    const auto& [source_name, with_source] = sources[source_index];
+                    const auto& [sink_name, with_sink] = sinks[sink_index];
+                    std::string label = std::format("backends {} -> {}", source_name, sink_name);
+                    try {
+                        with_source(plain, [&](Source& source) {
+                            with_sink(sealed, [&](Sink& sink) { encrypt(source, sink, key); });
+                        });
+                        check(fs::file_size(sealed) == stream_ciphertext_size(size), std::format("{}: {} bytes sealed to the wrong size", label, size));
+                        decrypt(sealed.string(), opened.string(), key);
+                        check(read_file(opened) == expected, std::format("{}: {} bytes didn't decrypt with decrypt()", label, size));
+
+                        // Open a file the path-based engine wrote
+                        encrypt(plain.string(), sealed.string(), key);
+                        with_source(sealed, [&](Source& source) {
+                            with_sink(opened, [&](Sink& sink) { decrypt(source, sink, key); });
+                        });
+                        check(read_file(opened) == expected, std::format("{}: {} bytes came back different", label, size));
+                    }
+                    catch (const std::exception& e) {
+                        check(false, std::format("{}: {} bytes threw `{}`", label, size, e.what()));
+                    }
+                }
+            }
+        }
+
+        // The stream checks still apply: tampering, truncation, and containers that need their file
+        write_random_file(plain, 5 * STREAM_CHUNK_SIZE);
+        auto decrypt_from_memory = [&](const fs::path& path) {
+            std::string bytes = read_file(path);
+            MemorySource source({ reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size() });
+            std::vector<unsigned char> output;
+            MemorySink sink(output);
+            decrypt(source, sink, key);
+        };
+
+        encrypt(plain.string(), sealed.string(), key);
+        flip_byte(sealed, fs::file_size(sealed) / 2);
+        check(rejects([&] { decrypt_from_memory(sealed); }), "backends: a flipped byte was accepted");
+
+        encrypt(plain.string(), sealed.string(), key);
+        fs::resize_file(sealed, crypto_secretstream_xchacha20poly1305_HEADERBYTES + 2 * STREAM_RECORD_SIZE);
+        check(rejects([&] { decrypt_from_memory(sealed); }), "backends: a truncated stream was accepted");
+
+        // Cut inside the header, it's reported as truncated like the path-based engine does
+        for (uint64_t cut : { uint64_t{ 0 }, uint64_t{ 3 }, uint64_t{ crypto_secretstream_xchacha20poly1305_HEADERBYTES - 1 } }) {
+            encrypt(plain.string(), sealed.string(), key);
+            fs::resize_file(sealed, cut);
+            std::string error;
+            try {
+                decrypt_from_memory(sealed);
+            }
+            catch (const AuthError& e) {
+                error = e.what();
+            }
+            catch (const std::exception&) {
+            }
+            check(error == "Decryption failed. The input file is truncated", std::format("backends: a stream cut to {} bytes wasn't reported as truncated", cut));
+        }
+
+        encrypt(plain.string(), sealed.string(), key);
+        std::ofstream(sealed, std::ios::binary | std::ios::app) << "trailing";
+        check(rejects([&] { decrypt_from_memory(sealed); }), "backends: a stream with trailing data was accepted");
+
+        encrypt_indexed(plain.string(), sealed.string(), key);
+        check(rejects([&] { decrypt_from_memory(sealed); }), "backends: an indexed container was read as a stream");
+    }
+
+    // NDJSON with increasing timestamps, a few records without one and, optionally, one far longer than a batch
+    std::string make_log(size_t records, bool long_record) {
+        std::string log;
+        for (size_t i = 0; i < records; ++i) {
+            if (i % 97 == 5) log += std::format("{{\"msg\":\"no time {}\",\"nested\":{{\"ts\":1}}}}\n", i);
+            else log += std::format("{{\"level\":\"info\",\"ts\":{},\"msg\":\"record {} \\\" ts\"}}\n", 1000 + i, i);
+            if (long_record && i == records / 2) log += "{\"ts\":" + std::to_string(1000 + i) + ",\"blob\":\"" + std::string(300 * KIB, 'x') + "\"}\n";
+        }
+        return log;
+    }
+
+    void test_records(const fs::path& dir) {
+        fs::path plain = dir / "plain.ndjson";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = dir / "opened.dec";
+
+        check(parse_record_time("1714564800") == 1714564800, "records: an integer time didn't parse");
+        check(parse_record_time("2024-05-01T12:00:00.250Z") == 1714564800250, "records: an RFC 3339 time didn't parse");
+        check(parse_record_time("2024-05-01T14:00:00+02:00") == 1714564800000, "records: an RFC 3339 offset was ignored");
+        check(!parse_record_time("2024-02-30T00:00:00Z") && !parse_record_time("yesterday"), "records: an invalid time parsed");
+
+        // Byte-exact round trips, including an unterminated last record and one longer than a batch
+        for (const std::string& log : { std::string(), std::string("{\"ts\":1}"), make_log(3000, false), make_log(3000, true) + "{\"ts\":9}" }) {
+            std::ofstream(plain, std::ios::binary | std::ios::trunc) << log;
+            encrypt_record_log(plain.string(), sealed.string(), key);
+            decrypt(sealed.string(), opened.string(), key);
+            check(read_file(opened) == log, std::format("records: a {} byte log came back different", log.size()));
+            decrypt_record_log(sealed.string(), opened.string(), key, 1);
+            check(read_file(opened) == log, std::format("records: a {} byte log came back different on one thread", log.size()));
+        }
+
+        // A time range reads only the batches that can hold it, and matches a plain filter over every record
+        std::string log = make_log(20000, true);
+        std::ofstream(plain, std::ios::binary | std::ios::trunc) << log;
+        encrypt_record_log(plain.string(), sealed.string(), key);
+
+        RecordQuery query;
+        query.from = 5000;
+        query.to = 6000;
+        std::vector<std::string> matched;
+        RecordScanStats stats = scan_record_log(sealed.string(), key, query, [&](std::string_view record) { matched.emplace_back(record); });
+
+        std::vector<std::string> expected;
+        std::istringstream lines(log);
+        for (std::string line; std::getline(lines, line);) {
+            size_t at = line.find("\"ts\":");
+            if (line.rfind("{\"msg\"", 0) == 0 || at == std::string::npos) continue;
+            long long time = std::stoll(line.substr(at + 5));
+            if (time >= 5000 && time <= 6000) expected.push_back(line);
+        }
+        check(matched == expected, std::format("records: the time range matched {} records instead of {}", matched.size(), expected.size()));
+        check(stats.batches_read < stats.batches / 4, std::format("records: the time range read {} of {} batches", stats.batches_read, stats.batches));
+
+        query.filter = [](std::string_view record) { return record.find("record 45") != std::string_view::npos; };
+        query.threads = 3;
+        std::string filtered;
+        for (const std::string& line : expected) {
+            if (line.find("record 45") != std::string::npos) filtered += line + '\n';
+        }
+        extract_records(sealed.string(), opened.string(), key, query);
+        check(!filtered.empty() && read_file(opened) == filtered, "records: extract_records didn't write the filtered records");
+
+        // Tampering with a batch or the index is caught, and so is a swapped key
+        flip_byte(sealed, fs::file_size(sealed) / 2);
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }), "records: a flipped byte in a batch was accepted");
+
+        encrypt_record_log(plain.string(), sealed.string(), key);
+        flip_byte(sealed, fs::file_size(sealed) - 20);
+        check(rejects([&] { scan_record_log(sealed.string(), key, {}, [](std::string_view) {}); }), "records: a flipped byte in the index was accepted");
+
+        encrypt_record_log(plain.string(), sealed.string(), key);
+        unsigned char other_key[sizeof(key)];
+        randombytes_buf(other_key, sizeof(other_key));
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), other_key); }), "records: a record log opened with the wrong key");
+    }
+
+    // Splits files into segments, uploads them to a stand-in bucket directory and puts them back together
+    void test_segments(const fs::path& dir) {
+        constexpr uint64_t SEALED_CHUNK{ 64 * KIB + 16 };
+        constexpr uint64_t SEGMENT_SIZE{ 3 * SEALED_CHUNK + 100 };
+        fs::path plain = dir / "plain.bin";
+        fs::path staged = dir / "staged.enc";
+        fs::path bucket = dir / "bucket";
+        fs::path manifest = bucket / "object.enc";
+        fs::path opened = dir / "opened.dec";
+        fs::create_directories(bucket);
+
+        auto upload = [&] {
+            for (const fs::directory_entry& entry : fs::directory_iterator(bucket)) fs::remove(entry.path());
+            for (const fs::directory_entry& entry : fs::directory_iterator(dir)) {
+                std::string name = entry.path().filename().string();
+                if (name.rfind("staged.enc", 0) == 0) fs::copy_file(entry.path(), bucket / ("object.enc" + name.substr(10)));
+            }
+        };
+        auto stage = [&](uint64_t segment_size) {
+            for (const fs::directory_entry& entry : fs::directory_iterator(dir)) {
+                if (entry.path().filename().string().rfind("staged.enc", 0) == 0) fs::remove(entry.path());
+            }
+            encrypt_segmented(plain.string(), staged.string(), key, segment_size);
+            upload();
+        };
+
+        std::vector<uint64_t> sizes{ 0, 1, 64 * KIB - 1, 64 * KIB, 3 * 64 * KIB, 3 * 64 * KIB + 1, 6 * 64 * KIB, 1024 * KIB + 7 };
+        for (uint64_t size : sizes) {
+            write_random_file(plain, size);
+            stage(SEGMENT_SIZE);
+
+            // Every segment but the last holds the same number of whole chunks and stays within the limit
+            uint64_t chunks = (size + 64 * KIB - 1) / (64 * KIB);
+            uint64_t segments = (chunks + 2) / 3;
+            for (uint64_t segment = 0; segment < segments; ++segment) {
+                fs::path path = segment_path(manifest.string(), segment);
+                check(fs::exists(path) && fs::file_size(path) <= SEGMENT_SIZE, std::format("segments: segment {} of a {} byte file is missing or too large", segment, size));
+                if (segment + 1 < segments) check(fs::file_size(path) == 3 * SEALED_CHUNK, std::format("segments: segment {} of a {} byte file isn't full", segment, size));
+            }
+            check(!fs::exists(segment_path(manifest.string(), segments)), std::format("segments: a {} byte file wrote too many segments", size));
+
+            decrypt(manifest.string(), opened.string(), key);
+            check(read_file(opened) == read_file(plain), std::format("segments: a {} byte file came back different", size));
+            decrypt_segmented(manifest.string(), opened.string(), key, 1);
+            check(read_file(opened) == read_file(plain), std::format("segments: a {} byte file came back different on one thread", size));
+
+            auto reader = open_chunk_reader(manifest.string(), key);
+            std::string read_back;
+            std::vector<unsigned char> chunk(reader->chunk_size());
+            for (uint64_t index = reader->chunk_count(); index-- > 0;) {
+                size_t length = reader->read_chunk(index, chunk.data());
+                read_back.insert(0, reinterpret_cast<const char*>(chunk.data()), length);
+            }
+            check(read_back == read_file(plain), std::format("segments: a {} byte file read back out of order came back different", size));
+
+#if !defined(_WIN32)
+            // A pipe can't be sized up front or written out of order, so the segments go to it in sequence
+            fs::path copied = dir / "copied.bin";
+            check(decrypt_to_command(manifest.string(), "cat > '" + copied.string() + "'", key) == 0, std::format("segments: exec of a {} byte file failed", size));
+            check(read_file(copied) == read_file(plain), std::format("segments: a {} byte file came back different through exec", size));
+#endif
+        }
+
+        check(rejects([&] { encrypt_segmented(plain.string(), staged.string(), key, SEALED_CHUNK - 1); }), "segments: a segment size smaller than a chunk was accepted");
+
+        // A missing, truncated, extended or out-of-place segment is caught, and so is a tampered manifest
+        write_random_file(plain, 1024 * KIB + 7);
+        stage(SEGMENT_SIZE);
+        fs::remove(segment_path(manifest.string(), 2));
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: a missing segment was accepted");
+
+        upload();
+        fs::resize_file(segment_path(manifest.string(), 4), fs::file_size(segment_path(manifest.string(), 4)) - 1);
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: a truncated segment was accepted");
+
+        upload();
+        std::ofstream(segment_path(manifest.string(), 1), std::ios::binary | std::ios::app) << "trailing";
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: a segment with trailing data was accepted");
+
+        upload();
+        fs::rename(segment_path(manifest.string(), 0), dir / "swap");
+        fs::rename(segment_path(manifest.string(), 1), segment_path(manifest.string(), 0));
+        fs::rename(dir / "swap", segment_path(manifest.string(), 1));
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: swapped segments were accepted");
+
+        upload();
+        flip_byte(segment_path(manifest.string(), 3), 5);
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: a flipped byte in a segment was accepted");
+
+#if !defined(_WIN32)
+        fs::path marker = dir / "marker";
+        check(rejects([&] { decrypt_to_command(manifest.string(), "cat > /dev/null && touch '" + marker.string() + "'", key); }), "segments: exec accepted a flipped byte");
+        check(!fs::exists(marker), "segments: the command finished after a failed decryption");
+#endif
+
+        upload();
+        flip_byte(manifest, 50);
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: a flipped byte in the manifest was accepted");
+
+        // Segments from another upload of the same file don't fit this manifest
+        upload();
+        fs::path other = dir / "other.enc";
+        encrypt_segmented(plain.string(), other.string(), key, SEGMENT_SIZE);
+        fs::copy_file(segment_path(other.string(), 2), segment_path(manifest.string(), 2), fs::copy_options::overwrite_existing);
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), key); }), "segments: a segment from another file was accepted");
+
+        upload();
+        unsigned char other_key[sizeof(key)];
+        randombytes_buf(other_key, sizeof(other_key));
+        check(rejects([&] { decrypt(manifest.string(), opened.string(), other_key); }), "segments: a manifest opened with the wrong key");
+        check(rejects([&] {
+            FileSource source(manifest.string());
+            std::vector<unsigned char> output;
+            MemorySink sink(output);
+            decrypt(source, sink, key);
+        }), "segments: a manifest was read as a stream");
+    }
+
+    // With huge pages on, the buffers the engine actually uses, all below 2 MiB, come from huge-page arenas
+    void test_pool(const fs::path& dir) {
+#if defined(__linux__)
+        constexpr uintptr_t HUGE_PAGE{ 2 * 1024 * 1024 };
+        BufferPoolOptions options;
+        options.huge_pages = true;
+        BufferPool::instance().configure(options);
+
+        {
+            PooledBuffer record = BufferPool::instance().acquire(STREAM_RECORD_SIZE);
+            PooledBuffer io = BufferPool::instance().acquire(256 * KIB);
+            PooledBuffer direct = BufferPool::instance().acquire(1024 * KIB);
+            check(BufferPool::instance().stats().huge_page_bytes >= HUGE_PAGE, "pool: no huge pages were mapped for buffers below 2 MiB");
+
+            // Carved from one aligned arena, and each block sits within it
+            uintptr_t arena = reinterpret_cast<uintptr_t>(io.data()) & ~(HUGE_PAGE - 1);
+            for (const PooledBuffer* buffer : { &record, &io, &direct }) {
+                uintptr_t start = reinterpret_cast<uintptr_t>(buffer->data());
+                check((start & ~(HUGE_PAGE - 1)) == arena && ((start + buffer->size() - 1) & ~(HUGE_PAGE - 1)) == arena,
+                    std::format("pool: a {} byte buffer isn't in the huge-page arena", buffer->size()));
+                std::memset(buffer->data(), 0xAB, buffer->size());
+            }
+        }
+
+        // Released buffers are wiped before the next holder gets them
+        {
+            PooledBuffer io = BufferPool::instance().acquire(256 * KIB);
+            check(std::all_of(io.data(), io.data() + io.size(), [](unsigned char c) { return c == 0; }), "pool: a reused buffer still held its last holder's bytes");
+        }
+
+        // Carved buffers are reused, and the engine round-trips through them
+        uint64_t mapped = BufferPool::instance().stats().huge_page_bytes;
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = dir / "opened.dec";
+        write_random_file(plain, 3 * 1024 * KIB + 1);
+        encrypt(plain.string(), sealed.string(), key);
+        decrypt(sealed.string(), opened.string(), key);
+        check(read_file(opened) == read_file(plain), "pool: a file came back different with huge pages");
+        check(BufferPool::instance().stats().allocations_avoided > 0, "pool: no buffer was reused");
+        check(BufferPool::instance().stats().huge_page_bytes <= mapped + 4 * HUGE_PAGE, "pool: the arenas kept growing");
+
+        BufferPool::instance().configure({});
+#else
+        (void)dir;
+#endif
+    }
+
+    // Checks the digests taken while encrypting against digests of the finished file, including parts
+    // that end on a chunk boundary and outputs smaller than one part
+    void test_digests(const fs::path& dir) {
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+
+        auto sha256_hex = [](std::string_view bytes) {
+            unsigned char digest[crypto_hash_sha256_BYTES];
+            crypto_hash_sha256(digest, reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+            char hex[2 * crypto_hash_sha256_BYTES + 1];
+            sodium_bin2hex(hex, sizeof(hex), digest, sizeof(digest));
+            return std::string(hex);
+        };
+
+        const uint64_t record = STREAM_RECORD_SIZE;
+        for (uint64_t part_size : { uint64_t{ 0 }, uint64_t{ 1000 }, record, 1024 * KIB, 7 * record + 3 }) {
+            for (uint64_t size : { uint64_t{ 0 }, uint64_t{ 100 }, STREAM_CHUNK_SIZE - 1, 5 * STREAM_CHUNK_SIZE, 2 * 1024 * KIB + 9 }) {
+                write_random_file(plain, size);
+                IoOptions options;
+                options.digest_part_size = part_size;
+                encrypt(plain.string(), sealed.string(), key, options);
+
+                std::string ciphertext = read_file(sealed);
+                std::string manifest = read_file(digest_manifest_path(sealed.string()));
+                std::string what = std::format("digests: {} byte file in {} byte parts", size, part_size);
+
+                std::string expected = std::format("\"file\": \"sealed.enc\",\n  \"size\": {},\n  \"sha256\": \"{}\",\n  \"part_size\": {},",
+                    ciphertext.size(), sha256_hex(ciphertext), part_size);
+                check(manifest.find(expected) != std::string::npos, what + " has the wrong whole-file digest");
+
+                uint64_t parts = part_size == 0 ? 0 : std::max<uint64_t>(1, (ciphertext.size() + part_size - 1) / part_size);
+                for (uint64_t part = 0; part < parts; ++part) {
+                    uint64_t offset = part * part_size;
+                    uint64_t length = std::min<uint64_t>(part_size, ciphertext.size() - offset);
+                    std::string entry = std::format("{{ \"part\": {}, \"offset\": {}, \"size\": {}, \"sha256\": \"{}\" }}",
+                        part + 1, offset, length, sha256_hex(std::string_view(ciphertext).substr(offset, length)));
+                    check(manifest.find(entry) != std::string::npos, std::format("{} has the wrong digest for part {}", what, part + 1));
+                }
+                check(manifest.find(std::format("\"part\": {},", parts + 1)) == std::string::npos, what + " has too many parts");
+
+                decrypt(sealed.string(), (dir / "opened.dec").string(), key);
+                check(read_file(dir / "opened.dec") == read_file(plain), what + " didn't round-trip");
+            }
+        }
+
+        // Without the option nothing is written next to the output
+        fs::remove(digest_manifest_path(sealed.string()));
+        encrypt(plain.string(), sealed.string(), key);
+        check(!fs::exists(digest_manifest_path(sealed.string())), "digests: a manifest was written without being asked for");
+
+        // Every padding case, fed whole and split, and two hashes fed side by side from different offsets
+        std::vector<unsigned char> message(300);
+        randombytes_buf(message.data(), message.size());
+        for (size_t length = 0; length <= message.size(); ++length) {
+            Sha256 reference;
+            crypto_hash_sha256(reference.data(), message.data(), length);
+            Sha256Hash whole_hash, split_hash, both_first, both_second;
+            whole_hash.update(std::span(message).first(length));
+            split_hash.update(std::span(message).first(length / 3));
+            split_hash.update(std::span(message).subspan(length / 3, length - length / 3));
+            both_first.update(std::span(message).first(length % 64));
+            both_second.update(std::span(message).first(length % 64));
+            Sha256Hash::update_both(both_first, both_second, std::span(message).subspan(length % 64, length - length % 64));
+            check(whole_hash.finish() == reference && split_hash.finish() == reference, std::format("digests: SHA-256 of {} bytes is wrong", length));
+            check(both_first.finish() == reference && both_second.finish() == reference, std::format("digests: SHA-256 side by side of {} bytes is wrong", length));
+        }
+
+        // The digests are the same whatever size the writes come in, whether or not parts start on a block
+        std::vector<unsigned char> bytes(10000);
+        randombytes_buf(bytes.data(), bytes.size());
+        Sha256 expected;
+        crypto_hash_sha256(expected.data(), bytes.data(), bytes.size());
+        for (uint64_t part_size : { uint64_t{ 3000 }, uint64_t{ 1024 } }) {
+            PartDigests whole(part_size), split(part_size);
+            whole.update(bytes);
+            for (size_t at = 0; at < bytes.size(); at += 7) split.update(std::span(bytes).subspan(at, std::min<size_t>(7, bytes.size() - at)));
+            whole.finish();
+            split.finish();
+
+            Sha256 last_part;
+            uint64_t last_offset = (bytes.size() - 1) / part_size * part_size;
+            crypto_hash_sha256(last_part.data(), bytes.data() + last_offset, bytes.size() - last_offset);
+            check(whole.sha256() == expected && split.sha256() == expected, std::format("digests: writes into {} byte parts gave the wrong digest", part_size));
+            check(split.parts().size() == (bytes.size() + part_size - 1) / part_size && split.parts().back().sha256 == last_part &&
+                whole.parts().back().sha256 == last_part, std::format("digests: writes into {} byte parts gave the wrong last part", part_size));
+        }
+    }
+
+    // Searches each format for a needle planted across every chunk and buffer boundary, and checks the result against the plaintext
+    void test_grep(const fs::path& dir) {
+        const std::string needle = "NEEDLE-42";
+        fs::path plain = dir / "plain.txt";
+        fs::path sealed = dir / "sealed.enc";
+
+        // Short lines, then one line much longer than the searcher holds at once
+        std::string text;
+        for (size_t i = 0; text.size() < 3 * 1024 * KIB; ++i) text += std::format("line {} of the log\n", i);
+        text += std::string(2500 * KIB, 'x') + "\n";
+        std::vector<uint64_t> planted;
+        for (uint64_t boundary : { uint64_t{ 0 }, STREAM_CHUNK_SIZE, 64 * KIB, 16 * STREAM_CHUNK_SIZE, 256 * KIB, 1024 * KIB, 3 * 1024 * KIB + 1024 * KIB }) {
+            for (uint64_t shift : { uint64_t{ 0 }, uint64_t{ 4 }, uint64_t{ 8 } }) {
+                if (boundary < shift) continue;
+                uint64_t at = boundary - shift + 64 * KIB * (planted.size() % 2);
+                text.replace(static_cast<size_t>(at), needle.size(), needle);
+                planted.push_back(at);
+            }
+        }
+
+        std::vector<uint64_t> expected_offsets;
+        std::vector<std::string> expected_lines;
+        for (size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + needle.size())) {
+            expected_offsets.push_back(at);
+        }
+        {
+            std::istringstream lines(text);
+            for (std::string line; std::getline(lines, line);) {
+                if (line.find(needle) != std::string::npos && line.size() <= 1024 * KIB) expected_lines.push_back(line);
+            }
+        }
+        std::ofstream(plain, std::ios::binary | std::ios::trunc) << text;
+
+        const std::vector<std::pair<std::string, std::function<void()>>> formats{
+            { "stream", [&] { encrypt(plain.string(), sealed.string(), key); } },
+            { "small", [&] { IoOptions small; small.small_format = true; encrypt(plain.string(), sealed.string(), key, small); } },
+            { "indexed", [&] { encrypt_indexed(plain.string(), sealed.string(), key); } },
+            { "kernel", [&] { encrypt_kernel(plain.string(), sealed.string(), key); } },
+            { "records", [&] { encrypt_record_log(plain.string(), sealed.string(), key); } },
+            { "segments", [&] { encrypt_segmented(plain.string(), sealed.string(), key, 1024 * KIB); } },
+        };
+
+        for (const auto& [name, seal] : formats) {
+            seal();
+
+            GrepOptions options;
+            options.offsets = true;
+            std::vector<uint64_t> offsets;
+            grep_file(sealed.string(), needle, key, options, [&](const GrepMatch& match) {
+                check(match.text == needle, std::format("grep {}: offsets mode reported `{}`", name, match.text));
+                offsets.push_back(match.offset);
+            });
+            check(offsets == expected_offsets, std::format("grep {}: found {} matches instead of {}", name, offsets.size(), expected_offsets.size()));
+
+            // Lines short enough to be held whole come back exactly as they are in the plaintext
+            options.offsets = false;
+            std::vector<std::string> lines;
+            grep_file(sealed.string(), needle, key, options, [&](const GrepMatch& match) {
+                if (match.text.size() <= 1024 * KIB && match.text.find('x') == std::string_view::npos) lines.emplace_back(match.text);
+                check(text.compare(static_cast<size_t>(match.offset), match.text.size(), match.text) == 0,
+                    std::format("grep {}: the line at {} doesn't match the plaintext", name, match.offset));
+            });
+            std::vector<std::string> short_expected;
+            std::copy_if(expected_lines.begin(), expected_lines.end(), std::back_inserter(short_expected), [](const std::string& line) { return line.find('x') == std::string::npos; });
+            check(lines == short_expected, std::format("grep {}: returned {} lines instead of {}", name, lines.size(), short_expected.size()));
+        }
+
+        // A regular expression is matched within lines
+        encrypt(plain.string(), sealed.string(), key);
+        GrepOptions regex_options;
+        regex_options.regex = true;
+        std::vector<std::string> lines;
+        grep_file(sealed.string(), "^line 12[0-9] of", key, regex_options, [&](const GrepMatch& match) { lines.emplace_back(match.text); });
+        check(lines.size() == 10 && lines.front() == "line 120 of the log", std::format("grep regex: returned {} lines", lines.size()));
+        check(rejects([&] { grep_file(sealed.string(), "([", key, regex_options, [](const GrepMatch&) {}); }), "grep: an invalid regex was accepted");
+
+        // Long lines don't exhaust the stack, neither the caller's nor a worker thread's
+        std::ofstream(plain, std::ios::binary | std::ios::trunc) << 'a' << std::string(200 * KIB, 'x') << "b\na" << std::string(900 * KIB, 'y') << "b\n";
+        encrypt(plain.string(), sealed.string(), key);
+        lines.clear();
+        grep_file(sealed.string(), "a.*b", key, regex_options, [&](const GrepMatch& match) { lines.emplace_back(match.text); });
+        check(lines.size() == 2 && lines[0].size() == 200 * KIB + 2 && lines[1].size() == 900 * KIB + 2,
+            std::format("grep regex: returned {} long lines", lines.size()));
+
+        GrepOptions threaded_options = regex_options;
+        threaded_options.threads = 2;
+        std::ostringstream long_out;
+        GrepSummary long_summary = grep_files({ sealed.string(), sealed.string() }, "a.*b", key, threaded_options, long_out);
+        check(long_summary.files_matched == 2 && long_out.str().size() == 2 * (1100 * KIB + 6 + 2 * (sealed.string().size() + 1)),
+            std::format("grep regex: {} files matched on worker threads, with {} bytes of output", long_summary.files_matched, long_out.str().size()));
+
+        // A search resuming mid-line doesn't anchor `^` there
+        regex_options.offsets = true;
+        std::vector<uint64_t> anchored;
+        grep_file(sealed.string(), "^[axy]", key, regex_options, [&](const GrepMatch& match) { anchored.push_back(match.offset); });
+        check(anchored == std::vector<uint64_t>{ 0, 200 * KIB + 3 }, std::format("grep regex: `^` matched {} times, first at {} and last at {}", anchored.size(), anchored.empty() ? 0 : anchored.front(), anchored.empty() ? 0 : anchored.back()));
+        regex_options.offsets = false;
+
+        // Several files at once, one of which fails to authenticate
+        fs::path other = dir / "other.enc";
+        fs::path tampered = dir / "tampered.enc";
+        std::ofstream(plain, std::ios::binary | std::ios::trunc) << "nothing to see\n";
+        encrypt(plain.string(), sealed.string(), key);
+        std::ofstream(plain, std::ios::binary | std::ios::trunc) << "alpha\nNEEDLE-42 beta\n";
+        encrypt(plain.string(), other.string(), key);
+        encrypt(plain.string(), tampered.string(), key);
+        flip_byte(tampered, fs::file_size(tampered) / 2);
+
+        std::ostringstream out;
+        std::ostringstream errors;
+        auto* original_errors = std::cerr.rdbuf(errors.rdbuf());
+        GrepSummary summary = grep_files({ sealed.string(), other.string(), tampered.string() }, needle, key, {}, out);
+        std::cerr.rdbuf(original_errors);
+        check(summary.files_matched == 1 && summary.files_failed == 1,
+            std::format("grep files: {} matched and {} failed", summary.files_matched, summary.files_failed));
+        check(out.str() == other.string() + ":NEEDLE-42 beta\n", std::format("grep files: printed `{}`", out.str()));
+
+        // Packed names are relative, so pack from inside the directory
+        fs::path original_dir = fs::current_path();
+        fs::current_path(dir);
+        pack_files({ plain.filename().string() }, sealed.string(), key);
+        fs::current_path(original_dir);
+        check(rejects([&] { grep_file(sealed.string(), needle, key, {}, [](const GrepMatch&) {}); }), "grep: a pack was searched");
+    }
+
+    void test_tamper(const fs::path& dir) {
+        fs::path plain = dir / "plain.bin";
+        fs::path sealed = dir / "sealed.enc";
+        fs::path opened = (dir / "opened.dec");
+
+        // One size per format: small, stream and indexed
+        IoOptions small;
+        small.small_format = true;
+        for (uint64_t size : { uint64_t{ 100 }, 3 * STREAM_CHUNK_SIZE + 5 }) {
+            write_random_file(plain, size);
+            encrypt(plain.string(), sealed.string(), key, small);
+            uint64_t sealed_size = fs::file_size(sealed);
+
+            for (uint64_t offset : { uint64_t{ 0 }, sealed_size / 2, sealed_size - 1 }) {
+                encrypt(plain.string(), sealed.string(), key, small);
+                flip_byte(sealed, offset);
+                check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }),
+                    std::format("tamper: {} bytes with byte {} flipped was accepted", size, offset));
+            }
+        }
+
+        write_random_file(plain, 200 * KIB);
+        encrypt_indexed(plain.string(), sealed.string(), key);
+        flip_byte(sealed, fs::file_size(sealed) / 2);
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }), "tamper: indexed container with a flipped byte was accepted");
+
+        // Cutting whole records off a stream leaves every remaining record authentic
+        uint64_t size = 5 * STREAM_CHUNK_SIZE;
+        write_random_file(plain, size);
+        encrypt(plain.string(), sealed.string(), key);
+        for (uint64_t records_left : { 0, 1, 4 }) {
+            encrypt(plain.string(), sealed.string(), key);
+            fs::resize_file(sealed, crypto_secretstream_xchacha20poly1305_HEADERBYTES + records_left * STREAM_RECORD_SIZE);
+            check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }),
+                std::format("tamper: stream truncated to {} records was accepted", records_left));
+        }
+
+        encrypt(plain.string(), sealed.string(), key);
+        std::ofstream(sealed, std::ios::binary | std::ios::app) << "trailing";
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), key); }), "tamper: stream with trailing data was accepted");
+
+        // A different key must not open anything
+        encrypt(plain.string(), sealed.string(), key);
+        unsigned char other_key[sizeof(key)];
+        randombytes_buf(other_key, sizeof(other_key));
+        check(rejects([&] { decrypt(sealed.string(), opened.string(), other_key); }), "tamper: stream opened with the wrong key");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const std::pair<std::string, std::function<void(const fs::path&)>> suites[]{
+        { "stream", test_stream }, { "indexed", test_indexed }, { "store", test_store },
+        { "pack", test_pack }, { "kernel", test_kernel }, { "memfd", test_memfd },
+        { "exec", test_exec }, { "istream", test_istream },
+        { "ostream", test_ostream }, { "async", test_async }, { "backends", test_backends },
+        { "records", test_records }, { "segments", test_segments },
+        { "pool", test_pool }, { "digests", test_digests }, { "grep", test_grep },
+        { "tamper", test_tamper },
+    };
+
+    if (argc != 2) {
+        std::cerr << "Usage: roundtrip_test <stream|indexed|store|pack|kernel|memfd|exec|istream|ostream|async|backends|records|segments|pool|digests|grep|tamper>" << std::endl;
+        return 2;
+    }
+
+    if (sodium_init() < 0) {
+        std::cerr << "Error: Couldn't initialize libsodium" << std::endl;
+        return 1;
+    }
+    randombytes_buf(key, sizeof(key));
+
+    for (const auto& [name, run] : suites) {
+        if (name != argv[1]) continue;
+
+        fs::path dir = fs::temp_directory_path() / std::format("cryptoutils_test_{}_{}", name, randombytes_random());
+        fs::create_directories(dir);
+
+        // The engine reports every file it writes; keep the test output to failures
+        std::ostringstream discarded;
+        auto* original_buffer = std::cout.rdbuf(discarded.rdbuf());
+        stdout_buffer = original_buffer;
+
+        try {
+            run(dir);
+        }
+        catch (const std::exception& e) {
+            check(false, std::format("{}: threw `{}`", name, e.what()));
+        }
+
+        std::cout.rdbuf(original_buffer);
+        fs::remove_all(dir);
+
+        if (failures > 0) {
+            std::cerr << std::format("{}: {} checks failed", name, failures) << std::endl;
+            return 1;
+        }
+        std::cout << std::format("{}: all checks passed", name) << std::endl;
+        return 0;
+    }
+
+    std::cerr << std::format("Unknown suite `{}`", argv[1]) << std::endl;
+    return 2;
+}
@@ -0,0 +1,280 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include <new>
+#include <cstdint>
+
+#include "buffer_pool.h"
+#include "aligned_allocator.h"
+
+#include <sodium/utils.h>
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
+
+namespace {
+    constexpr size_t MIN_CLASS_SIZE{ PAGE_ALIGNMENT };
+    constexpr size_t CLASS_COUNT{ 20 }; // 4 KiB up to 2 GiB
+    constexpr size_t HUGE_PAGE_SIZE{ 2 * 1024 * 1024 };
+
+    // Buffers each thread keeps per size class before handing them to the shared lists
+    constexpr size_t THREAD_CACHE_DEPTH{ 4 };
+
+    // Memory kept in the shared lists beyond this is given back to the system
+    constexpr uint64_t SHARED_CACHE_LIMIT{ 256 * 1024 * 1024 };
+
+    constexpr unsigned BLOCK_MAPPED{ 1 };
+    constexpr unsigned BLOCK_LOCKED{ 2 };
+    constexpr unsigned BLOCK_CARVED{ 4 };
+
+    size_t class_index(size_t capacity) {
+        return static_cast<size_t>(std::countr_zero(capacity) - std::countr_zero(MIN_CLASS_SIZE));
+    }
+
+#if defined(__linux__)
+    // Maps `size` bytes, a multiple of the huge page size. Explicit huge pages need a reserved pool
+    // (vm.nr_hugepages); without one, fall back to THP, which only backs ranges aligned to a huge page
+    unsigned char* map_huge_pages(size_t size) {
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED) return static_cast<unsigned char*>(mapping);
+
+        size_t padded = size + HUGE_PAGE_SIZE;
+        mapping = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) throw std::bad_alloc();
+
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~static_cast<uintptr_t>(HUGE_PAGE_SIZE - 1);
+        if (aligned > start) munmap(mapping, aligned - start);
+        if (start + padded > aligned + size) munmap(reinterpret_cast<void*>(aligned + size), start + padded - (aligned + size));
+
+        madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+        return reinterpret_cast<unsigned char*>(aligned);
+    }
+#endif
+}
+
+/*
+ * Per-thread free lists. Buffers still cached when the thread exits go back to the shared lists
+ */
+struct ThreadCache {
+    std::vector<std::vector<unsigned char*>> free_lists{ CLASS_COUNT };
+
+    ~ThreadCache() {
+        for (size_t i = 0; i < free_lists.size(); ++i) {
+            for (unsigned char* block : free_lists[i]) BufferPool::instance().release_shared(block, MIN_CLASS_SIZE << i);
+        }
+    }
+};
+
+namespace {
+    thread_local ThreadCache thread_cache;
+}
+
+PooledBuffer::~PooledBuffer() {
+    if (block) BufferPool::instance().release(block, length, capacity);
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : block(std::exchange(other.block, nullptr)), length(std::exchange(other.length, 0)), capacity(std::exchange(other.capacity, 0)) {
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        if (block) BufferPool::instance().release(block, length, capacity);
+        block = std::exchange(other.block, nullptr);
+        length = std::exchange(other.length, 0);
+        capacity = std::exchange(other.capacity, 0);
+    }
+    return *this;
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::~BufferPool() {
+    for (size_t i = 0; i < shared_free.size(); ++i) {
+        for (unsigned char* block : shared_free[i]) free_block(block, MIN_CLASS_SIZE << i);
+    }
+#if defined(__linux__)
+    for (unsigned char* arena : arenas) munmap(arena, HUGE_PAGE_SIZE);
+#endif
+}
+
+void BufferPool::configure(const BufferPoolOptions& new_options) {
+    std::lock_guard<std::mutex> lock(mutex);
+    options = new_options;
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    size_t capacity = std::bit_ceil(std::max(size, MIN_CLASS_SIZE));
+    size_t index = class_index(capacity);
+
+    auto& local = thread_cache.free_lists[index];
+    if (!local.empty()) {
+        unsigned char* block = local.back();
+        local.pop_back();
+        allocations_avoided.fetch_add(1, std::memory_order_relaxed);
+        return PooledBuffer(block, size, capacity);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index < shared_free.size() && !shared_free[index].empty()) {
+            unsigned char* block = shared_free[index].back();
+            shared_free[index].pop_back();
+            shared_bytes -= capacity;
+            allocations_avoided.fetch_add(1, std::memory_order_relaxed);
+            return PooledBuffer(block, size, capacity);
+        }
+    }
+
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return PooledBuffer(allocate_block(capacity), size, capacity);
+}
+
+void BufferPool::release(unsigned char* block, size_t length, size_t capacity) {
+    // Whatever the holder left in it, often plaintext, mustn't outlive it in the pool or reach the next holder
+    sodium_memzero(block, length);
+
+    auto& local = thread_cache.free_lists[class_index(capacity)];
+    if (local.size() < THREAD_CACHE_DEPTH) {
+        local.push_back(block);
+        return;
+    }
+    release_shared(block, capacity);
+}
+
+void BufferPool::release_shared(unsigned char* block, size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // A block carved from an arena can't be given back on its own, so it always stays in the pool
+        auto it = block_flags.find(block);
+        bool carved = it != block_flags.end() && (it->second & BLOCK_CARVED);
+        if (carved || shared_bytes + capacity <= SHARED_CACHE_LIMIT) {
+            size_t index = class_index(capacity);
+            if (shared_free.size() <= index) shared_free.resize(index + 1);
+            shared_free[index].push_back(block);
+            shared_bytes += capacity;
+            return;
+        }
+    }
+    free_block(block, capacity);
+}
+
+unsigned char* BufferPool::allocate_block(size_t capacity) {
+    BufferPoolOptions current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = options;
+    }
+
+    unsigned char* block = nullptr;
+    unsigned flags = 0;
+
+#if defined(__linux__)
+    if (current.huge_pages && capacity >= HUGE_PAGE_SIZE) {
+        block = map_huge_pages(capacity);
+        flags |= BLOCK_MAPPED;
+        huge_page_bytes.fetch_add(capacity, std::memory_order_relaxed);
+    }
+    else if (current.huge_pages) {
+        // Every I/O and chunk buffer is below the huge page size, so they share arenas of huge pages.
+        // Size classes are powers of two, so aligning each block to its size keeps it within one arena
+        std::lock_guard<std::mutex> lock(mutex);
+        arena_used = (arena_used + capacity - 1) & ~(capacity - 1);
+        if (arenas.empty() || arena_used + capacity > HUGE_PAGE_SIZE) {
+            arenas.push_back(map_huge_pages(HUGE_PAGE_SIZE));
+            arena_used = 0;
+            huge_page_bytes.fetch_add(HUGE_PAGE_SIZE, std::memory_order_relaxed);
+        }
+        block = arenas.back() + arena_used;
+        arena_used += capacity;
+        flags |= BLOCK_CARVED;
+    }
+#endif
+
+    if (!block) block = AlignedAllocator<unsigned char>().allocate(capacity);
+
+    if (current.lock_memory) {
+        if (sodium_mlock(block, capacity) == 0) {
+            flags |= BLOCK_LOCKED;
+            uint64_t pinned = pinned_bytes.fetch_add(capacity, std::memory_order_relaxed) + capacity;
+            uint64_t peak = peak_pinned_bytes.load(std::memory_order_relaxed);
+            while (pinned > peak && !peak_pinned_bytes.compare_exchange_weak(peak, pinned, std::memory_order_relaxed)) {
+            }
+        }
+        else if (!lock_warning_shown.exchange(true)) {
+            std::cerr << "Warning: Couldn't lock buffers in memory (check RLIMIT_MEMLOCK), continuing unlocked" << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    block_flags[block] = flags;
+    return block;
+}
+
+void BufferPool::free_block(unsigned char* block, size_t capacity) {
+    unsigned flags = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = block_flags.find(block);
+        if (it != block_flags.end()) {
+            flags = it->second;
+            block_flags.erase(it);
+        }
+    }
+
+    // sodium_munlock also wipes the buffer; unlocked buffers get the same treatment since they held plaintext
+    if (flags & BLOCK_LOCKED) {
+        sodium_munlock(block, capacity);
+        pinned_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+    }
+    else {
+        sodium_memzero(block, capacity);
+    }
+
+#if defined(__linux__)
+    // Carved blocks go when their arena is unmapped
+    if (flags & BLOCK_CARVED) return;
+    if (flags & BLOCK_MAPPED) {
+        munmap(block, capacity);
+        huge_page_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+        return;
+    }
+#endif
+    AlignedAllocator<unsigned char>().deallocate(block, capacity);
+}
+
+BufferPoolStats BufferPool::stats() const {
+    BufferPoolStats result;
+    result.allocations = allocations.load(std::memory_order_relaxed);
+    result.allocations_avoided = allocations_avoided.load(std::memory_order_relaxed);
+    result.pinned_bytes = pinned_bytes.load(std::memory_order_relaxed);
+    result.peak_pinned_bytes = peak_pinned_bytes.load(std::memory_order_relaxed);
+    result.huge_page_bytes = huge_page_bytes.load(std::memory_order_relaxed);
+    return result;
+}
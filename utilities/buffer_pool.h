@@ -0,0 +1,117 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * @brief How the pool backs its buffers. Set once, before the first buffer is handed out
+ */
+struct BufferPoolOptions {
+    // Try MAP_HUGETLB, then transparent huge pages, to cut TLB misses on the buffers (Linux). Buffers
+    // smaller than a huge page are carved from 2 MiB huge-page arenas, which are kept until exit
+    bool huge_pages{ false };
+
+    // Pin buffers in RAM with sodium_mlock so plaintext never reaches swap
+    bool lock_memory{ false };
+};
+
+struct BufferPoolStats {
+    uint64_t allocations{ 0 };
+    uint64_t allocations_avoided{ 0 };
+    uint64_t pinned_bytes{ 0 };
+    uint64_t peak_pinned_bytes{ 0 };
+    uint64_t huge_page_bytes{ 0 };
+};
+
+class BufferPool;
+
+/*
+ * @brief A page-aligned buffer borrowed from the BufferPool, wiped and returned to it on destruction
+ */
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    ~PooledBuffer();
+
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    unsigned char* data() const { return block; }
+    size_t size() const { return length; }
+
+private:
+    friend class BufferPool;
+    PooledBuffer(unsigned char* block, size_t length, size_t capacity) : block(block), length(length), capacity(capacity) {}
+
+    unsigned char* block{ nullptr };
+    size_t length{ 0 };
+    size_t capacity{ 0 };
+};
+
+/*
+ * @brief Process-wide pool of reusable I/O and chunk buffers. Buffers are grouped in
+ * power-of-two size classes; each thread keeps a few of every class to itself and the
+ * rest are shared behind a mutex, so steady-state runs never go back to the allocator
+ */
+class BufferPool {
+public:
+    static BufferPool& instance();
+
+    void configure(const BufferPoolOptions& options);
+
+    PooledBuffer acquire(size_t size);
+    BufferPoolStats stats() const;
+
+private:
+    friend class PooledBuffer;
+    friend struct ThreadCache;
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    unsigned char* allocate_block(size_t capacity);
+    void free_block(unsigned char* block, size_t capacity);
+    void release(unsigned char* block, size_t length, size_t capacity);
+    void release_shared(unsigned char* block, size_t capacity);
+
+    BufferPoolOptions options;
+    mutable std::mutex mutex;
+    std::vector<std::vector<unsigned char*>> shared_free;
+    uint64_t shared_bytes{ 0 };
+
+    // How each live block was obtained, so it's released the same way even if the options change
+    std::unordered_map<unsigned char*, unsigned> block_flags;
+
+    // Huge-page arenas that buffers below the huge page size are carved from, and the space used in the last
+    std::vector<unsigned char*> arenas;
+    size_t arena_used{ 0 };
+
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> allocations_avoided{ 0 };
+    std::atomic<uint64_t> pinned_bytes{ 0 };
+    std::atomic<uint64_t> peak_pinned_bytes{ 0 };
+    std::atomic<uint64_t> huge_page_bytes{ 0 };
+    std::atomic<bool> lock_warning_shown{ false };
+};
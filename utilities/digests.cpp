@@ -0,0 +1,320 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+#include "digests.h"
+#include "exception.h"
+
+#include <sodium/utils.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRYPTOUTILS_SHA_EXTENSIONS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+#if defined(CRYPTOUTILS_SHA_EXTENSIONS)
+    // libsodium's SHA-256 is portable C, several times slower than the encryption it would sit behind,
+    // so where the CPU has the SHA extensions, Sha256Hash compresses with them instead
+    bool has_sha_extensions() {
+        static const bool supported = [] {
+            unsigned eax, ebx, ecx, edx;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3)) return false;
+            if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+            return (ebx & bit_SHA) != 0;
+        }();
+        return supported;
+    }
+
+    alignas(16) constexpr uint32_t ROUND_CONSTANTS[64]{
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    // Compresses `blocks` 64-byte blocks into `first` and, when given, into `second` as well. The two
+    // share the message schedule, and their round chains are independent, so they run side by side
+    __attribute__((target("sha,sse4.1,ssse3")))
+    void compress_blocks(uint32_t* first, uint32_t* second, const unsigned char* data, size_t blocks) {
+        const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        const size_t lanes = second ? 2 : 1;
+        uint32_t* words[2]{ first, second };
+
+        // The rounds work on the state as ABEF and CDGH
+        __m128i abef[2], cdgh[2];
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[lane])), 0xB1);
+            __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(words[lane] + 4)), 0x1B);
+            abef[lane] = _mm_alignr_epi8(dcba, efgh, 8);
+            cdgh[lane] = _mm_blend_epi16(efgh, dcba, 0xF0);
+        }
+
+        for (; blocks > 0; --blocks, data += 64) {
+            __m128i saved_abef[2]{ abef[0], abef[1] };
+            __m128i saved_cdgh[2]{ cdgh[0], cdgh[1] };
+            __m128i schedule[4];
+
+#pragma GCC unroll 16
+            for (int group = 0; group < 16; ++group) {
+                __m128i message;
+                if (group < 4) {
+                    message = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * group)), byte_swap);
+                }
+                else {
+                    message = _mm_sha256msg1_epu32(schedule[group % 4], schedule[(group + 1) % 4]);
+                    message = _mm_add_epi32(message, _mm_alignr_epi8(schedule[(group + 3) % 4], schedule[(group + 2) % 4], 4));
+                    message = _mm_sha256msg2_epu32(message, schedule[(group + 3) % 4]);
+                }
+                schedule[group % 4] = message;
+
+                __m128i round_input = _mm_add_epi32(message, _mm_load_si128(reinterpret_cast<const __m128i*>(ROUND_CONSTANTS + 4 * group)));
+                __m128i high_input = _mm_shuffle_epi32(round_input, 0x0E);
+                cdgh[0] = _mm_sha256rnds2_epu32(cdgh[0], abef[0], round_input);
+                if (lanes == 2) cdgh[1] = _mm_sha256rnds2_epu32(cdgh[1], abef[1], round_input);
+                abef[0] = _mm_sha256rnds2_epu32(abef[0], cdgh[0], high_input);
+                if (lanes == 2) abef[1] = _mm_sha256rnds2_epu32(abef[1], cdgh[1], high_input);
+            }
+
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                abef[lane] = _mm_add_epi32(abef[lane], saved_abef[lane]);
+                cdgh[lane] = _mm_add_epi32(cdgh[lane], saved_cdgh[lane]);
+            }
+        }
+
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            __m128i feba = _mm_shuffle_epi32(abef[lane], 0x1B);
+            __m128i dchg = _mm_shuffle_epi32(cdgh[lane], 0xB1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(words[lane]), _mm_blend_epi16(feba, dchg, 0xF0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(words[lane] + 4), _mm_alignr_epi8(dchg, feba, 8));
+        }
+    }
+#endif
+
+    constexpr uint32_t INITIAL_WORDS[8]{
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    std::string to_hex(const Sha256& digest) {
+        char hex[2 * crypto_hash_sha256_BYTES + 1];
+        sodium_bin2hex(hex, sizeof(hex), digest.data(), digest.size());
+        return hex;
+    }
+
+    std::string json_escape(const std::string& text) {
+        std::string escaped;
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += static_cast<char>(c);
+            }
+            else if (c < 0x20) escaped += std::format("\\u{:04x}", static_cast<unsigned>(c));
+            else escaped += static_cast<char>(c);
+        }
+        return escaped;
+    }
+}
+
+Sha256Hash::Sha256Hash() {
+#if defined(CRYPTOUTILS_SHA_EXTENSIONS)
+    accelerated = has_sha_extensions();
+#else
+    accelerated = false;
+#endif
+    if (accelerated) std::memcpy(words, INITIAL_WORDS, sizeof(words));
+    else crypto_hash_sha256_init(&sodium_state);
+}
+
+void Sha256Hash::update(std::span<const unsigned char> data) {
+    if (!accelerated) {
+        crypto_hash_sha256_update(&sodium_state, data.data(), data.size());
+        return;
+    }
+#if defined(CRYPTOUTILS_SHA_EXTENSIONS)
+    size_t used = static_cast<size_t>(length % 64);
+    length += data.size();
+
+    // Top up a partly filled block first
+    if (used > 0) {
+        size_t take = std::min(data.size(), 64 - used);
+        std::memcpy(block + used, data.data(), take);
+        data = data.subspan(take);
+        if (used + take < 64) return;
+        compress_blocks(words, nullptr, block, 1);
+    }
+
+    size_t blocks = data.size() / 64;
+    compress_blocks(words, nullptr, data.data(), blocks);
+    data = data.subspan(blocks * 64);
+    std::memcpy(block, data.data(), data.size());
+#endif
+}
+
+void Sha256Hash::update_both(Sha256Hash& first, Sha256Hash& second, std::span<const unsigned char> data) {
+    if (!first.accelerated || !second.accelerated || first.length % 64 != second.length % 64) {
+        first.update(data);
+        second.update(data);
+        return;
+    }
+#if defined(CRYPTOUTILS_SHA_EXTENSIONS)
+    size_t used = static_cast<size_t>(first.length % 64);
+    first.length += data.size();
+    second.length += data.size();
+
+    if (used > 0) {
+        size_t take = std::min(data.size(), 64 - used);
+        std::memcpy(first.block + used, data.data(), take);
+        std::memcpy(second.block + used, data.data(), take);
+        data = data.subspan(take);
+        if (used + take < 64) return;
+        compress_blocks(first.words, nullptr, first.block, 1);
+        compress_blocks(second.words, nullptr, second.block, 1);
+    }
+
+    size_t blocks = data.size() / 64;
+    compress_blocks(first.words, second.words, data.data(), blocks);
+    data = data.subspan(blocks * 64);
+    std::memcpy(first.block, data.data(), data.size());
+    std::memcpy(second.block, data.data(), data.size());
+#endif
+}
+
+Sha256 Sha256Hash::finish() {
+    Sha256 digest;
+    if (!accelerated) {
+        crypto_hash_sha256_final(&sodium_state, digest.data());
+        return digest;
+    }
+#if defined(CRYPTOUTILS_SHA_EXTENSIONS)
+    // Pad with a one bit, zeros, and the length in bits as a big-endian 64-bit number
+    uint64_t bits = length * 8;
+    unsigned char padding[128]{ 0x80 };
+    size_t padding_size = (length % 64 < 56 ? 56 : 120) - length % 64;
+    for (int i = 0; i < 8; ++i) padding[padding_size + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+    update({ padding, padding_size + 8 });
+
+    for (int i = 0; i < 8; ++i) {
+        for (int byte = 0; byte < 4; ++byte) digest[4 * i + byte] = static_cast<unsigned char>(words[i] >> (24 - 8 * byte));
+    }
+#endif
+    return digest;
+}
+
+PartDigests::PartDigests(uint64_t part_size) : part_limit(part_size) {
+}
+
+void PartDigests::update(std::span<const unsigned char> data) {
+    if (finished) throw UtilException("Digests can't be updated once they're finished");
+
+    uint64_t limit = part_limit ? part_limit : std::numeric_limits<uint64_t>::max();
+    while (!data.empty()) {
+        size_t take = static_cast<size_t>(std::min<uint64_t>(data.size(), limit - (total - part_start)));
+        std::span<const unsigned char> slice = data.first(take);
+
+        // With parts starting on block boundaries, the part and the whole stream are hashed in lockstep
+        if (whole_started) Sha256Hash::update_both(whole_state, part_state, slice);
+        else part_state.update(slice);
+
+        total += take;
+        data = data.subspan(take);
+        if (total - part_start == limit) end_part();
+    }
+}
+
+void PartDigests::end_part() {
+    // The whole-stream digest starts out as a copy of the first part's, so a stream that fits in one part
+    // is only hashed once
+    if (!whole_started) {
+        whole_state = part_state;
+        whole_started = true;
+    }
+
+    PartDigest part;
+    part.offset = part_start;
+    part.size = total - part_start;
+    part.sha256 = part_state.finish();
+    finished_parts.push_back(part);
+
+    part_state = Sha256Hash();
+    part_start = total;
+}
+
+void PartDigests::finish() {
+    if (finished) return;
+    finished = true;
+
+    if (whole_started) {
+        if (total > part_start) end_part();
+        whole = whole_state.finish();
+        return;
+    }
+
+    // Nothing crossed a part boundary, so the whole stream is its only part. An empty stream still has one
+    whole = part_state.finish();
+    if (part_limit) finished_parts.push_back({ 0, total, whole });
+}
+
+void PartDigests::write_manifest(const std::string& manifest_path, const std::string& file_name) const {
+    std::string text = "{\n";
+    text += std::format("  \"file\": \"{}\",\n", json_escape(file_name));
+    text += std::format("  \"size\": {},\n", total);
+    text += std::format("  \"sha256\": \"{}\",\n", to_hex(whole));
+    text += std::format("  \"part_size\": {},\n", part_limit);
+    text += "  \"parts\": [";
+    for (size_t i = 0; i < finished_parts.size(); ++i) {
+        const PartDigest& part = finished_parts[i];
+        text += std::format("{}\n    {{ \"part\": {}, \"offset\": {}, \"size\": {}, \"sha256\": \"{}\" }}",
+            i == 0 ? "" : ",", i + 1, part.offset, part.size, to_hex(part.sha256));
+    }
+    text += finished_parts.empty() ? "]\n}\n" : "\n  ]\n}\n";
+
+    // Whatever picks the manifest up never sees it half-written
+    std::string temp_path = manifest_path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) throw FileError(std::format("Error opening digest manifest `{}`", temp_path));
+        out << text;
+        out.flush();
+        if (!out) throw FileError(std::format("Error writing digest manifest `{}`", temp_path));
+    }
+
+    std::error_code rename_error;
+    std::filesystem::rename(temp_path, manifest_path, rename_error);
+    if (rename_error) throw FileError(std::format("Error replacing digest manifest `{}`: {}", manifest_path, rename_error.message()));
+}
+
+void DigestSink::write(std::span<const unsigned char> data) {
+    digests.update(data);
+    inner.write(data);
+}
+
+void DigestSink::close() {
+    inner.close();
+    digests.finish();
+}
\ No newline at end of file
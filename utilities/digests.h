@@ -0,0 +1,114 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <span>
+#include <cstdint>
+
+#include "source_sink.h"
+
+#include <sodium/crypto_hash_sha256.h>
+
+using Sha256 = std::array<unsigned char, crypto_hash_sha256_BYTES>;
+
+/*
+ * @brief Incremental SHA-256. Where the CPU has the SHA extensions, it keeps its own state and
+ * compresses with them; otherwise it wraps libsodium's through its public API
+ */
+class Sha256Hash {
+public:
+    Sha256Hash();
+
+    void update(std::span<const unsigned char> data);
+    Sha256 finish();
+
+    // Hashes `data` into both. When they're at the same offset within a block, the whole blocks of
+    // `data` are scheduled once and the two hashes' rounds run side by side
+    static void update_both(Sha256Hash& first, Sha256Hash& second, std::span<const unsigned char> data);
+
+private:
+    bool accelerated;
+    crypto_hash_sha256_state sodium_state{};
+    uint32_t words[8]{};
+    uint64_t length{ 0 };
+    unsigned char block[64]{};
+};
+
+struct PartDigest {
+    uint64_t offset{ 0 };
+    uint64_t size{ 0 };
+    Sha256 sha256{};
+};
+
+/*
+ * @brief SHA-256 of a byte stream as a whole and of each `part_size` bytes of it, e.g. the parts of
+ * a multipart upload, taken in one pass. A `part_size` of 0 takes the whole-stream digest only
+ */
+class PartDigests {
+public:
+    explicit PartDigests(uint64_t part_size);
+
+    void update(std::span<const unsigned char> data);
+
+    // Finalizes the last part and the whole-stream digest. Nothing can be added afterwards
+    void finish();
+
+    uint64_t size() const { return total; }
+    uint64_t part_size() const { return part_limit; }
+    const std::vector<PartDigest>& parts() const { return finished_parts; }
+    const Sha256& sha256() const { return whole; }
+
+    // Writes the digests as JSON, hex-encoded, replacing `manifest_path` atomically (temp file + rename).
+    // Throws FileError if it can't be written
+    void write_manifest(const std::string& manifest_path, const std::string& file_name) const;
+
+private:
+    void end_part();
+
+    uint64_t part_limit;
+    uint64_t total{ 0 };
+    uint64_t part_start{ 0 };
+    Sha256Hash part_state;
+    Sha256Hash whole_state;
+    bool whole_started{ false };
+    bool finished{ false };
+    std::vector<PartDigest> finished_parts;
+    Sha256 whole{};
+};
+
+/*
+ * @brief Feeds everything written through it to `digests` before passing it on, so the bytes are
+ * hashed while they're still in cache instead of being read back later. close() finishes the digests
+ */
+class DigestSink : public Sink {
+public:
+    DigestSink(Sink& inner, PartDigests& digests) : inner(inner), digests(digests) {}
+
+    void write(std::span<const unsigned char> data) override;
+    void reserve(uint64_t size) override { inner.reserve(size); }
+    void close() override;
+    size_t pending() const override { return inner.pending(); }
+
+private:
+    Sink& inner;
+    PartDigests& digests;
+};
+
+// The sidecar manifest for the digests of `output_path`
+inline std::string digest_manifest_path(const std::string& output_path) { return output_path + ".sha256.json"; }
\ No newline at end of file
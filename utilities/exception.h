@@ -38,6 +38,14 @@ public:
  * @brief Exception class for symbolizing error in the key
  */
 class KeyError : public UtilException {
+public:
+	using UtilException::UtilException;
+};
+
+/*
+ * @brief Exception class for symbolizing data that failed authentication (wrong key or tampered ciphertext)
+ */
+class AuthError : public UtilException {
 public:
 	using UtilException::UtilException;
 };
\ No newline at end of file
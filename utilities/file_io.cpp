@@ -0,0 +1,350 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "file_io.h"
+#include "aligned_allocator.h"
+#include "throttle.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "progress.h"
+#include "metrics.h"
+#include "exception.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+    // Large enough that each syscall moves dozens of 4 KiB chunks
+    constexpr size_t IO_BUFFER_SIZE{ 256 * 1024 };
+
+    // Without the kernel's readahead and write-behind, O_DIRECT needs bigger requests to keep the device busy
+    constexpr size_t DIRECT_BUFFER_SIZE{ 1024 * 1024 };
+
+    // With `drop_cache`, at most about this much of each file is kept in the page cache
+    constexpr uint64_t CACHE_WINDOW_SIZE{ 8 * 1024 * 1024 };
+
+#if defined(_WIN32)
+    int open_for_reading(const std::string& path, bool) { return _open(path.c_str(), _O_RDONLY | _O_BINARY); }
+    int open_for_writing(const std::string& path, bool) { return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE); }
+    bool supports_direct() { return false; }
+    void disable_direct(int) {}
+    long long read_some(int fd, unsigned char* data, size_t size) { return _read(fd, data, static_cast<unsigned int>(size)); }
+    long long write_some(int fd, const unsigned char* data, size_t size) { return _write(fd, data, static_cast<unsigned int>(size)); }
+    bool truncate_to(int fd, uint64_t size) { return _chsize_s(fd, static_cast<long long>(size)) == 0; }
+    void close_fd(int fd) { _close(fd); }
+
+    uint64_t file_size(int fd) {
+        struct _stat64 st;
+        return _fstat64(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    }
+
+    bool preallocate_fd(int, uint64_t) { return false; }
+    void advise(int, uint64_t, uint64_t, int) {}
+#else
+#if defined(O_DIRECT)
+    constexpr int DIRECT_FLAG{ O_DIRECT };
+#else
+    constexpr int DIRECT_FLAG{ 0 };
+#endif
+
+    int open_for_reading(const std::string& path, bool direct) { return ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (direct ? DIRECT_FLAG : 0)); }
+    int open_for_writing(const std::string& path, bool direct) { return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? DIRECT_FLAG : 0), 0666); }
+    bool supports_direct() { return DIRECT_FLAG != 0; }
+
+    void disable_direct(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags != -1) fcntl(fd, F_SETFL, flags & ~DIRECT_FLAG);
+    }
+    long long read_some(int fd, unsigned char* data, size_t size) { return ::read(fd, data, size); }
+    long long write_some(int fd, const unsigned char* data, size_t size) { return ::write(fd, data, size); }
+    bool truncate_to(int fd, uint64_t size) { return ::ftruncate(fd, static_cast<off_t>(size)) == 0; }
+    void close_fd(int fd) { ::close(fd); }
+
+    uint64_t file_size(int fd) {
+        struct stat st;
+        return fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    }
+
+    bool preallocate_fd(int fd, uint64_t size) {
+    #if defined(__linux__)
+        // KEEP_SIZE: an interrupted run leaves a file of its real length, not one padded with zeros
+        return fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0;
+    #else
+        (void)fd;
+        (void)size;
+        return false;
+    #endif
+    }
+
+    void advise(int fd, uint64_t offset, uint64_t length, int advice) {
+    #if defined(__linux__)
+        posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), advice);
+    #else
+        (void)fd;
+        (void)offset;
+        (void)length;
+        (void)advice;
+    #endif
+    }
+#endif
+
+    void warn_no_direct(const std::string& path) {
+        std::cerr << "Warning: `" << path << "` doesn't support O_DIRECT, falling back to buffered I/O" << std::endl;
+    }
+
+    // Opens with O_DIRECT if asked to, retrying without it where the filesystem refuses it (e.g. tmpfs)
+    int open_file(const std::string& path, bool writing, bool& direct) {
+        direct = direct && supports_direct();
+        int fd = writing ? open_for_writing(path, direct) : open_for_reading(path, direct);
+
+        if (fd < 0 && direct && errno == EINVAL) {
+            warn_no_direct(path);
+            direct = false;
+            fd = writing ? open_for_writing(path, false) : open_for_reading(path, false);
+        }
+        return fd;
+    }
+}
+
+InputFile::InputFile(const std::string& path, const IoOptions& options)
+    : path(path), options(options), buffer(BufferPool::instance().acquire(options.direct ? DIRECT_BUFFER_SIZE : IO_BUFFER_SIZE)) {
+    fd = open_file(path, false, this->options.direct);
+    if (fd < 0) throw FileError("Error: Couldn't open input file `" + path + '`');
+
+#if defined(__linux__)
+    if (options.drop_cache) {
+        advise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        advise_window();
+    }
+#endif
+}
+
+InputFile::~InputFile() {
+    close();
+}
+
+bool InputFile::refill() {
+    PerfCounters::Scope perf_scope(options.perf, PerfStage::Read);
+    Trace::Scope trace_scope(options.trace, "read syscalls");
+
+    buffer_pos = 0;
+    buffer_end = 0;
+
+    // Fill the whole buffer unless the file ends first; reads may return short on pipes
+    while (buffer_end < buffer.size() && !file_ended) {
+        if (options.throttle) options.throttle->before_read(buffer.size() - buffer_end);
+
+        long long result = read_some(fd, buffer.data() + buffer_end, buffer.size() - buffer_end);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+
+            // Some filesystems accept O_DIRECT on open and only refuse it on the first read
+            if (errno == EINVAL && options.direct) {
+                warn_no_direct(path);
+                options.direct = false;
+                disable_direct(fd);
+                continue;
+            }
+
+            throw FileError("Error: Couldn't read input file `" + path + "`: " + std::strerror(errno));
+        }
+        if (result == 0) file_ended = true;
+        buffer_end += static_cast<size_t>(result);
+    }
+
+    file_offset += buffer_end;
+    if (options.drop_cache) advise_window();
+    if (options.progress) options.progress->add(buffer_end);
+    if (options.metrics) options.metrics->add_read(buffer_end);
+
+    return buffer_end > 0;
+}
+
+void InputFile::advise_window() {
+#if defined(__linux__)
+    // Re-armed every half window, so readahead always stays between half and one window ahead
+    if (file_offset < advised_up_to) return;
+
+    // Everything before `file_offset` has been copied into our buffer already
+    if (file_offset > 0) advise(fd, 0, file_offset, POSIX_FADV_DONTNEED);
+    advise(fd, file_offset, CACHE_WINDOW_SIZE, POSIX_FADV_WILLNEED);
+    advised_up_to = file_offset + CACHE_WINDOW_SIZE / 2;
+#endif
+}
+
+size_t InputFile::read(unsigned char* data, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        if (buffer_pos == buffer_end && !refill()) {
+            reached_eof = true;
+            break;
+        }
+
+        size_t count = std::min(size - total, buffer_end - buffer_pos);
+        std::memcpy(data + total, buffer.data() + buffer_pos, count);
+        buffer_pos += count;
+        total += count;
+    }
+    return total;
+}
+
+uint64_t InputFile::size() const {
+    return file_size(fd);
+}
+
+void InputFile::close() {
+    if (fd < 0) return;
+
+#if defined(__linux__)
+    // Drop the tail of the file and whatever readahead was still pending
+    if (options.drop_cache) advise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+    close_fd(fd);
+    fd = -1;
+}
+
+OutputFile::OutputFile(const std::string& path, const IoOptions& options)
+    : path(path), options(options), buffer(BufferPool::instance().acquire(options.direct ? DIRECT_BUFFER_SIZE : IO_BUFFER_SIZE)) {
+    fd = open_file(path, true, this->options.direct);
+    if (fd < 0) throw FileError("Error: Couldn't open output file `" + path + '`');
+}
+
+OutputFile::~OutputFile() {
+    // Like `std::ofstream`, flush what we can, but never throw from a destructor
+    if (fd < 0) return;
+    try {
+        finish_direct();
+        flush();
+        if (preallocated) truncate_to(fd, written);
+    }
+    catch (...) {
+    }
+    close_fd(fd);
+}
+
+void OutputFile::flush() {
+    PerfCounters::Scope perf_scope(options.perf, PerfStage::Write);
+    Trace::Scope trace_scope(options.trace, "write syscalls");
+
+    size_t offset = 0;
+    while (offset < buffered) {
+        if (options.throttle) options.throttle->before_write(buffered - offset);
+
+        long long result = write_some(fd, buffer.data() + offset, buffered - offset);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+
+            if (errno == EINVAL && options.direct) {
+                warn_no_direct(path);
+                options.direct = false;
+                disable_direct(fd);
+                continue;
+            }
+
+            throw FileError("Error: Couldn't write output file `" + path + "`: " + std::strerror(errno));
+        }
+        offset += static_cast<size_t>(result);
+    }
+    written += buffered;
+    if (options.metrics) options.metrics->add_written(buffered);
+    buffered = 0;
+
+    if (options.drop_cache) write_back_window(false);
+}
+
+void OutputFile::write_back_window(bool final) {
+#if defined(__linux__)
+    if (!final && written - window_start < CACHE_WINDOW_SIZE) return;
+
+    // Wait for everything before the current window, which has had a whole window's worth
+    // of time to reach the disk, then drop it. This bounds dirty pages to about two windows
+    // and keeps the kernel from stalling us on a huge writeback burst later
+    if (window_start > 0) {
+        sync_file_range(fd, 0, static_cast<off_t>(window_start), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        advise(fd, 0, window_start, POSIX_FADV_DONTNEED);
+    }
+
+    if (final) {
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        advise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        return;
+    }
+
+    // Start writeback of the window just filled without waiting for it
+    sync_file_range(fd, static_cast<off_t>(window_start), static_cast<off_t>(written - window_start), SYNC_FILE_RANGE_WRITE);
+    window_start = written;
+#else
+    (void)final;
+#endif
+}
+
+void OutputFile::write(const unsigned char* data, size_t size) {
+    while (size > 0) {
+        size_t count = std::min(size, buffer.size() - buffered);
+        std::memcpy(buffer.data() + buffered, data, count);
+        buffered += count;
+        data += count;
+        size -= count;
+
+        if (buffered == buffer.size()) flush();
+    }
+}
+
+void OutputFile::preallocate(uint64_t size) {
+    if (!options.preallocate || size == 0) return;
+    preallocated = preallocate_fd(fd, size) || preallocated;
+}
+
+void OutputFile::finish_direct() {
+    // Full buffers are always written at aligned offsets; only the tail of the file can be
+    // unaligned, so it goes out through the page cache
+    if (options.direct && buffered % PAGE_ALIGNMENT != 0) {
+        disable_direct(fd);
+        options.direct = false;
+    }
+}
+
+void OutputFile::close() {
+    if (fd < 0) return;
+
+    finish_direct();
+    flush();
+
+    // Give back any reserved blocks past the data actually written
+    if (preallocated && !truncate_to(fd, written)) {
+        throw FileError("Error: Couldn't truncate output file `" + path + "`: " + std::strerror(errno));
+    }
+
+    if (options.drop_cache) write_back_window(true);
+
+    close_fd(fd);
+    fd = -1;
+}
@@ -0,0 +1,153 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "buffer_pool.h"
+
+class Throttle;
+class PerfCounters;
+class Trace;
+class Progress;
+class Metrics;
+
+/*
+ * @brief Knobs for how the engine talks to the filesystem
+ */
+struct IoOptions {
+    // Reserve the whole output up front when its final size is known, so the
+    // filesystem can lay it out in a few large extents
+    bool preallocate{ true };
+
+    // Keep the page-cache footprint bounded: read ahead of the input and drop it once consumed,
+    // push the output to disk behind a sliding window and drop it once written (Linux only)
+    bool drop_cache{ false };
+
+    // Bypass the page cache entirely with O_DIRECT and page-aligned buffers. Falls back to
+    // buffered I/O, with a warning, on filesystems that refuse it
+    bool direct{ false };
+
+    // Paces every read and write syscall against shared bandwidth and IOPS limits when set
+    Throttle* throttle{ nullptr };
+
+    // Attributes read and write syscalls to their stages when set
+    PerfCounters* perf{ nullptr };
+
+    // Records read and write syscalls on the timeline when set
+    Trace* trace{ nullptr };
+
+    // Counts bytes read for progress reporting when set
+    Progress* progress{ nullptr };
+
+    // Counts bytes read and written for the metrics file when set
+    Metrics* metrics{ nullptr };
+
+    // Print a line for every file written. Off when the output is a pipe or memfd that the caller reports
+    // itself, so nothing lands on a stdout the reader of the plaintext may share
+    bool report{ true };
+
+    // Have encrypt() seal inputs under 4 KiB in the one-shot small format instead of the stream format.
+    // Only the path-based readers open it, and it is skipped whenever direct, drop_cache, throttle, perf or
+    // trace is set, since its single read and write go around them
+    bool small_format{ false };
+
+    // When set, encrypt() takes SHA-256 digests of the ciphertext as it writes it, whole and in parts
+    // of this many bytes (0 for whole only), and saves them next to the output (see digest_manifest_path())
+    std::optional<uint64_t> digest_part_size;
+};
+
+
+/*
+ * @brief Sequential, buffered reader over a file descriptor
+ */
+class InputFile {
+public:
+    explicit InputFile(const std::string& path, const IoOptions& options = {});
+    ~InputFile();
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    // Reads up to `size` bytes; returns fewer only at the end of the file
+    size_t read(unsigned char* data, size_t size);
+
+    // True once a read came up short, like `std::ifstream::eof()`
+    bool eof() const { return reached_eof; }
+
+    // Bytes read ahead from the file that haven't been consumed yet
+    size_t buffered() const { return buffer_end - buffer_pos; }
+
+    uint64_t size() const;
+    void close();
+
+private:
+    bool refill();
+    void advise_window();
+
+    int fd{ -1 };
+    std::string path;
+    IoOptions options;
+    PooledBuffer buffer;
+    size_t buffer_pos{ 0 };
+    size_t buffer_end{ 0 };
+    bool reached_eof{ false };
+    bool file_ended{ false };
+    uint64_t file_offset{ 0 };
+    uint64_t advised_up_to{ 0 };
+};
+
+/*
+ * @brief Sequential, buffered writer over a file descriptor. The file is truncated on open,
+ * and on close it's cut to exactly the bytes written, dropping any unused preallocation
+ */
+class OutputFile {
+public:
+    explicit OutputFile(const std::string& path, const IoOptions& options = {});
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    void write(const unsigned char* data, size_t size);
+
+    // Best effort: reserves `size` bytes without changing the file size. A no-op when disabled or unsupported
+    void preallocate(uint64_t size);
+
+    // Bytes accepted by write() that haven't reached the file yet
+    size_t pending() const { return buffered; }
+
+    // Flushes, trims the file to the bytes written and closes it. Throws FileError on failure
+    void close();
+
+private:
+    void flush();
+    void finish_direct();
+    void write_back_window(bool final);
+
+    int fd{ -1 };
+    std::string path;
+    IoOptions options;
+    PooledBuffer buffer;
+    size_t buffered{ 0 };
+    uint64_t written{ 0 };
+    uint64_t window_start{ 0 };
+    bool preallocated{ false };
+};
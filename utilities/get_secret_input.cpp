@@ -34,15 +34,15 @@ std::string get_secret_input() {
             if (ch == '\b') { // Handle backspace
                 if (!secret.empty()) {
                     secret.pop_back();
-                    std::cout << "\b \b"; // Erase the character from the console
+                    std::cerr << "\b \b"; // Erase the character from the console
                 }
             }
             else {
                 secret.push_back(ch);
-                std::cout << '*';
+                std::cerr << '*';
             }
         }
-        std::cout << std::endl;
+        std::cerr << std::endl;
 
         SetConsoleMode(h_stdin, mode); // Restore original mode
     #else
@@ -55,7 +55,7 @@ std::string get_secret_input() {
         std::getline(std::cin, secret);
 
         tcsetattr(STDIN_FILENO, TCSANOW, &oldt); // Restore original settings
-        std::cout << std::endl;
+        std::cerr << std::endl;
     #endif
     
     return secret;
@@ -0,0 +1,43 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+
+#include "get_secret_key.h"
+#include "get_secret_input.h"
+#include "exception.h"
+
+#include <sodium/utils.h>
+
+void get_secret_key(unsigned char (&key)[crypto_secretstream_xchacha20poly1305_KEYBYTES]) {
+    // Ask the user for the secret key. On stderr, because stdout can be the plaintext (--exec)
+    std::cerr << "Enter the secret key (hex): ";
+    std::string key_hex = get_secret_input();
+
+    if (key_hex.empty()) throw KeyError("No key was entered");
+
+    // Convert the hex key from the user's input into raw bytes
+    size_t key_len = 0;
+    int result = sodium_hex2bin(key, sizeof(key), key_hex.c_str(), key_hex.length(), NULL, &key_len, NULL);
+    sodium_memzero(key_hex.data(), key_hex.size());
+
+    // A short key would leave the tail of `key` uninitialized
+    if (result != 0 || key_len != sizeof(key)) {
+        throw KeyError("Invalid hex key provided");
+    }
+}
@@ -0,0 +1,25 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+
+/*
+ * @brief Prompts for the secret key (hex) and decodes it into `key`
+ * @throws KeyError if no key was entered or it isn't exactly 32 bytes of hex
+ */
+void get_secret_key(unsigned char (&key)[crypto_secretstream_xchacha20poly1305_KEYBYTES]);
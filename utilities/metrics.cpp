@@ -0,0 +1,172 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+
+#include "metrics.h"
+#include "exception.h"
+
+Metrics::Metrics(const std::string& path, std::chrono::seconds interval) : path(path), interval(interval) {
+    started = std::chrono::steady_clock::now();
+    started_wall = std::chrono::system_clock::now();
+    file_started = started;
+
+    // Publish right away, so a run that hangs before its first file still shows up as running
+    write_file(true);
+
+    timer = std::thread([this] { run(); });
+}
+
+Metrics::~Metrics() {
+    try {
+        finish();
+    }
+    catch (...) {}
+}
+
+void Metrics::begin_file() {
+    std::lock_guard<std::mutex> lock(mutex);
+    file_read_start = bytes_read.load(std::memory_order_relaxed);
+    file_written_start = bytes_written.load(std::memory_order_relaxed);
+    file_started = std::chrono::steady_clock::now();
+}
+
+void Metrics::end_file(bool ok, bool auth_failure, uint64_t input_size, uint64_t output_size) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - file_started).count();
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT && seconds > DURATION_BUCKETS[bucket]) ++bucket;
+    ++duration_counts[bucket];
+    duration_sum += seconds;
+
+    if (ok) {
+        ++files_ok;
+
+        uint64_t read_now = bytes_read.load(std::memory_order_relaxed);
+        if (read_now - file_read_start < input_size) bytes_read.fetch_add(input_size - (read_now - file_read_start), std::memory_order_relaxed);
+        uint64_t written_now = bytes_written.load(std::memory_order_relaxed);
+        if (written_now - file_written_start < output_size) bytes_written.fetch_add(output_size - (written_now - file_written_start), std::memory_order_relaxed);
+    }
+    else {
+        ++files_failed;
+    }
+    if (auth_failure) ++auth_failures;
+}
+
+void Metrics::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) return;
+        finished = true;
+        stopping = true;
+    }
+    wake.notify_all();
+    timer.join();
+
+    write_file(false);
+}
+
+void Metrics::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+        try {
+            write_file(true);
+        }
+        catch (const UtilException&) {
+            // A full disk shouldn't kill the run; the final write reports the error
+        }
+        lock.lock();
+    }
+}
+
+std::string Metrics::render(bool running) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t read = bytes_read.load(std::memory_order_relaxed);
+    uint64_t written = bytes_written.load(std::memory_order_relaxed);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double start_time = std::chrono::duration<double>(started_wall.time_since_epoch()).count();
+
+    std::string text;
+    text += "# HELP cryptoutils_bytes_read_total Bytes read from input files.\n";
+    text += "# TYPE cryptoutils_bytes_read_total counter\n";
+    text += std::format("cryptoutils_bytes_read_total {}\n", read);
+    text += "# HELP cryptoutils_bytes_written_total Bytes written to output files.\n";
+    text += "# TYPE cryptoutils_bytes_written_total counter\n";
+    text += std::format("cryptoutils_bytes_written_total {}\n", written);
+
+    text += "# HELP cryptoutils_files_total Files processed, by result.\n";
+    text += "# TYPE cryptoutils_files_total counter\n";
+    text += std::format("cryptoutils_files_total{{result=\"ok\"}} {}\n", files_ok);
+    text += std::format("cryptoutils_files_total{{result=\"failed\"}} {}\n", files_failed);
+
+    text += "# HELP cryptoutils_auth_failures_total Files that failed authentication (wrong key or tampered data).\n";
+    text += "# TYPE cryptoutils_auth_failures_total counter\n";
+    text += std::format("cryptoutils_auth_failures_total {}\n", auth_failures);
+
+    text += "# HELP cryptoutils_file_duration_seconds Time taken per file.\n";
+    text += "# TYPE cryptoutils_file_duration_seconds histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        cumulative += duration_counts[i];
+        text += std::format("cryptoutils_file_duration_seconds_bucket{{le=\"{}\"}} {}\n", DURATION_BUCKETS[i], cumulative);
+    }
+    cumulative += duration_counts[BUCKET_COUNT];
+    text += std::format("cryptoutils_file_duration_seconds_bucket{{le=\"+Inf\"}} {}\n", cumulative);
+    text += std::format("cryptoutils_file_duration_seconds_sum {:.6f}\n", duration_sum);
+    text += std::format("cryptoutils_file_duration_seconds_count {}\n", cumulative);
+
+    text += "# HELP cryptoutils_throughput_bytes_per_second Average read throughput of the run.\n";
+    text += "# TYPE cryptoutils_throughput_bytes_per_second gauge\n";
+    text += std::format("cryptoutils_throughput_bytes_per_second {:.0f}\n", elapsed > 0 ? static_cast<double>(read) / elapsed : 0.0);
+
+    text += "# HELP cryptoutils_run_start_time_seconds Unix time the run started.\n";
+    text += "# TYPE cryptoutils_run_start_time_seconds gauge\n";
+    text += std::format("cryptoutils_run_start_time_seconds {:.3f}\n", start_time);
+    text += "# HELP cryptoutils_run_duration_seconds Time since the run started, or its total time once finished.\n";
+    text += "# TYPE cryptoutils_run_duration_seconds gauge\n";
+    text += std::format("cryptoutils_run_duration_seconds {:.3f}\n", elapsed);
+    text += "# HELP cryptoutils_run_in_progress 1 while the run is going, 0 once it has finished.\n";
+    text += "# TYPE cryptoutils_run_in_progress gauge\n";
+    text += std::format("cryptoutils_run_in_progress {}\n", running ? 1 : 0);
+
+    return text;
+}
+
+void Metrics::write_file(bool running) {
+    std::string text = render(running);
+
+    // The collector only reads `*.prom`, so the temp file is never picked up half-written
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) throw FileError(std::format("Error opening metrics file `{}`", temp_path));
+        out << text;
+        out.flush();
+        if (!out) throw FileError(std::format("Error writing metrics file `{}`", temp_path));
+    }
+
+    std::error_code rename_error;
+    std::filesystem::rename(temp_path, path, rename_error);
+    if (rename_error) throw FileError(std::format("Error replacing metrics file `{}`: {}", path, rename_error.message()));
+}
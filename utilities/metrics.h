@@ -0,0 +1,88 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * @brief Run metrics in the Prometheus text exposition format, written for node_exporter's
+ * textfile collector. The file is replaced atomically (temp file + rename) every `interval`
+ * while running and once more at the end, so a scrape never sees a half-written file
+ */
+class Metrics {
+public:
+    explicit Metrics(const std::string& path, std::chrono::seconds interval = std::chrono::seconds(15));
+
+    // Writes the final metrics if finish() wasn't called, so a failed run is still recorded
+    ~Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // Called from the I/O layer
+    void add_read(uint64_t bytes) { bytes_read.fetch_add(bytes, std::memory_order_relaxed); }
+    void add_written(uint64_t bytes) { bytes_written.fetch_add(bytes, std::memory_order_relaxed); }
+
+    void begin_file();
+
+    // Records one file. On success, bytes that didn't go through the I/O layer (indexed, store
+    // and pack formats) are topped up from the input and output sizes
+    void end_file(bool ok, bool auth_failure, uint64_t input_size, uint64_t output_size);
+
+    // Stops the timer thread and writes the final file. Throws FileError if it can't be written
+    void finish();
+
+private:
+    void run();
+    std::string render(bool running);
+    void write_file(bool running);
+
+    static constexpr double DURATION_BUCKETS[]{ 0.1, 1, 10, 60, 300, 900, 3600, 14400 };
+    static constexpr size_t BUCKET_COUNT{ std::size(DURATION_BUCKETS) };
+
+    std::string path;
+    std::chrono::seconds interval;
+
+    std::atomic<uint64_t> bytes_read{ 0 };
+    std::atomic<uint64_t> bytes_written{ 0 };
+
+    // Everything below is guarded by `mutex`
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping{ false };
+    bool finished{ false };
+    uint64_t files_ok{ 0 };
+    uint64_t files_failed{ 0 };
+    uint64_t auth_failures{ 0 };
+    uint64_t duration_counts[BUCKET_COUNT + 1]{};
+    double duration_sum{ 0 };
+    uint64_t file_read_start{ 0 };
+    uint64_t file_written_start{ 0 };
+    std::chrono::steady_clock::time_point file_started;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::system_clock::time_point started_wall;
+
+    std::thread timer;
+};
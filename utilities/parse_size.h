@@ -0,0 +1,54 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <cstdint>
+
+#include "exception.h"
+
+/*
+ * @brief Parses a byte count such as `4096`, `64K`, `500M` or `2G` (binary multiples)
+ * @throws UtilException if `text` isn't one
+ */
+inline uint64_t parse_size(const std::string& text) {
+    // std::stoull would skip leading whitespace and wrap a negative number around
+    if (text.empty() || text[0] < '0' || text[0] > '9') throw UtilException("Invalid size `" + text + '`');
+
+    size_t suffix_pos = 0;
+    uint64_t value = 0;
+    try {
+        value = std::stoull(text, &suffix_pos);
+    }
+    catch (const std::exception&) {
+        throw UtilException("Invalid size `" + text + '`');
+    }
+
+    std::string suffix = text.substr(suffix_pos);
+    if (suffix.empty()) return value;
+    if (suffix.size() > 1) throw UtilException("Invalid size `" + text + '`');
+
+    int shift = 0;
+    switch (suffix[0]) {
+    case 'K': case 'k': shift = 10; break;
+    case 'M': case 'm': shift = 20; break;
+    case 'G': case 'g': shift = 30; break;
+    default: throw UtilException("Invalid size `" + text + '`');
+    }
+    if (value > (UINT64_MAX >> shift)) throw UtilException("Size `" + text + "` is too large");
+    return value << shift;
+}
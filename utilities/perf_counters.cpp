@@ -0,0 +1,163 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <ostream>
+#include <format>
+#include <string>
+#include <cstring>
+
+#include "perf_counters.h"
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+#if defined(__linux__)
+    struct EventSpec {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    constexpr EventSpec EVENT_SPECS[]{
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
+
+    int open_event(const EventSpec& spec, bool exclude_kernel) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = spec.type;
+        attr.config = spec.config;
+        attr.exclude_kernel = exclude_kernel;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // Count worker threads too
+        // With more events than hardware counters the kernel multiplexes them, so read how long each one ran
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+}
+
+PerfCounters::PerfCounters() {
+    for (int& fd : fds) fd = -1;
+
+#if defined(__linux__)
+    // Counting kernel time too needs perf_event_paranoid <= 1; otherwise settle for user space
+    for (size_t i = 0; i < EVENT_COUNT; ++i) fds[i] = open_event(EVENT_SPECS[i], false);
+    if (fds[0] < 0 && fds[3] < 0) {
+        user_only = true;
+        for (size_t i = 0; i < EVENT_COUNT; ++i) {
+            if (fds[i] >= 0) close(fds[i]);
+            fds[i] = open_event(EVENT_SPECS[i], true);
+        }
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+#endif
+}
+
+bool PerfCounters::available() const {
+    for (int fd : fds) {
+        if (fd >= 0) return true;
+    }
+    return false;
+}
+
+void PerfCounters::read_all(uint64_t* values) const {
+    for (size_t i = 0; i < EVENT_COUNT; ++i) {
+        values[i] = 0;
+#if defined(__linux__)
+        // value, time enabled, time running; a multiplexed count is scaled up to the whole time enabled
+        uint64_t sample[3];
+        if (fds[i] >= 0 && read(fds[i], sample, sizeof(sample)) == sizeof(sample) && sample[2] > 0) {
+            values[i] = sample[2] >= sample[1] ? sample[0] :
+                static_cast<uint64_t>(static_cast<double>(sample[0]) * static_cast<double>(sample[1]) / static_cast<double>(sample[2]));
+        }
+#endif
+    }
+}
+
+PerfCounters::Scope::Scope(PerfCounters* counters, PerfStage stage) : counters(counters), stage(stage) {
+    if (counters) counters->read_all(start);
+}
+
+PerfCounters::Scope::~Scope() {
+    if (!counters) return;
+
+    uint64_t end[EVENT_COUNT];
+    counters->read_all(end);
+    // Scaled counts are estimates, so one can come out a little lower at the end than at the start
+    for (size_t i = 0; i < EVENT_COUNT; ++i) counters->totals[static_cast<size_t>(stage)][i] += end[i] > start[i] ? end[i] - start[i] : 0;
+}
+
+void PerfCounters::report(std::ostream& out) const {
+    if (!available()) {
+        out << "Performance counters are unavailable (no PMU, or kernel.perf_event_paranoid is too strict)" << std::endl;
+        return;
+    }
+
+    auto column = [&](size_t event, uint64_t value) -> std::string {
+        return fds[event] >= 0 ? std::to_string(value) : std::string("n/a");
+    };
+
+    auto print_row = [&](const char* name, const uint64_t* values) {
+        bool have_cycles = fds[static_cast<size_t>(PerfEvent::Cycles)] >= 0;
+        bool have_instructions = fds[static_cast<size_t>(PerfEvent::Instructions)] >= 0;
+        uint64_t cycles = values[static_cast<size_t>(PerfEvent::Cycles)];
+        uint64_t instructions = values[static_cast<size_t>(PerfEvent::Instructions)];
+
+        std::string cycles_per_byte = have_cycles && bytes ? std::format("{:.2f}", static_cast<double>(cycles) / bytes) : "n/a";
+        std::string ipc = have_cycles && have_instructions && cycles ? std::format("{:.2f}", static_cast<double>(instructions) / cycles) : "n/a";
+
+        out << std::format("{:<8} {:>12} {:>8} {:>14} {:>14}", name, cycles_per_byte, ipc,
+            column(static_cast<size_t>(PerfEvent::LlcMisses), values[static_cast<size_t>(PerfEvent::LlcMisses)]),
+            column(static_cast<size_t>(PerfEvent::ContextSwitches), values[static_cast<size_t>(PerfEvent::ContextSwitches)])) << std::endl;
+    };
+
+    out << std::format("Performance counters over {} bytes of plain streams{}:", bytes, user_only ? " (user space only)" : "") << std::endl;
+    out << std::format("{:<8} {:>12} {:>8} {:>14} {:>14}", "stage", "cycles/byte", "IPC", "LLC misses", "ctx switches") << std::endl;
+
+    const uint64_t* read_totals = totals[static_cast<size_t>(PerfStage::Read)];
+    const uint64_t* write_totals = totals[static_cast<size_t>(PerfStage::Write)];
+    const uint64_t* all_totals = totals[static_cast<size_t>(PerfStage::Total)];
+
+    // Whatever the run spent outside read and write syscalls went to sealing/opening chunks and copying them
+    uint64_t crypto_totals[EVENT_COUNT];
+    for (size_t i = 0; i < EVENT_COUNT; ++i) {
+        uint64_t io = read_totals[i] + write_totals[i];
+        crypto_totals[i] = all_totals[i] > io ? all_totals[i] - io : 0;
+    }
+
+    print_row("read", read_totals);
+    print_row("crypto", crypto_totals);
+    print_row("write", write_totals);
+    print_row("total", all_totals);
+}
@@ -0,0 +1,77 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+enum class PerfStage { Read, Write, Total, Count };
+
+enum class PerfEvent { Cycles, Instructions, LlcMisses, ContextSwitches, Count };
+
+/*
+ * @brief Hardware and software performance counters (Linux perf_event_open) split by stage.
+ * Counters the kernel won't give us (no PMU in a VM, perf_event_paranoid too high) are
+ * reported as unavailable and everything else keeps working
+ */
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const;
+
+    // Adds input bytes processed under the total stage. Only plain streams are scoped, so only their bytes count
+    void add_bytes(uint64_t count) { bytes += count; }
+
+    // Prints cycles/byte, IPC, LLC misses and context switches per stage over the added bytes.
+    // Time not spent in read or write syscalls is reported as the crypto stage
+    void report(std::ostream& out) const;
+
+    /*
+     * @brief Adds the counts between construction and destruction to `stage`. A null
+     * `counters` makes it a no-op, so call sites don't need to check
+     */
+    class Scope {
+    public:
+        Scope(PerfCounters* counters, PerfStage stage);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        PerfCounters* counters;
+        PerfStage stage;
+        uint64_t start[static_cast<size_t>(PerfEvent::Count)]{};
+    };
+
+private:
+    void read_all(uint64_t* values) const;
+
+    static constexpr size_t EVENT_COUNT{ static_cast<size_t>(PerfEvent::Count) };
+    static constexpr size_t STAGE_COUNT{ static_cast<size_t>(PerfStage::Count) };
+
+    int fds[EVENT_COUNT];
+    bool user_only{ false };
+    uint64_t totals[STAGE_COUNT][EVENT_COUNT]{};
+    uint64_t bytes{ 0 };
+};
@@ -0,0 +1,220 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <format>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+
+#include "progress.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace {
+    constexpr double MEBIBYTE{ 1024.0 * 1024.0 };
+
+    bool stderr_is_terminal() {
+#if defined(_WIN32)
+        return _isatty(_fileno(stderr)) != 0;
+#else
+        return isatty(STDERR_FILENO) != 0;
+#endif
+    }
+
+    std::string human_bytes(uint64_t bytes) {
+        const char* units[]{ "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+        double value = static_cast<double>(bytes);
+        size_t unit = 0;
+        while (value >= 1024.0 && unit + 1 < std::size(units)) {
+            value /= 1024.0;
+            ++unit;
+        }
+        return unit == 0 ? std::format("{} B", bytes) : std::format("{:.2f} {}", value, units[unit]);
+    }
+
+    std::string human_duration(double seconds) {
+        uint64_t total = static_cast<uint64_t>(seconds + 0.5);
+        return std::format("{}:{:02}:{:02}", total / 3600, total / 60 % 60, total % 60);
+    }
+
+    std::string json_escape(const std::string& text) {
+        std::string escaped;
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += static_cast<char>(c);
+            }
+            else if (c < 0x20) escaped += std::format("\\u{:04x}", static_cast<unsigned>(c));
+            else escaped += static_cast<char>(c);
+        }
+        return escaped;
+    }
+}
+
+/*
+ * @brief Sits in front of std::cout while a progress line is on the terminal and wipes
+ * the line before anything else is printed, so messages don't land on the end of it
+ */
+class Progress::ClearingBuf : public std::streambuf {
+public:
+    ClearingBuf(Progress& progress, std::streambuf* target) : progress(progress), target(target) {}
+
+protected:
+    int overflow(int c) override {
+        clear_line();
+        return c == traits_type::eof() ? traits_type::not_eof(c) : target->sputc(static_cast<char>(c));
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        clear_line();
+        return target->sputn(data, size);
+    }
+
+    int sync() override {
+        return target->pubsync();
+    }
+
+private:
+    void clear_line() {
+        std::lock_guard<std::mutex> lock(progress.mutex);
+        if (!progress.line_drawn) return;
+        std::fputs("\r\033[K", stderr);
+        std::fflush(stderr);
+        progress.line_drawn = false;
+    }
+
+    Progress& progress;
+    std::streambuf* target;
+};
+
+Progress::Progress(ProgressFormat format, uint64_t total_bytes, size_t total_files, std::chrono::milliseconds interval)
+    : format(format), total_bytes(total_bytes), total_files(total_files), interval(interval),
+      on_terminal(format == ProgressFormat::Text && stderr_is_terminal()) {
+    started = std::chrono::steady_clock::now();
+    last_sample_time = started;
+
+    if (on_terminal) {
+        stdout_buf = std::make_unique<ClearingBuf>(*this, std::cout.rdbuf());
+        original_stdout_buf = std::cout.rdbuf(stdout_buf.get());
+    }
+
+    timer = std::thread([this] { run(); });
+}
+
+Progress::~Progress() {
+    finish();
+}
+
+void Progress::begin_file(const std::string& name, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    file_name = name;
+    file_size = size;
+    file_start = done.load(std::memory_order_relaxed);
+    ++file_index;
+}
+
+void Progress::end_file() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Formats that don't read through InputFile (indexed, store) only show up here
+    uint64_t file_end = file_start + file_size;
+    uint64_t current = done.load(std::memory_order_relaxed);
+    if (current < file_end) done.fetch_add(file_end - current, std::memory_order_relaxed);
+}
+
+void Progress::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return;
+        stopping = true;
+    }
+    wake.notify_all();
+    timer.join();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        print(true);
+    }
+
+    if (original_stdout_buf) {
+        std::cout.flush();
+        std::cout.rdbuf(original_stdout_buf);
+        original_stdout_buf = nullptr;
+    }
+}
+
+void Progress::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+        print(false);
+    }
+}
+
+void Progress::print(bool final) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t bytes = done.load(std::memory_order_relaxed);
+
+    double elapsed = std::chrono::duration<double>(now - started).count();
+    double since_sample = std::chrono::duration<double>(now - last_sample_time).count();
+    double rate = since_sample > 0 ? static_cast<double>(bytes - last_sample_bytes) / since_sample : 0;
+    double average = elapsed > 0 ? static_cast<double>(bytes) / elapsed : 0;
+    last_sample_time = now;
+    last_sample_bytes = bytes;
+
+    // The ETA follows a smoothed current rate, so it reacts to throttling changes without jumping around
+    smoothed_rate = smoothed_rate == 0 ? rate : 0.3 * rate + 0.7 * smoothed_rate;
+    uint64_t remaining = total_bytes > bytes ? total_bytes - bytes : 0;
+    double eta = smoothed_rate > 0 ? static_cast<double>(remaining) / smoothed_rate : -1;
+
+    uint64_t file_done = std::min(bytes - std::min(bytes, file_start), file_size);
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole > 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 100.0;
+    };
+
+    std::string line;
+    if (format == ProgressFormat::Json) {
+        line = std::format("{{\"file\":\"{}\",\"file_index\":{},\"files\":{},\"file_bytes\":{},\"file_size\":{},"
+            "\"bytes\":{},\"total_bytes\":{},\"rate_mib_s\":{:.2f},\"average_mib_s\":{:.2f},\"eta_s\":{:.0f},\"elapsed_s\":{:.1f},\"done\":{}}}",
+            json_escape(file_name), file_index, total_files, file_done, file_size, bytes, total_bytes,
+            rate / MEBIBYTE, average / MEBIBYTE, final ? 0.0 : eta, elapsed, final ? "true" : "false");
+    }
+    else {
+        if (total_files > 1) line += std::format("[{}/{}] ", file_index, total_files);
+        line += std::format("{}: {} / {} ({:.1f}%)", file_name, human_bytes(file_done), human_bytes(file_size), percent(file_done, file_size));
+        if (total_files > 1) line += std::format(", total {} / {} ({:.1f}%)", human_bytes(bytes), human_bytes(total_bytes), percent(bytes, total_bytes));
+        line += std::format(", {:.1f} MiB/s now, {:.1f} MiB/s avg", rate / MEBIBYTE, average / MEBIBYTE);
+        if (final) line += std::format(", took {}", human_duration(elapsed));
+        else line += std::format(", ETA {}", eta < 0 ? std::string("--:--:--") : human_duration(eta));
+    }
+
+    // On a terminal the line is redrawn in place; anywhere else each update is its own line
+    if (on_terminal) {
+        std::fputs(("\r" + line + "\033[K").c_str(), stderr);
+        if (final) std::fputs("\n", stderr);
+        line_drawn = !final;
+    }
+    else {
+        std::fputs((line + "\n").c_str(), stderr);
+    }
+    std::fflush(stderr);
+}
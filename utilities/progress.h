@@ -0,0 +1,90 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <streambuf>
+#include <cstddef>
+#include <cstdint>
+
+enum class ProgressFormat { Text, Json };
+
+/*
+ * @brief Reports bytes done, current and average throughput and ETA on stderr while
+ * files are processed. The I/O layer only bumps a relaxed atomic counter; a timer thread
+ * samples it and does all the formatting, so the chunk loop pays nothing extra
+ */
+class Progress {
+public:
+    Progress(ProgressFormat format, uint64_t total_bytes, size_t total_files,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+    // Stops the timer thread and prints the final line
+    ~Progress();
+
+    Progress(const Progress&) = delete;
+    Progress& operator=(const Progress&) = delete;
+
+    // Called from the I/O layer as input is read
+    void add(uint64_t bytes) { done.fetch_add(bytes, std::memory_order_relaxed); }
+
+    // Marks the start of the next file in a batch; `size` is its input size
+    void begin_file(const std::string& name, uint64_t size);
+
+    // Counts the file as fully done, even if part of it was read outside the I/O layer
+    void end_file();
+
+    void finish();
+
+private:
+    class ClearingBuf;
+
+    void run();
+    void print(bool final);
+
+    ProgressFormat format;
+    uint64_t total_bytes;
+    size_t total_files;
+    std::chrono::milliseconds interval;
+    bool on_terminal;
+
+    std::atomic<uint64_t> done{ 0 };
+
+    // Everything below is guarded by `mutex`
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping{ false };
+    bool line_drawn{ false };
+    std::string file_name;
+    size_t file_index{ 0 };
+    uint64_t file_start{ 0 };
+    uint64_t file_size{ 0 };
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point last_sample_time;
+    uint64_t last_sample_bytes{ 0 };
+    double smoothed_rate{ 0 };
+
+    std::unique_ptr<ClearingBuf> stdout_buf;
+    std::streambuf* original_stdout_buf{ nullptr };
+    std::thread timer;
+};
@@ -0,0 +1,226 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "source_sink.h"
+#include "exception.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+#if defined(_WIN32)
+    long long read_some(int fd, unsigned char* data, size_t size) { return _read(fd, data, static_cast<unsigned int>(size)); }
+    long long write_some(int fd, const unsigned char* data, size_t size) { return _write(fd, data, static_cast<unsigned int>(size)); }
+#else
+    long long read_some(int fd, unsigned char* data, size_t size) { return ::read(fd, data, size); }
+    long long write_some(int fd, const unsigned char* data, size_t size) { return ::write(fd, data, size); }
+#endif
+}
+
+std::span<const unsigned char> Source::borrow(size_t max) {
+    if (scratch.size() < max) scratch = BufferPool::instance().acquire(max);
+    size_t count = read_into({ scratch.data(), max });
+    return { scratch.data(), count };
+}
+
+size_t FdSource::read_into(std::span<unsigned char> buffer) {
+    // Pipes and sockets return whatever has arrived, so keep reading until full or at the end
+    size_t filled = 0;
+    while (filled < buffer.size()) {
+        long long result = read_some(fd, buffer.data() + filled, buffer.size() - filled);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            throw FileError(std::string("Error: Couldn't read the input: ") + std::strerror(errno));
+        }
+        if (result == 0) break;
+        filled += static_cast<size_t>(result);
+    }
+    return filled;
+}
+
+uint64_t FdSource::size() const {
+#if defined(_WIN32)
+    struct _stat64 info;
+    if (_fstat64(fd, &info) != 0 || !(info.st_mode & _S_IFREG)) return UNKNOWN_SIZE;
+#else
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) return UNKNOWN_SIZE;
+#endif
+    return static_cast<uint64_t>(info.st_size);
+}
+
+void FdSink::write(std::span<const unsigned char> data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        long long result = write_some(fd, data.data() + offset, data.size() - offset);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            throw FileError(std::string("Error: Couldn't write the output: ") + std::strerror(errno));
+        }
+        offset += static_cast<size_t>(result);
+    }
+}
+
+#if defined(_WIN32)
+MmapSource::MmapSource(const std::string&) {
+    throw UtilException("Memory-mapped input is only supported on POSIX systems");
+}
+
+MmapSource::~MmapSource() {
+}
+#else
+MmapSource::MmapSource(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw FileError("Error: Couldn't open input file `" + path + '`');
+    }
+
+    // An empty file can't be mapped, and has nothing to map anyway
+    length = static_cast<size_t>(info.st_size);
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw FileError("Error: Couldn't map input file `" + path + "`: " + std::strerror(errno));
+        }
+        mapping = static_cast<unsigned char*>(mapped);
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+}
+
+MmapSource::~MmapSource() {
+    if (mapping) munmap(mapping, length);
+}
+#endif
+
+size_t MmapSource::read_into(std::span<unsigned char> buffer) {
+    std::span<const unsigned char> bytes = borrow(buffer.size());
+    if (!bytes.empty()) std::memcpy(buffer.data(), bytes.data(), bytes.size());
+    return bytes.size();
+}
+
+std::span<const unsigned char> MmapSource::borrow(size_t max) {
+    size_t count = std::min(max, length - position);
+    std::span<const unsigned char> bytes{ mapping + position, count };
+    position += count;
+    return bytes;
+}
+
+size_t MemorySource::read_into(std::span<unsigned char> buffer) {
+    std::span<const unsigned char> bytes = borrow(buffer.size());
+    if (!bytes.empty()) std::memcpy(buffer.data(), bytes.data(), bytes.size());
+    return bytes.size();
+}
+
+std::span<const unsigned char> MemorySource::borrow(size_t max) {
+    size_t count = std::min(max, data.size() - position);
+    std::span<const unsigned char> bytes = data.subspan(position, count);
+    position += count;
+    return bytes;
+}
+
+BufferedSource::BufferedSource(Source& inner, size_t buffer_size)
+    : inner(inner), buffer(BufferPool::instance().acquire(buffer_size)) {
+}
+
+void BufferedSource::fill(size_t wanted) {
+    if (end - position >= wanted || ended) return;
+
+    if (position > 0) {
+        std::memmove(buffer.data(), buffer.data() + position, end - position);
+        end -= position;
+        position = 0;
+    }
+
+    size_t count = inner.read_into({ buffer.data() + end, buffer.size() - end });
+    if (end + count < buffer.size()) ended = true;
+    end += count;
+}
+
+size_t BufferedSource::read_into(std::span<unsigned char> request) {
+    size_t filled = 0;
+    while (filled < request.size()) {
+        // Large reads skip the buffer once it's drained
+        if (position == end && request.size() - filled >= buffer.size() && !ended) {
+            size_t count = inner.read_into(request.subspan(filled));
+            filled += count;
+            if (filled < request.size()) ended = true;
+            break;
+        }
+
+        fill(1);
+        if (position == end) break;
+
+        size_t count = std::min(request.size() - filled, end - position);
+        std::memcpy(request.data() + filled, buffer.data() + position, count);
+        position += count;
+        filled += count;
+    }
+    return filled;
+}
+
+std::span<const unsigned char> BufferedSource::borrow(size_t max) {
+    if (max > buffer.size()) return Source::borrow(max);
+
+    fill(max);
+    size_t count = std::min(max, end - position);
+    std::span<const unsigned char> bytes{ buffer.data() + position, count };
+    position += count;
+    return bytes;
+}
+
+BufferedSink::BufferedSink(Sink& inner, size_t buffer_size)
+    : inner(inner), buffer(BufferPool::instance().acquire(buffer_size)) {
+}
+
+void BufferedSink::write(std::span<const unsigned char> data) {
+    if (used + data.size() > buffer.size()) flush();
+
+    // Writes as big as the buffer gain nothing from a copy
+    if (data.size() >= buffer.size()) {
+        inner.write(data);
+        return;
+    }
+
+    std::memcpy(buffer.data() + used, data.data(), data.size());
+    used += data.size();
+}
+
+void BufferedSink::flush() {
+    if (used == 0) return;
+    inner.write({ buffer.data(), used });
+    used = 0;
+}
+
+void BufferedSink::close() {
+    flush();
+    inner.close();
+}
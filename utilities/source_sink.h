@@ -0,0 +1,228 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <span>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "file_io.h"
+#include "buffer_pool.h"
+
+/*
+ * Byte sources and sinks the chunk loops of `encrypt()` and `decrypt()` run against, so an I/O
+ * strategy can be swapped (or benchmarked) without touching the crypto code. Backends that
+ * already hold their data in memory hand it out through `borrow()` without copying
+ */
+
+constexpr uint64_t UNKNOWN_SIZE{ UINT64_MAX };
+
+class Source {
+public:
+    virtual ~Source() = default;
+
+    // Fills `buffer`; returns fewer bytes only at the end of the input
+    virtual size_t read_into(std::span<unsigned char> buffer) = 0;
+
+    /*
+     * @brief Returns a view of the next `max` bytes, or fewer only at the end of the input. The view
+     * is valid until the next call. By default the bytes are copied into a scratch buffer
+     */
+    virtual std::span<const unsigned char> borrow(size_t max);
+
+    // The input size if it's known up front
+    virtual uint64_t size() const { return UNKNOWN_SIZE; }
+
+    // Bytes read ahead but not consumed yet
+    virtual size_t buffered() const { return 0; }
+
+private:
+    PooledBuffer scratch;
+};
+
+class Sink {
+public:
+    virtual ~Sink() = default;
+
+    virtual void write(std::span<const unsigned char> data) = 0;
+
+    // Best effort: the final size, for backends that can reserve space
+    virtual void reserve(uint64_t) {}
+
+    // Writes out anything held back and finishes the output. Throws FileError on failure
+    virtual void close() {}
+
+    // Bytes accepted by write() that haven't been written out yet
+    virtual size_t pending() const { return 0; }
+};
+
+/*
+ * @brief A file read through InputFile, with its buffering, O_DIRECT, cache dropping and throttling
+ */
+class FileSource : public Source {
+public:
+    explicit FileSource(const std::string& path, const IoOptions& options = {}) : input_file(path, options) {}
+
+    size_t read_into(std::span<unsigned char> buffer) override { return input_file.read(buffer.data(), buffer.size()); }
+    uint64_t size() const override { return input_file.size(); }
+    size_t buffered() const override { return input_file.buffered(); }
+    void close() { input_file.close(); }
+
+private:
+    InputFile input_file;
+};
+
+/*
+ * @brief A file written through OutputFile, with its buffering, preallocation, O_DIRECT and throttling
+ */
+class FileSink : public Sink {
+public:
+    explicit FileSink(const std::string& path, const IoOptions& options = {}) : output_file(path, options) {}
+
+    void write(std::span<const unsigned char> data) override { output_file.write(data.data(), data.size()); }
+    void reserve(uint64_t size) override { output_file.preallocate(size); }
+    void close() override { output_file.close(); }
+    size_t pending() const override { return output_file.pending(); }
+
+private:
+    OutputFile output_file;
+};
+
+/*
+ * @brief Unbuffered reads from a descriptor the caller owns: a file, pipe, socket or standard input.
+ * Every read is a syscall, so wrap it in a BufferedSource for small reads
+ */
+class FdSource : public Source {
+public:
+    explicit FdSource(int fd) : fd(fd) {}
+
+    size_t read_into(std::span<unsigned char> buffer) override;
+    uint64_t size() const override;
+
+private:
+    int fd;
+};
+
+/*
+ * @brief Unbuffered writes to a descriptor the caller owns. Every write is a syscall, so wrap it in
+ * a BufferedSink for small writes
+ */
+class FdSink : public Sink {
+public:
+    explicit FdSink(int fd) : fd(fd) {}
+
+    void write(std::span<const unsigned char> data) override;
+
+private:
+    int fd;
+};
+
+/*
+ * @brief A whole file mapped read-only. `borrow()` hands out the mapping itself, so the crypto loop
+ * reads straight from the page cache without a copy. POSIX only
+ */
+class MmapSource : public Source {
+public:
+    explicit MmapSource(const std::string& path);
+    ~MmapSource() override;
+
+    MmapSource(const MmapSource&) = delete;
+    MmapSource& operator=(const MmapSource&) = delete;
+
+    size_t read_into(std::span<unsigned char> buffer) override;
+    std::span<const unsigned char> borrow(size_t max) override;
+    uint64_t size() const override { return length; }
+
+private:
+    unsigned char* mapping{ nullptr };
+    size_t length{ 0 };
+    size_t position{ 0 };
+};
+
+/*
+ * @brief Bytes already in memory, which must outlive the source. `borrow()` doesn't copy
+ */
+class MemorySource : public Source {
+public:
+    explicit MemorySource(std::span<const unsigned char> data) : data(data) {}
+
+    size_t read_into(std::span<unsigned char> buffer) override;
+    std::span<const unsigned char> borrow(size_t max) override;
+    uint64_t size() const override { return data.size(); }
+
+private:
+    std::span<const unsigned char> data;
+    size_t position{ 0 };
+};
+
+/*
+ * @brief Appends everything written to a vector the caller owns
+ */
+class MemorySink : public Sink {
+public:
+    explicit MemorySink(std::vector<unsigned char>& data) : data(data) {}
+
+    void write(std::span<const unsigned char> bytes) override { data.insert(data.end(), bytes.begin(), bytes.end()); }
+    void reserve(uint64_t size) override { data.reserve(data.size() + size); }
+
+private:
+    std::vector<unsigned char>& data;
+};
+
+/*
+ * @brief Reads another source in large blocks and serves small reads and borrows from the block
+ */
+class BufferedSource : public Source {
+public:
+    explicit BufferedSource(Source& inner, size_t buffer_size = 256 * 1024);
+
+    size_t read_into(std::span<unsigned char> buffer) override;
+    std::span<const unsigned char> borrow(size_t max) override;
+    uint64_t size() const override { return inner.size(); }
+    size_t buffered() const override { return end - position; }
+
+private:
+    // Moves what's left to the front and tops the buffer up to at least `wanted` bytes, unless the input ends
+    void fill(size_t wanted);
+
+    Source& inner;
+    PooledBuffer buffer;
+    size_t position{ 0 };
+    size_t end{ 0 };
+    bool ended{ false };
+};
+
+/*
+ * @brief Collects small writes into large ones for another sink. `close()` flushes and closes the inner sink
+ */
+class BufferedSink : public Sink {
+public:
+    explicit BufferedSink(Sink& inner, size_t buffer_size = 256 * 1024);
+
+    void write(std::span<const unsigned char> data) override;
+    void reserve(uint64_t size) override { inner.reserve(size); }
+    void close() override;
+    size_t pending() const override { return used + inner.pending(); }
+
+private:
+    void flush();
+
+    Sink& inner;
+    PooledBuffer buffer;
+    size_t used{ 0 };
+};
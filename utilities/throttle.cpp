@@ -0,0 +1,146 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <csignal>
+#include <cctype>
+
+#include "throttle.h"
+#include "parse_size.h"
+#include "exception.h"
+
+namespace {
+    // A bucket holds at most this long a stretch of traffic, which caps bursts after an idle spell
+    constexpr double BURST_SECONDS{ 0.05 };
+
+    // How often the control file is checked for changes
+    constexpr auto CONTROL_POLL_INTERVAL{ std::chrono::seconds(1) };
+
+    std::atomic<bool> reload_requested{ false };
+
+    extern "C" void request_reload(int) {
+        reload_requested.store(true, std::memory_order_relaxed);
+    }
+}
+
+void TokenBucket::set_rate(uint64_t new_rate) {
+    rate = static_cast<double>(new_rate);
+    tokens = std::min(tokens, rate * BURST_SECONDS);
+}
+
+std::chrono::nanoseconds TokenBucket::take(double amount, std::chrono::steady_clock::time_point now) {
+    if (rate <= 0) return std::chrono::nanoseconds(0);
+
+    if (last_refill.time_since_epoch().count() == 0) last_refill = now;
+    double elapsed = std::chrono::duration<double>(now - last_refill).count();
+    last_refill = now;
+    tokens = std::min(tokens + elapsed * rate, rate * BURST_SECONDS);
+
+    // Going into debt and sleeping it off paces requests larger than the burst size too
+    tokens -= amount;
+    if (tokens >= 0) return std::chrono::nanoseconds(0);
+    return std::chrono::nanoseconds(static_cast<long long>(-tokens / rate * 1e9));
+}
+
+Throttle::Throttle(const ThrottleLimits& limits, const std::string& control_path) : control_path(control_path) {
+    set_limits(limits);
+}
+
+void Throttle::set_limits(const ThrottleLimits& limits) {
+    read_bucket.set_rate(limits.max_read_bps);
+    write_bucket.set_rate(limits.max_write_bps);
+    iops_bucket.set_rate(limits.max_iops);
+}
+
+void Throttle::before_read(size_t bytes) {
+    acquire(read_bucket, bytes);
+}
+
+void Throttle::before_write(size_t bytes) {
+    acquire(write_bucket, bytes);
+}
+
+void Throttle::acquire(TokenBucket& bandwidth, size_t bytes) {
+    std::chrono::nanoseconds wait{ 0 };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        poll_control_file(now);
+
+        // The request waits for whichever limit it hits last
+        wait = std::max(bandwidth.take(static_cast<double>(bytes), now), iops_bucket.take(1, now));
+    }
+
+    if (wait.count() > 0) std::this_thread::sleep_for(wait);
+}
+
+void Throttle::poll_control_file(std::chrono::steady_clock::time_point now) {
+    if (control_path.empty()) return;
+
+    bool forced = reload_requested.exchange(false, std::memory_order_relaxed);
+    if (!forced && now - last_poll < CONTROL_POLL_INTERVAL) return;
+    last_poll = now;
+
+    std::error_code error;
+    auto mtime = std::filesystem::last_write_time(control_path, error);
+    if (error) return;
+
+    long long mtime_count = static_cast<long long>(mtime.time_since_epoch().count());
+    if (!forced && mtime_count == control_mtime) return;
+    control_mtime = mtime_count;
+
+    std::ifstream control_file(control_path);
+    ThrottleLimits limits;
+    std::string line;
+
+    // A bad line is reported and the current limits are kept, rather than failing a long run
+    try {
+        while (std::getline(control_file, line)) {
+            line.erase(std::remove_if(line.begin(), line.end(), [](unsigned char c) { return std::isspace(c); }), line.end());
+            if (line.empty() || line[0] == '#') continue;
+
+            size_t equals = line.find('=');
+            if (equals == std::string::npos) throw UtilException("Expected `key=value`, got `" + line + '`');
+
+            std::string name = line.substr(0, equals);
+            uint64_t value = parse_size(line.substr(equals + 1));
+
+            if (name == "max-read-bps") limits.max_read_bps = value;
+            else if (name == "max-write-bps") limits.max_write_bps = value;
+            else if (name == "max-iops") limits.max_iops = value;
+            else throw UtilException("Unknown limit `" + name + '`');
+        }
+    }
+    catch (const UtilException& e) {
+        std::cerr << "Warning: Ignoring throttle control file `" << control_path << "`: " << e.what() << std::endl;
+        return;
+    }
+
+    set_limits(limits);
+}
+
+void Throttle::install_reload_signal() {
+#if defined(SIGHUP)
+    std::signal(SIGHUP, request_reload);
+#endif
+}
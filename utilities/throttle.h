@@ -0,0 +1,80 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * @brief Limits enforced by a Throttle. 0 means unlimited
+ */
+struct ThrottleLimits {
+    uint64_t max_read_bps{ 0 };
+    uint64_t max_write_bps{ 0 };
+    uint64_t max_iops{ 0 };
+};
+
+/*
+ * @brief Token-bucket rate limiter. Callers take tokens before each request and are put to
+ * sleep once they run ahead of the rate, so traffic is paced instead of bursting
+ */
+class TokenBucket {
+public:
+    void set_rate(uint64_t rate);
+
+    // Returns how long the caller must wait before issuing a request of `amount`
+    std::chrono::nanoseconds take(double amount, std::chrono::steady_clock::time_point now);
+
+private:
+    double rate{ 0 };
+    double tokens{ 0 };
+    std::chrono::steady_clock::time_point last_refill{};
+};
+
+/*
+ * @brief Read bandwidth, write bandwidth and IOPS limits shared by every file of a run.
+ * The limits can be changed while running through a control file of `key=value` lines
+ * (max-read-bps, max-write-bps, max-iops), which is re-read when it changes or on SIGHUP
+ */
+class Throttle {
+public:
+    explicit Throttle(const ThrottleLimits& limits, const std::string& control_path = "");
+
+    void before_read(size_t bytes);
+    void before_write(size_t bytes);
+
+    void set_limits(const ThrottleLimits& limits);
+
+    // Makes SIGHUP force a re-read of the control file (POSIX only)
+    static void install_reload_signal();
+
+private:
+    void acquire(TokenBucket& bandwidth, size_t bytes);
+    void poll_control_file(std::chrono::steady_clock::time_point now);
+
+    std::mutex mutex;
+    TokenBucket read_bucket;
+    TokenBucket write_bucket;
+    TokenBucket iops_bucket;
+
+    std::string control_path;
+    std::chrono::steady_clock::time_point last_poll{};
+    long long control_mtime{ 0 };
+};
@@ -0,0 +1,128 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <format>
+#include <fstream>
+#include <atomic>
+
+#include "trace.h"
+#include "exception.h"
+
+namespace {
+    // Lets each thread find its buffer without a lock once it has one. Traces are told apart
+    // by id rather than address, since a new one may be allocated where an old one lived
+    struct LocalSlot {
+        uint64_t trace_id{ 0 };
+        void* buffer{ nullptr };
+    };
+
+    thread_local LocalSlot local_slot;
+    std::atomic<uint64_t> next_trace_id{ 1 };
+    std::atomic<uint32_t> next_thread_id{ 1 };
+    thread_local uint32_t local_thread_id{ 0 };
+
+    void write_escaped(std::ofstream& out, const char* text) {
+        for (const char* c = text; *c; ++c) {
+            if (*c == '"' || *c == '\\') out << '\\';
+            out << *c;
+        }
+    }
+
+    // Trace Event timestamps are in microseconds; keep nanosecond precision as a fraction
+    std::string micros(uint64_t ns) {
+        return std::format("{}.{:03}", ns / 1000, ns % 1000);
+    }
+}
+
+Trace::Trace(const std::string& output_path)
+    : output_path(output_path), id(next_trace_id++), origin(std::chrono::steady_clock::now()) {}
+
+Trace::~Trace() {
+    try {
+        finish();
+    }
+    catch (...) {}
+}
+
+uint64_t Trace::now() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - origin).count());
+}
+
+Trace::ThreadBuffer& Trace::local_buffer() {
+    if (local_slot.trace_id == id) return *static_cast<ThreadBuffer*>(local_slot.buffer);
+
+    if (local_thread_id == 0) local_thread_id = next_thread_id++;
+
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->thread_id = local_thread_id;
+    buffer->events.reserve(4096);
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.push_back(std::move(buffer));
+    local_slot = { id, buffers.back().get() };
+    return *buffers.back();
+}
+
+void Trace::span(const char* name, uint64_t start_ns, uint64_t end_ns, uint64_t chunk) {
+    local_buffer().events.push_back({ name, start_ns, end_ns, chunk, false });
+}
+
+void Trace::counter(const char* name, uint64_t value) {
+    local_buffer().events.push_back({ name, now(), value, NO_CHUNK, true });
+}
+
+void Trace::finish() {
+    if (finished) return;
+    finished = true;
+    write_file();
+}
+
+void Trace::write_file() const {
+    std::ofstream out(output_path, std::ios::binary | std::ios::trunc);
+    if (!out) throw FileError(std::format("Error opening trace file `{}`", output_path));
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"encryptor\"}}";
+
+    for (const std::unique_ptr<ThreadBuffer>& buffer : buffers) {
+        out << std::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"thread {}\"}}}}",
+            buffer->thread_id, buffer->thread_id);
+
+        for (const Event& event : buffer->events) {
+            out << ",\n{\"name\":\"";
+            write_escaped(out, event.name);
+
+            if (event.is_counter) {
+                // Counter tracks are per process; the value is shown as a graph under the threads
+                out << std::format("\",\"ph\":\"C\",\"pid\":1,\"tid\":{},\"ts\":{},\"args\":{{\"bytes\":{}}}}}",
+                    buffer->thread_id, micros(event.start_ns), event.end_ns);
+                continue;
+            }
+
+            // Complete events carry begin and end in one record, half the size of B/E pairs
+            out << std::format("\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{}",
+                buffer->thread_id, micros(event.start_ns), micros(event.end_ns - event.start_ns));
+            if (event.chunk != NO_CHUNK) out << std::format(",\"args\":{{\"chunk\":{}}}", event.chunk);
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+    if (!out) throw FileError(std::format("Error writing trace file `{}`", output_path));
+}
@@ -0,0 +1,102 @@
+/*
+* Copyright (C) 2025 Omega493
+
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * @brief Records a timeline of chunk events and queue depths per thread and writes it
+ * in Chrome Trace Event format, which chrome://tracing and Perfetto can load. Each thread
+ * appends to its own buffer, so recording never takes a lock after the first event
+ */
+class Trace {
+public:
+    explicit Trace(const std::string& output_path);
+
+    // Writes the trace if finish() wasn't called, so a failed run still leaves a timeline
+    ~Trace();
+
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    // Records a span of `name` on the calling thread. `chunk` is shown as an argument unless NO_CHUNK
+    void span(const char* name, uint64_t start_ns, uint64_t end_ns, uint64_t chunk);
+
+    // Records the value of a counter track (e.g. bytes waiting in a buffer) at this moment
+    void counter(const char* name, uint64_t value);
+
+    // Writes the trace file; throws FileError if it can't be written
+    void finish();
+
+    uint64_t now() const;
+
+    static constexpr uint64_t NO_CHUNK{ UINT64_MAX };
+
+    /*
+     * @brief Records a span from construction to destruction. A null `trace` makes it
+     * a no-op, so call sites don't need to check
+     */
+    class Scope {
+    public:
+        Scope(Trace* trace, const char* name, uint64_t chunk = NO_CHUNK)
+            : trace(trace), name(name), chunk(chunk), start(trace ? trace->now() : 0) {}
+
+        ~Scope() {
+            if (trace) trace->span(name, start, trace->now(), chunk);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Trace* trace;
+        const char* name;
+        uint64_t chunk;
+        uint64_t start;
+    };
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t start_ns;
+        uint64_t end_ns; // Counter value for counter events
+        uint64_t chunk;
+        bool is_counter;
+    };
+
+    struct ThreadBuffer {
+        uint32_t thread_id;
+        std::vector<Event> events;
+    };
+
+    ThreadBuffer& local_buffer();
+    void write_file() const;
+
+    std::string output_path;
+    uint64_t id;
+    std::chrono::steady_clock::time_point origin;
+    bool finished{ false };
+
+    std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};